@@ -0,0 +1,206 @@
+// Times the intersection kernels in isolation on seeded random inputs, so a
+// kernel rewrite can be judged without a full render in the way.
+//
+//   bench/kernel_bench [--iterations N] [--seed S] [scene.json ...]
+//
+// run from raytracer/, where 'make kernel-bench' builds and runs it. Every
+// scene given (default ../inputs/bunny.json) is loaded and its BVH is
+// traversed with random rays aimed at the scene bounds.
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../objects/sphere.h"
+#include "../objects/triangle.h"
+#include "../objects/plane.h"
+#include "../scene/loaded_scene.h"
+
+// Inputs are drawn per kernel and cycled through, so the timed loop only
+// measures the call itself.
+constexpr int INPUT_COUNT = 4096;
+
+typedef struct KernelResult {
+  std::string name;
+  long long calls;
+  long long hits;
+  double seconds;
+}KernelResult;
+
+static Vec3 randomPoint(std::mt19937& rng, double lo, double hi)
+{
+  std::uniform_real_distribution<double> dist(lo, hi);
+  double x = dist(rng);
+  double y = dist(rng);
+  double z = dist(rng);
+  return Vec3(x, y, z);
+}
+
+static Vec3 randomDirection(std::mt19937& rng)
+{
+  Vec3 d = randomPoint(rng, -1.0, 1.0);
+  while (d.length() < 1e-3)
+    d = randomPoint(rng, -1.0, 1.0);
+  return d.normalize();
+}
+
+// Rays starting outside the unit cube and passing through it, so about
+// half of them hit a primitive placed inside.
+static std::vector<Ray> randomRays(std::mt19937& rng)
+{
+  std::vector<Ray> rays;
+  for (int i = 0; i < INPUT_COUNT; i++)
+  {
+    Vec3 target = randomPoint(rng, -1.0, 1.0);
+    Vec3 origin = target + randomDirection(rng) * 4.0;
+    rays.push_back(Ray(origin, (target - origin).normalize()));
+  }
+  return rays;
+}
+
+static KernelResult timeKernel(const std::string& name, long long iterations,
+  const std::function<bool(long long)>& kernel)
+{
+  long long hits = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (long long i = 0; i < iterations; i++)
+  {
+    if (kernel(i)) hits++;
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return KernelResult{ name, iterations, hits, elapsed.count() };
+}
+
+static void printResult(const KernelResult& result)
+{
+  double ns_per_call = result.seconds * 1e9 / result.calls;
+  std::cout << std::left << std::setw(32) << result.name << std::right << std::fixed
+    << std::setprecision(1) << std::setw(10) << ns_per_call << " ns/call"
+    << std::setprecision(0) << std::setw(14) << result.calls / result.seconds << " rays/s"
+    << std::setprecision(1) << std::setw(8) << 100.0 * result.hits / result.calls << "% hit"
+    << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+static void benchPrimitives(std::mt19937& rng, long long iterations)
+{
+  std::vector<Ray> rays = randomRays(rng);
+  const Interval ray_t(1e-4, INFINITY);
+
+  std::vector<Triangle> triangles;
+  for (int i = 0; i < INPUT_COUNT; i++)
+  {
+    Vec3 center = randomPoint(rng, -0.5, 0.5);
+    Vec3 vertices[3] = { center + randomPoint(rng, -0.5, 0.5),
+      center + randomPoint(rng, -0.5, 0.5), center + randomPoint(rng, -0.5, 0.5) };
+    triangles.push_back(Triangle(vertices, 0));
+  }
+  printResult(timeKernel("Triangle::hit", iterations, [&](long long i) {
+    HitRecord rec;
+    return triangles[i % INPUT_COUNT].hit(rays[(i / INPUT_COUNT + i) % INPUT_COUNT], ray_t, rec);
+  }));
+
+  std::vector<Sphere> spheres;
+  std::uniform_real_distribution<double> radius(0.1, 0.6);
+  for (int i = 0; i < INPUT_COUNT; i++)
+    spheres.push_back(Sphere(randomPoint(rng, -0.5, 0.5), radius(rng), 0));
+  printResult(timeKernel("Sphere::hit", iterations, [&](long long i) {
+    HitRecord rec;
+    return spheres[i % INPUT_COUNT].hit(rays[(i / INPUT_COUNT + i) % INPUT_COUNT], ray_t, rec);
+  }));
+
+  std::vector<AABB> boxes;
+  for (int i = 0; i < INPUT_COUNT; i++)
+    boxes.push_back(AABB(randomPoint(rng, -1.0, 0.0), randomPoint(rng, 0.0, 1.0)));
+  printResult(timeKernel("AABB::hit", iterations, [&](long long i) {
+    return boxes[i % INPUT_COUNT].hit(rays[(i / INPUT_COUNT + i) % INPUT_COUNT], ray_t);
+  }));
+
+  std::vector<Plane> planes(INPUT_COUNT);
+  for (Plane& plane : planes)
+  {
+    plane.point = randomPoint(rng, -0.5, 0.5);
+    plane.normal = randomDirection(rng);
+  }
+  printResult(timeKernel("Plane::hit", iterations, [&](long long i) {
+    HitRecord rec;
+    return planes[i % INPUT_COUNT].hit(rays[(i / INPUT_COUNT + i) % INPUT_COUNT], ray_t, rec);
+  }));
+}
+
+static void benchTraversal(const std::string& scene_filename, std::mt19937& rng, long long iterations)
+{
+  std::ostringstream discarded;
+  std::streambuf* console = std::cout.rdbuf(discarded.rdbuf());
+  RendererInfo options{};
+  LoadedScene loaded_scene(scene_filename, options);
+  std::cout.rdbuf(console);
+
+  // Rays from a sphere around the bounds towards random points inside.
+  const AABB bounds = loaded_scene.scene.world.getAABB();
+  Vec3 lo(bounds[0].min, bounds[1].min, bounds[2].min);
+  Vec3 hi(bounds[0].max, bounds[1].max, bounds[2].max);
+  Vec3 center = (lo + hi) * 0.5;
+  double reach = (hi - lo).length();
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::vector<Ray> rays;
+  for (int i = 0; i < INPUT_COUNT; i++)
+  {
+    Vec3 target(lo.x + unit(rng) * (hi.x - lo.x), lo.y + unit(rng) * (hi.y - lo.y),
+      lo.z + unit(rng) * (hi.z - lo.z));
+    Vec3 origin = center + randomDirection(rng) * reach;
+    rays.push_back(Ray(origin, (target - origin).normalize()));
+  }
+
+  const BvhNode& world = loaded_scene.scene.world;
+  const Interval ray_t(1e-4, INFINITY);
+  std::string name = "BVH " + std::filesystem::path(scene_filename).filename().string()
+    + " (" + std::to_string(loaded_scene.world_objects.size()) + " prims)";
+  printResult(timeKernel(name, iterations, [&](long long i) {
+    HitRecord rec;
+    return world.hit(rays[i % INPUT_COUNT], ray_t, rec);
+  }));
+}
+
+int main(int argc, char* argv[])
+{
+  long long iterations = 2000000;
+  unsigned seed = 12345;
+  std::vector<std::string> scenes;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "--iterations" && i + 1 < argc)
+      iterations = std::stoll(argv[++i]);
+    else if (arg == "--seed" && i + 1 < argc)
+      seed = static_cast<unsigned>(std::stoul(argv[++i]));
+    else if (arg.rfind("--", 0) != 0)
+      scenes.push_back(arg);
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--iterations N] [--seed S] [scene.json ...]" << std::endl;
+      return 1;
+    }
+  }
+  if (scenes.empty())
+    scenes.push_back("../inputs/bunny.json");
+
+  std::cout << iterations << " calls per kernel, seed " << seed << std::endl;
+  std::mt19937 rng(seed);
+  benchPrimitives(rng, iterations);
+  for (const std::string& scene : scenes)
+  {
+    if (!std::filesystem::exists(scene))
+    {
+      std::cerr << "Scene not found: " << scene << std::endl;
+      return 1;
+    }
+    // BVH traversal is orders of magnitude slower than one primitive test.
+    benchTraversal(scene, rng, std::max(1LL, iterations / 20));
+  }
+  return 0;
+}
@@ -1,4 +1,19 @@
 #include "camera.h"
+#include "../render/wavefront_integrator.h"
+#include "../include/morton.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <tuple>
 
 
 Camera::Camera()
@@ -47,63 +62,827 @@ Camera::~Camera()
 {
 }
 
+int workerThreadCount(const RendererInfo& renderer_info, int work_items)
+{
+	int num_threads = renderer_info.thread_count;
+	if (num_threads <= 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	return std::max(1, std::min(num_threads, work_items));
+}
+
+// Cells of a width x height grid, numbered row by row, listed in curve
+// order. Built once per grid shape and kept.
+static const std::vector<int>& curveOrder(int width, int height, PixelOrder order)
+{
+	static std::mutex mutex;
+	static std::map<std::tuple<int, int, PixelOrder>, std::vector<int>> cache;
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<int>& cells = cache[std::make_tuple(width, height, order)];
+	if (cells.empty())
+	{
+		uint32_t n = 1;
+		while (n < static_cast<uint32_t>(std::max(width, height))) n *= 2;
+		std::vector<uint64_t> keys(width * height);
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+				keys[y * width + x] = order == PixelOrder::Morton ? morton2D(x, y) : hilbert2D(n, x, y);
+		}
+		cells.resize(width * height);
+		std::iota(cells.begin(), cells.end(), 0);
+		std::stable_sort(cells.begin(), cells.end(), [&keys](int a, int b) { return keys[a] < keys[b]; });
+	}
+	return cells;
+}
+
+// Calls visit(i, j) for the cells of a rows x cols block in the given
+// order. Curves are laid over a side x side grid, so a tile clipped by the
+// image edge keeps the order of a full one.
+template <typename Visit>
+static void forEachCell(int rows, int cols, int side, PixelOrder order, const Visit& visit)
+{
+	if (order == PixelOrder::Scanline)
+	{
+		for (int i = 0; i < rows; i++)
+		{
+			for (int j = 0; j < cols; j++)
+				visit(i, j);
+		}
+		return;
+	}
+	for (int cell : curveOrder(side, side, order))
+	{
+		int i = cell / side;
+		int j = cell % side;
+		if (i < rows && j < cols)
+			visit(i, j);
+	}
+}
+
 void Camera::render(IN const BaseRayTracer& rendering_technique,
 										OUT std::vector<std::vector<Color>>& image) const
 {
-	image.resize(image_height, std::vector<Color>(image_width, Color(0, 0, 0)));
+	ScopedStageTimer timer(Stage::Render);
+	prepareImage(image);
 
+	const RendererInfo& renderer_info = rendering_technique.renderer_info;
+	const int tile_count = tileCount(renderer_info);
+	const int num_threads = workerThreadCount(renderer_info, tile_count);
 
-	for (int i = 0; i < image_height; ++i)
+	// Workers pull tiles off a shared counter until the image is done.
+	std::atomic<int> next_tile(0);
+	std::vector<std::thread> threads;
+	for (int thread_id = 0; thread_id < num_threads; thread_id++)
 	{
-		for (int j = 0; j < image_width; ++j)
-		{
-			Vec3 pixel_center = q + su * (j + 0.5) + sv * (i + 0.5);
-			Ray primary_ray(position, (pixel_center - position).normalize());
+		threads.emplace_back([this, &rendering_technique, &next_tile,
+			tile_count, &image, thread_id]() {
+			TraceRecorder::setThreadName("render worker " + std::to_string(thread_id));
+			WavefrontIntegrator integrator(rendering_technique);
+			for (int tile = next_tile++; tile < tile_count; tile = next_tile++)
+			{
+				renderTileAt(rendering_technique, integrator, tile, image);
+			}
+			RenderStats::flushThread();
+		});
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
 
-			Color pixel_color = rendering_technique.traceRay(primary_ray);
-			pixel_color = pixel_color.clamp();
-			image[i][j] = pixel_color;
-		}
+void Camera::prepareImage(OUT std::vector<std::vector<Color>>& image) const
+{
+	image.assign(image_height, std::vector<Color>(image_width, Color(0, 0, 0)));
+}
+
+int Camera::tileSize(const RendererInfo& renderer_info) const
+{
+	return renderer_info.integrator == Integrator::Wavefront ? WAVEFRONT_TILE_SIZE : RENDER_TILE_SIZE;
+}
+
+int Camera::tileCount(const RendererInfo& renderer_info) const
+{
+	const int tile_size = tileSize(renderer_info);
+	const int tiles_x = (image_width + tile_size - 1) / tile_size;
+	const int tiles_y = (image_height + tile_size - 1) / tile_size;
+	return tiles_x * tiles_y;
+}
+
+void Camera::tileRect(const RendererInfo& renderer_info, int tile,
+											OUT int& row, OUT int& col, OUT int& rows, OUT int& cols) const
+{
+	const int tile_size = tileSize(renderer_info);
+	const int tiles_x = (image_width + tile_size - 1) / tile_size;
+	const int tiles_y = (image_height + tile_size - 1) / tile_size;
+	if (renderer_info.pixel_order != PixelOrder::Scanline)
+		tile = curveOrder(tiles_x, tiles_y, renderer_info.pixel_order)[tile];
+	row = (tile / tiles_x) * tile_size;
+	col = (tile % tiles_x) * tile_size;
+	rows = std::min(tile_size, image_height - row);
+	cols = std::min(tile_size, image_width - col);
+}
+
+void Camera::renderTileAt(IN const BaseRayTracer& rendering_technique,
+													IN const WavefrontIntegrator& integrator,
+													int tile,
+													OUT std::vector<std::vector<Color>>& image) const
+{
+	const int tile_size = tileSize(rendering_technique.renderer_info);
+	int row, col, rows, cols;
+	tileRect(rendering_technique.renderer_info, tile, row, col, rows, cols);
+	TraceSpan span("tile", "render");
+	span.arg("camera", id);
+	span.arg("row", row);
+	span.arg("col", col);
+	renderTile(rendering_technique, integrator, row, col, tile_size, image);
+}
+
+GBufferKey Camera::gbufferKey(uint64_t geometry_key) const
+{
+	GBufferKey key;
+	const Vec3 view[4] = { position, q, su, sv };
+	for (int k = 0; k < 4; k++)
+	{
+		key.view[3 * k] = view[k].x;
+		key.view[3 * k + 1] = view[k].y;
+		key.view[3 * k + 2] = view[k].z;
+	}
+	key.width = image_width;
+	key.height = image_height;
+	key.geometry = geometry_key;
+	return key;
+}
+
+// Rows are shared out like renderTraversalCost's. The G-buffer's key is
+// left to the caller, which knows the scene.
+void Camera::fillGBuffer(IN const BaseRayTracer& rendering_technique,
+												 OUT GBuffer& gbuffer) const
+{
+	ScopedStageTimer timer(Stage::Render);
+	gbuffer.samples.assign(static_cast<size_t>(image_width) * image_height, GBufferSample());
+
+	const int num_threads = workerThreadCount(rendering_technique.renderer_info, image_height);
+	std::atomic<int> next_row(0);
+	std::vector<std::thread> threads;
+	for (int thread_id = 0; thread_id < num_threads; thread_id++)
+	{
+		threads.emplace_back([this, &rendering_technique, &next_row, &gbuffer]() {
+			for (int i = next_row++; i < image_height; i = next_row++)
+			{
+				for (int j = 0; j < image_width; ++j)
+					storePrimaryHit(rendering_technique, i, j, gbuffer);
+			}
+			RenderStats::flushThread();
+		});
 	}
-	/*
-	const int numThreads = std::thread::hardware_concurrency();
-	std::vector<std::thread> threads(numThreads);
-	for (int threadId = 0; threadId < numThreads; threadId++)
+	for (auto& thread : threads)
 	{
-		threads[threadId] = std::thread([this, &world, threadId, numThreads, 
-			&rendering_technique, &background_color, &light_sources,
-			&material_manager, &renderer_info, &image]() {
-			//int k = 0;
-			for (int i = threadId; i < image_height; i+=numThreads)
+		thread.join();
+	}
+}
+
+void Camera::renderFromGBuffer(IN const BaseRayTracer& rendering_technique,
+															 IN const GBuffer& gbuffer,
+															 OUT std::vector<std::vector<Color>>& image) const
+{
+	ScopedStageTimer timer(Stage::Render);
+	prepareImage(image);
+
+	const int num_threads = workerThreadCount(rendering_technique.renderer_info, image_height);
+	std::atomic<int> next_row(0);
+	std::vector<std::thread> threads;
+	for (int thread_id = 0; thread_id < num_threads; thread_id++)
+	{
+		threads.emplace_back([this, &rendering_technique, &next_row, &gbuffer, &image]() {
+			for (int i = next_row++; i < image_height; i = next_row++)
 			{
-				//k++;
-				//int l = 0;
 				for (int j = 0; j < image_width; ++j)
+					image[i][j] = shadeStoredHit(rendering_technique, gbuffer, i, j);
+			}
+			RenderStats::flushThread();
+		});
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+void Camera::storePrimaryHit(IN const BaseRayTracer& rendering_technique, int i, int j,
+														 OUT GBuffer& gbuffer) const
+{
+	Vec3 pixel_center = q + su * (j + 0.5) + sv * (i + 0.5);
+	Ray primary_ray(position, (pixel_center - position).normalize());
+
+	HitRecord rec;
+	GBufferSample& sample = gbuffer.samples[static_cast<size_t>(i) * image_width + j];
+	sample = GBufferSample();
+	sample.hit = rendering_technique.intersectPrimary(primary_ray, rec);
+	if (!sample.hit) return;
+	sample.point = rec.point;
+	sample.normal = rec.normal;
+	sample.t = rec.t;
+	sample.material_id = rec.material_id;
+	sample.front_face = rec.front_face;
+}
+
+Color Camera::shadeStoredHit(IN const BaseRayTracer& rendering_technique,
+														 IN const GBuffer& gbuffer, int i, int j) const
+{
+	Vec3 pixel_center = q + su * (j + 0.5) + sv * (i + 0.5);
+	Ray primary_ray(position, (pixel_center - position).normalize());
+
+	const GBufferSample& sample = gbuffer.samples[static_cast<size_t>(i) * image_width + j];
+	HitRecord rec;
+	rec.point = sample.point;
+	rec.normal = sample.normal;
+	rec.front_face = sample.front_face;
+	rec.material_id = sample.material_id;
+	rec.t = sample.t;
+	return rendering_technique.shadePrimary(primary_ray, sample.hit, rec);
+}
+
+bool Camera::projectBox(const AABB& box, OUT int& row_begin, OUT int& row_end,
+												OUT int& col_begin, OUT int& col_end) const
+{
+	row_begin = 0;
+	row_end = image_height;
+	col_begin = 0;
+	col_end = image_width;
+
+	double x_min = INFINITY, x_max = -INFINITY;
+	double y_min = INFINITY, y_max = -INFINITY;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		Vec3 p((corner & 1) ? box.x.max : box.x.min,
+			(corner & 2) ? box.y.max : box.y.min,
+			(corner & 4) ? box.z.max : box.z.min);
+		Vec3 d = p - position;
+		double depth = -d.dot(w);
+		if (depth <= 0)
+			return true;
+		Vec3 on_plane = position + d * (near_distance / depth) - q;
+		double x = on_plane.dot(su) / su.dot(su);
+		double y = on_plane.dot(sv) / sv.dot(sv);
+		x_min = std::min(x_min, x);
+		x_max = std::max(x_max, x);
+		y_min = std::min(y_min, y);
+		y_max = std::max(y_max, y);
+	}
+
+	// Pixel (i, j)'s ray goes through (j + 0.5, i + 0.5); one pixel of
+	// margin absorbs rounding.
+	col_begin = std::max(0, static_cast<int>(std::ceil(x_min - 0.5)) - 1);
+	col_end = std::min(image_width, static_cast<int>(std::floor(x_max - 0.5)) + 2);
+	row_begin = std::max(0, static_cast<int>(std::ceil(y_min - 0.5)) - 1);
+	row_end = std::min(image_height, static_cast<int>(std::floor(y_max - 0.5)) + 2);
+	return row_begin < row_end && col_begin < col_end;
+}
+
+// Only the primary hit is known, so anything a secondary ray might see
+// counts: every pixel showing a reflective or refractive material is
+// redone.
+static bool storedHitAffected(const BaseRayTracer& rendering_technique,
+	const GBufferSample& sample, const SceneChange& change)
+{
+	if (!sample.hit) return false;
+	if (change.lights) return true;
+	const Material& mat = rendering_technique.material_manager.getMaterialById(sample.material_id);
+	if (mat.type == "mirror" || mat.type == "conductor" || mat.type == "dielectric") return true;
+	if (std::find(change.materials.begin(), change.materials.end(), sample.material_id) != change.materials.end())
+		return true;
+
+	// The shadow rays applyShading casts, against the changed boxes grown a
+	// little for rounding.
+	const double epsilon = rendering_technique.renderer_info.shadow_ray_epsilon;
+	for (const PointLight& light : rendering_technique.light_sources.point_lights)
+	{
+		Vec3 wi = Vec3(light.position) - sample.point;
+		double distance = wi.length();
+		wi.normalize();
+		Ray shadow_ray(sample.point + sample.normal * epsilon, wi);
+		for (const AABB& box : change.boxes)
+		{
+			if (AABB(box, box).hit(shadow_ray, Interval(0, distance)))
+				return true;
+		}
+	}
+	return false;
+}
+
+void Camera::dirtyTiles(IN const BaseRayTracer& rendering_technique,
+												IN const GBuffer& gbuffer,
+												IN const SceneChange& change,
+												OUT std::vector<uint8_t>& dirty) const
+{
+	const int tiles_x = (image_width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	const int tiles_y = (image_height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	dirty.assign(tiles_x * tiles_y, 0);
+	if (change.empty())
+		return;
+
+	// Pixels whose primary ray may cross a changed box.
+	std::vector<std::array<int, 4>> rects;
+	for (const AABB& box : change.boxes)
+	{
+		std::array<int, 4> rect;
+		if (projectBox(box, rect[0], rect[1], rect[2], rect[3]))
+			rects.push_back(rect);
+	}
+
+	const int tile_count = tiles_x * tiles_y;
+	const int num_threads = workerThreadCount(rendering_technique.renderer_info, tile_count);
+	std::atomic<int> next_tile(0);
+	std::vector<std::thread> threads;
+	for (int thread_id = 0; thread_id < num_threads; thread_id++)
+	{
+		threads.emplace_back([&]() {
+			for (int tile = next_tile++; tile < tile_count; tile = next_tile++)
+			{
+				const int row = (tile / tiles_x) * RENDER_TILE_SIZE;
+				const int col = (tile % tiles_x) * RENDER_TILE_SIZE;
+				const int row_end = std::min(row + RENDER_TILE_SIZE, image_height);
+				const int col_end = std::min(col + RENDER_TILE_SIZE, image_width);
+				bool affected = false;
+				for (const auto& rect : rects)
 				{
-					//l++;
-					Vec3 pixel_center = q + su * (j + 0.5) + sv * (i + 0.5);
-					
-					if (j == 770 && i == 545)
+					affected = affected || (row < rect[1] && rect[0] < row_end && col < rect[3] && rect[2] < col_end);
+				}
+				for (int i = row; i < row_end && !affected; i++)
+				{
+					for (int j = col; j < col_end && !affected; j++)
+					{
+						affected = storedHitAffected(rendering_technique,
+							gbuffer.samples[static_cast<size_t>(i) * image_width + j], change);
+					}
+				}
+				dirty[tile] = affected;
+			}
+		});
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+void Camera::rerenderTiles(IN const BaseRayTracer& rendering_technique,
+													 IN const std::vector<uint8_t>& dirty, bool retrace,
+													 GBuffer& gbuffer,
+													 OUT std::vector<std::vector<Color>>& image) const
+{
+	ScopedStageTimer timer(Stage::Render);
+	const int tiles_x = (image_width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	std::vector<int> tiles;
+	for (int tile = 0; tile < static_cast<int>(dirty.size()); tile++)
+	{
+		if (dirty[tile]) tiles.push_back(tile);
+	}
+
+	std::atomic<int> next(0);
+	std::vector<std::thread> threads;
+	const int num_threads = workerThreadCount(rendering_technique.renderer_info, static_cast<int>(tiles.size()));
+	for (int thread_id = 0; thread_id < num_threads; thread_id++)
+	{
+		threads.emplace_back([&]() {
+			for (int k = next++; k < static_cast<int>(tiles.size()); k = next++)
+			{
+				const int row = (tiles[k] / tiles_x) * RENDER_TILE_SIZE;
+				const int col = (tiles[k] % tiles_x) * RENDER_TILE_SIZE;
+				const int row_end = std::min(row + RENDER_TILE_SIZE, image_height);
+				const int col_end = std::min(col + RENDER_TILE_SIZE, image_width);
+				for (int i = row; i < row_end; i++)
+				{
+					for (int j = col; j < col_end; j++)
 					{
-						int debug = 1;
+						if (retrace)
+							storePrimaryHit(rendering_technique, i, j, gbuffer);
+						image[i][j] = shadeStoredHit(rendering_technique, gbuffer, i, j);
 					}
+				}
+			}
+			RenderStats::flushThread();
+		});
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+void Camera::renderTraversalCost(IN const BaseRayTracer& rendering_technique,
+																 OUT std::vector<std::vector<int>>& cost) const
+{
+	cost.assign(image_height, std::vector<int>(image_width, 0));
+
+	const int num_threads = workerThreadCount(rendering_technique.renderer_info, image_height);
+
+	std::atomic<int> next_row(0);
+	std::vector<std::thread> threads;
+	for (int thread_id = 0; thread_id < num_threads; thread_id++)
+	{
+		threads.emplace_back([this, &rendering_technique, &next_row, &cost]() {
+			RenderCounters& counters = RenderStats::local();
+			const RenderCounters saved = counters;
+			for (int i = next_row++; i < image_height; i = next_row++)
+			{
+				for (int j = 0; j < image_width; ++j)
+				{
+					Vec3 pixel_center = q + su * (j + 0.5) + sv * (i + 0.5);
 					Ray primary_ray(position, (pixel_center - position).normalize());
 
-					Color pixel_color = rendering_technique.traceRay(primary_ray);
-					pixel_color = pixel_color.clamp();
-					image[i][j] = pixel_color;
-					//std::cout << "i:" << i << " j:" << j << std::endl;
+					long long before = counters.node_tests + counters.primitive_tests;
+					HitRecord rec;
+					rendering_technique.intersect(primary_ray, rec);
+					cost[i][j] = static_cast<int>(counters.node_tests + counters.primitive_tests - before);
 				}
-				//std::cout << i  << std::endl;
 			}
+			counters = saved;
 		});
 	}
-	for (int threadId = 0; threadId < numThreads; ++threadId)
+	for (auto& thread : threads)
 	{
-		threads[threadId].join();
+		thread.join();
 	}
-	*/
+}
 
+void Camera::renderTile(IN const BaseRayTracer& rendering_technique,
+												IN const WavefrontIntegrator& integrator,
+												int row, int col, int tile_size,
+												OUT std::vector<std::vector<Color>>& image) const
+{
+	const RendererInfo& renderer_info = rendering_technique.renderer_info;
+	const int row_end = std::min(row + tile_size, image_height);
+	const int col_end = std::min(col + tile_size, image_width);
+
+	if (renderer_info.aa_min_samples > 1 || renderer_info.aa_max_samples > 1)
+	{
+		renderAdaptiveTile(rendering_technique, row, col, tile_size, image);
+		return;
+	}
+
+	if (renderer_info.integrator == Integrator::Wavefront)
+	{
+		renderWavefrontTile(integrator, row, col, image);
+		return;
+	}
+
+	const int packet_size = renderer_info.packet_size;
+	if (packet_size > 0)
+	{
+		const int packets = (tile_size + packet_size - 1) / packet_size;
+		forEachCell((row_end - row + packet_size - 1) / packet_size,
+			(col_end - col + packet_size - 1) / packet_size, packets, renderer_info.pixel_order,
+			[&](int a, int b) {
+				renderPacket(rendering_technique, row + a * packet_size, col + b * packet_size, packet_size, image);
+			});
+		return;
+	}
+
+	forEachCell(row_end - row, col_end - col, tile_size, renderer_info.pixel_order, [&](int a, int b) {
+		const int i = row + a;
+		const int j = col + b;
+		Vec3 pixel_center = q + su * (j + 0.5) + sv * (i + 0.5);
+		Ray primary_ray(position, (pixel_center - position).normalize());
+
+		image[i][j] = rendering_technique.traceRay(primary_ray);
+	});
 }
 
+void Camera::renderPacket(IN const BaseRayTracer& rendering_technique,
+													int row, int col, int packet_size,
+													OUT std::vector<std::vector<Color>>& image) const
+{
+	const int row_end = std::min(row + packet_size, image_height);
+	const int col_end = std::min(col + packet_size, image_width);
+
+	RayPacket packet;
+	for (int i = row; i < row_end; ++i)
+	{
+		for (int j = col; j < col_end; ++j)
+		{
+			Vec3 pixel_center = q + su * (j + 0.5) + sv * (i + 0.5);
+			packet.add(Ray(position, (pixel_center - position).normalize()));
+		}
+	}
+
+	Color colors[MAX_PACKET_SIZE];
+	rendering_technique.tracePacket(packet, colors);
 
+	int lane = 0;
+	for (int i = row; i < row_end; ++i)
+	{
+		for (int j = col; j < col_end; ++j)
+		{
+			image[i][j] = colors[lane++];
+		}
+	}
+}
+
+bool Camera::writesFloatImage(const RendererInfo& renderer_info) const
+{
+	if (renderer_info.image_format != ImageFormat::Png)
+		return true;
+	const std::string extension = std::filesystem::path(image_name).extension().string();
+	return extension == ".pfm" || extension == ".exr";
+}
+
+// Deterministic jitter in [0, 1) for one coordinate of one sample, so a
+// tile renders the same whichever thread takes it.
+static double sampleJitter(uint64_t pixel, uint64_t sample, uint64_t dimension)
+{
+	uint64_t z = pixel * 0x9E3779B97F4A7C15ull + sample * 0xBF58476D1CE4E5B9ull + dimension;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	z = z ^ (z >> 31);
+	return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double luminance(const Color& c)
+{
+	return 0.2126 * c.r + 0.7152 * c.g + 0.0722 * c.b;
+}
+
+// Multisampled pixels average clamped samples for PNG, as they did before
+// float output, so a bright highlight does not bleed into the pixels on
+// its edge; float images average the samples as traced.
+typedef struct PixelEstimate {
+	Color sum;
+	Color clamped_sum;
+	double luminance_sum = 0.0;
+	double luminance_squared_sum = 0.0;
+	int count = 0;
+
+	// Noise is judged on the displayed value, so thresholds keep their
+	// 0-255 meaning.
+	void add(const Color& c)
+	{
+		Color clamped = Color(c).clamp();
+		double l = luminance(clamped);
+		sum += c;
+		clamped_sum += clamped;
+		luminance_sum += l;
+		luminance_squared_sum += l * l;
+		count++;
+	}
+
+	Color mean(bool clamped) const
+	{
+		const Color& total = clamped ? clamped_sum : sum;
+		return Color(total.r / count, total.g / count, total.b / count);
+	}
+
+	// Standard error of the mean luminance.
+	double noise() const
+	{
+		if (count < 2) return 0.0;
+		double mean_luminance = luminance_sum / count;
+		double variance = (luminance_squared_sum - count * mean_luminance * mean_luminance) / (count - 1);
+		return std::sqrt(std::max(0.0, variance) / count);
+	}
+}PixelEstimate;
+
+// Every pixel first gets a grid x grid set of jittered stratified samples.
+// Pixels whose estimate is still noisy, or that differ from a neighbour by
+// more than the threshold, then get further stratified rounds until the
+// noise drops below the threshold or the budget is spent. Neighbours in the
+// tiles around are compared too: their first rounds are traced again for a
+// one pixel apron, which gives the same samples as their own tile's since
+// the jitter only depends on the pixel. The noise needs two samples, so a
+// pixel whose first round is a single one always gets a second.
+void Camera::renderAdaptiveTile(IN const BaseRayTracer& rendering_technique,
+																int row, int col, int tile_size,
+																OUT std::vector<std::vector<Color>>& image) const
+{
+	const RendererInfo& renderer_info = rendering_technique.renderer_info;
+	const int row_end = std::min(row + tile_size, image_height);
+	const int col_end = std::min(col + tile_size, image_width);
+	const int rows = row_end - row;
+	const int cols = col_end - col;
+
+	const int grid = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(renderer_info.aa_min_samples))));
+	const int round_samples = grid * grid;
+	const int max_samples = std::max(renderer_info.aa_max_samples, round_samples);
+	const double threshold = renderer_info.aa_threshold;
+	const bool clamped = !writesFloatImage(renderer_info);
+
+	auto addRound = [&](int i, int j, int round, PixelEstimate& estimate) {
+		const uint64_t pixel = static_cast<uint64_t>(i) * image_width + j;
+		for (int a = 0; a < grid; a++)
+		{
+			for (int b = 0; b < grid; b++)
+			{
+				uint64_t sample = static_cast<uint64_t>(round) * round_samples + a * grid + b;
+				double x = j + (b + sampleJitter(pixel, sample, 0)) / grid;
+				double y = i + (a + sampleJitter(pixel, sample, 1)) / grid;
+				Vec3 sample_point = q + su * x + sv * y;
+				estimate.add(rendering_technique.traceRay(Ray(position, (sample_point - position).normalize())));
+			}
+		}
+	};
+
+	std::vector<PixelEstimate> estimates(rows * cols);
+	for (int i = 0; i < rows; i++)
+	{
+		for (int j = 0; j < cols; j++)
+			addRound(row + i, col + j, 0, estimates[i * cols + j]);
+	}
+
+	// First round mean luminance of the tile and its apron, indexed from
+	// (row - 1, col - 1).
+	const int apron_cols = cols + 2;
+	std::vector<double> first_round((rows + 2) * apron_cols);
+	for (int i = -1; i <= rows; i++)
+	{
+		for (int j = -1; j <= cols; j++)
+		{
+			const bool inside = i >= 0 && i < rows && j >= 0 && j < cols;
+			const bool in_image = row + i >= 0 && row + i < image_height && col + j >= 0 && col + j < image_width;
+			if (!in_image || (!inside && (i < 0 || i == rows) && (j < 0 || j == cols)))
+				continue; // outside the image, or an apron corner no pixel compares with
+			PixelEstimate apron;
+			if (!inside)
+				addRound(row + i, col + j, 0, apron);
+			const PixelEstimate& estimate = inside ? estimates[i * cols + j] : apron;
+			first_round[(i + 1) * apron_cols + j + 1] = estimate.luminance_sum / estimate.count;
+		}
+	}
+	auto differs = [&](int i, int j, int di, int dj) {
+		if (row + i + di < 0 || row + i + di >= image_height || col + j + dj < 0 || col + j + dj >= image_width)
+			return false;
+		return std::abs(first_round[(i + 1) * apron_cols + j + 1]
+			- first_round[(i + 1 + di) * apron_cols + j + 1 + dj]) > threshold;
+	};
+
+	for (int i = 0; i < rows; i++)
+	{
+		for (int j = 0; j < cols; j++)
+		{
+			PixelEstimate& estimate = estimates[i * cols + j];
+			bool edge = differs(i, j, -1, 0) || differs(i, j, 1, 0) || differs(i, j, 0, -1) || differs(i, j, 0, 1);
+
+			for (int round = 1; estimate.count + round_samples <= max_samples
+				&& (edge || estimate.count < 2 || estimate.noise() > threshold); round++)
+			{
+				addRound(row + i, col + j, round, estimate);
+				edge = false;
+			}
+			image[row + i][col + j] = estimate.mean(clamped);
+		}
+	}
+}
+
+void Camera::renderWavefrontTile(IN const WavefrontIntegrator& integrator,
+																 int row, int col,
+																 OUT std::vector<std::vector<Color>>& image) const
+{
+	const int row_end = std::min(row + WAVEFRONT_TILE_SIZE, image_height);
+	const int col_end = std::min(col + WAVEFRONT_TILE_SIZE, image_width);
+
+	std::vector<Ray> primary_rays;
+	for (int i = row; i < row_end; ++i)
+	{
+		for (int j = col; j < col_end; ++j)
+		{
+			Vec3 pixel_center = q + su * (j + 0.5) + sv * (i + 0.5);
+			primary_rays.push_back(Ray(position, (pixel_center - position).normalize()));
+		}
+	}
+
+	std::vector<Color> colors;
+	integrator.traceTile(primary_rays, colors);
+
+	int index = 0;
+	for (int i = row; i < row_end; ++i)
+	{
+		for (int j = col; j < col_end; ++j)
+		{
+			image[i][j] = colors[index++];
+		}
+	}
+}
+
+// Coarse-to-fine passes over the whole image: one ray per 8x8, 4x4 and 2x2
+// block for a quick preview, then one ray through every pixel center, then
+// one jittered sample per pixel per pass. Each pass is split into rows that
+// worker threads pull until the pass ends or the time budget runs out.
+void Camera::renderProgressive(IN const BaseRayTracer& rendering_technique,
+															 OUT std::vector<std::vector<Color>>& image,
+															 const std::function<void(const std::vector<std::vector<Color>>&)>& checkpoint) const
+{
+	ScopedStageTimer timer(Stage::Render);
+	const RendererInfo& renderer_info = rendering_technique.renderer_info;
+	const auto start = std::chrono::steady_clock::now();
+	const bool has_deadline = renderer_info.progressive_seconds > 0.0;
+	const auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(renderer_info.progressive_seconds));
+	const double noise_target = renderer_info.progressive_noise;
+	// Noise estimates from fewer samples than this are not trusted.
+	constexpr int MIN_SAMPLES_FOR_NOISE = 4;
+	const int max_samples = std::max(1, renderer_info.progressive_max_samples);
+	const int num_threads = workerThreadCount(renderer_info, image_height);
+	const bool clamped = !writesFloatImage(renderer_info);
+
+	std::vector<PixelEstimate> estimates(image_width * image_height);
+	auto timeUp = [&]() { return has_deadline && std::chrono::steady_clock::now() >= deadline; };
+	auto converged = [&](const PixelEstimate& e) {
+		return e.count >= max_samples
+			|| (noise_target > 0.0 && e.count >= MIN_SAMPLES_FOR_NOISE && e.noise() <= noise_target);
+	};
+
+	// Pixels without a sample of their own show the nearest coarser one.
+	auto updateImage = [&]() {
+		image.assign(image_height, std::vector<Color>(image_width, Color(0, 0, 0)));
+		for (int i = 0; i < image_height; i++)
+		{
+			for (int j = 0; j < image_width; j++)
+			{
+				for (int step = 1; step <= 8; step *= 2)
+				{
+					const PixelEstimate& e = estimates[(i - i % step) * image_width + (j - j % step)];
+					if (e.count > 0)
+					{
+						image[i][j] = e.mean(clamped);
+						break;
+					}
+				}
+			}
+		}
+	};
+
+	auto runPass = [&](int step, int sample) {
+		std::atomic<int> next_row(0);
+		std::vector<std::thread> threads;
+		for (int thread_id = 0; thread_id < num_threads; thread_id++)
+		{
+			threads.emplace_back([&]() {
+				for (int i = next_row++ * step; i < image_height && !timeUp(); i = next_row++ * step)
+				{
+					for (int j = 0; j < image_width; j += step)
+					{
+						PixelEstimate& e = estimates[i * image_width + j];
+						if (sample == 0 ? e.count > 0 : converged(e)) continue;
+
+						double x = j + 0.5;
+						double y = i + 0.5;
+						if (sample > 0)
+						{
+							uint64_t pixel = static_cast<uint64_t>(i) * image_width + j;
+							x = j + sampleJitter(pixel, sample, 0);
+							y = i + sampleJitter(pixel, sample, 1);
+						}
+						Vec3 sample_point = q + su * x + sv * y;
+						e.add(rendering_technique.traceRay(Ray(position, (sample_point - position).normalize())));
+					}
+				}
+				RenderStats::flushThread();
+			});
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+	};
+
+	auto last_write = start;
+	auto finishPass = [&](const std::string& label) {
+		updateImage();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "Progressive " << image_name << ": " << label << " done at "
+			<< elapsed.count() << " s" << std::endl;
+		if (std::chrono::steady_clock::now() - last_write
+			>= std::chrono::duration<double>(renderer_info.progressive_write_interval))
+		{
+			// Writing is timed as encoding, not rendering.
+			timer.pause();
+			checkpoint(image);
+			timer.resume();
+			last_write = std::chrono::steady_clock::now();
+		}
+	};
+
+	for (int step = 8; step >= 1 && !timeUp(); step /= 2)
+	{
+		runPass(step, 0);
+		finishPass(step > 1 ? "preview 1/" + std::to_string(step) : "1 sample per pixel");
+	}
+
+	for (int sample = 1; !timeUp(); sample++)
+	{
+		bool all_converged = true;
+		for (const PixelEstimate& e : estimates)
+		{
+			if (!converged(e))
+			{
+				all_converged = false;
+				break;
+			}
+		}
+		if (all_converged) break;
+
+		runPass(1, sample);
+		finishPass("pass " + std::to_string(sample + 1));
+	}
+	updateImage();
+}
@@ -13,11 +13,21 @@
 #include "parser.hpp"
 #include "../render/rendering_technique.h"
 #include <thread>
+#include <functional>
 #include "../render/base_ray_tracer.h"
+#include "../render/gbuffer.h"
 
 
+// Side of the square tiles worker threads pull off the image; a multiple
+// of every packet size.
+constexpr int RENDER_TILE_SIZE = 32;
+
 class Scene;
 class RenderingTechnique;
+class WavefrontIntegrator;
+
+// Worker threads for a job of work_items independent pieces.
+int workerThreadCount(const RendererInfo& renderer_info, int work_items);
 
 class Camera {
 public:
@@ -29,7 +39,90 @@ public:
 	void render(IN const BaseRayTracer& rendering_technique,		
 							OUT std::vector<std::vector<Color>>& image) const;
 
-private:	
+	// The tiles render() splits the image into, exposed so several cameras'
+	// tiles can share one pool of workers. Tiles are numbered in the
+	// renderer's pixel order; renderTileAt writes into an image sized by
+	// prepareImage.
+	void prepareImage(OUT std::vector<std::vector<Color>>& image) const;
+	int tileSize(const RendererInfo& renderer_info) const;
+	int tileCount(const RendererInfo& renderer_info) const;
+	// Pixels covered by tile, clipped to the image.
+	void tileRect(const RendererInfo& renderer_info, int tile,
+								OUT int& row, OUT int& col, OUT int& rows, OUT int& cols) const;
+	void renderTileAt(IN const BaseRayTracer& rendering_technique,
+										IN const WavefrontIntegrator& integrator,
+										int tile,
+										OUT std::vector<std::vector<Color>>& image) const;
+
+	// Whether the image is written as unclamped floats (PFM or EXR) rather
+	// than PNG, going by the image format option and the image name.
+	bool writesFloatImage(const RendererInfo& renderer_info) const;
+
+	// Refines the image in passes until renderer_info's time budget or noise
+	// target is met, handing the current image to checkpoint at most every
+	// progressive_write_interval seconds. image holds the final result.
+	void renderProgressive(IN const BaseRayTracer& rendering_technique,
+												 OUT std::vector<std::vector<Color>>& image,
+												 const std::function<void(const std::vector<std::vector<Color>>&)>& checkpoint) const;
+
+	// Relighting: fillGBuffer stores the primary hit of every pixel center,
+	// renderFromGBuffer shades them into the image render() would produce
+	// without anti-aliasing, tracing only secondary and shadow rays. The
+	// key tells whether a stored G-buffer still holds this camera's hits.
+	GBufferKey gbufferKey(uint64_t geometry_key) const;
+	void fillGBuffer(IN const BaseRayTracer& rendering_technique,
+									 OUT GBuffer& gbuffer) const;
+	void renderFromGBuffer(IN const BaseRayTracer& rendering_technique,
+												 IN const GBuffer& gbuffer,
+												 OUT std::vector<std::vector<Color>>& image) const;
+
+	// Incremental re-rendering after a scene edit, on a grid of
+	// RENDER_TILE_SIZE tiles numbered row by row. dirtyTiles marks the tiles
+	// the change can affect, judged from the primary hits gbuffer held
+	// before it: pixels whose primary or shadow rays may cross a changed
+	// box, that show a changed material, or that reflect or refract.
+	// rerenderTiles shades those tiles again, re-tracing their primary hits
+	// into gbuffer first when geometry changed.
+	void dirtyTiles(IN const BaseRayTracer& rendering_technique,
+									IN const GBuffer& gbuffer,
+									IN const SceneChange& change,
+									OUT std::vector<uint8_t>& dirty) const;
+	void rerenderTiles(IN const BaseRayTracer& rendering_technique,
+										 IN const std::vector<uint8_t>& dirty, bool retrace,
+										 GBuffer& gbuffer,
+										 OUT std::vector<std::vector<Color>>& image) const;
+
+	// Pixels, as [row_begin, row_end) x [col_begin, col_end), whose primary
+	// rays may pass through box; the whole image when part of it is behind
+	// the eye. False when none do.
+	bool projectBox(const AABB& box, OUT int& row_begin, OUT int& row_end,
+									OUT int& col_begin, OUT int& col_end) const;
+
+	// Debug mode: cost[i][j] is the number of BVH nodes and primitives the
+	// primary ray of pixel (i, j) was tested against. Leaves the render
+	// statistics untouched.
+	void renderTraversalCost(IN const BaseRayTracer& rendering_technique,
+													 OUT std::vector<std::vector<int>>& cost) const;
+
+private:
+	void storePrimaryHit(IN const BaseRayTracer& rendering_technique, int i, int j,
+											 OUT GBuffer& gbuffer) const;
+	Color shadeStoredHit(IN const BaseRayTracer& rendering_technique,
+											 IN const GBuffer& gbuffer, int i, int j) const;
+	void renderTile(IN const BaseRayTracer& rendering_technique,
+									IN const WavefrontIntegrator& integrator,
+									int row, int col, int tile_size,
+									OUT std::vector<std::vector<Color>>& image) const;
+	void renderPacket(IN const BaseRayTracer& rendering_technique,
+										int row, int col, int packet_size,
+										OUT std::vector<std::vector<Color>>& image) const;
+	void renderAdaptiveTile(IN const BaseRayTracer& rendering_technique,
+													int row, int col, int tile_size,
+													OUT std::vector<std::vector<Color>>& image) const;
+	void renderWavefrontTile(IN const WavefrontIntegrator& integrator,
+													 int row, int col,
+													 OUT std::vector<std::vector<Color>>& image) const;
+
 	Vec3 position;
 	Vec3 gaze;
 	Vec3 up;
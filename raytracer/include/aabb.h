@@ -4,6 +4,7 @@
 #include "interval.h"
 #include "vec3.h"
 #include "ray.h"
+#include "ray_packet.h"
 
 class AABB {
 public:
@@ -16,7 +17,10 @@ public:
     const void thicken();
     const Interval& axis(int i) const;
     bool hit(const Ray& ray, Interval ray_t) const;
+    LaneMask hitPacket(const RayPacket& packet, LaneMask active,
+        const Interval* ray_t, const double* closest_t) const;
     const Interval& operator[](int axis) const;
+    double surfaceArea() const;
 };
 
 #endif // AABB_H
\ No newline at end of file
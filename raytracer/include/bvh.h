@@ -7,19 +7,64 @@
 #include <algorithm>
 #include <random>
 
+enum class BvhBuilder {
+	Median, // random axis, split at the middle object
+	Spatial // surface area heuristic over object and spatial splits (SBVH)
+};
+
 class BvhNode : public Hittable{
 public:
 	BvhNode();
   BvhNode(std::vector<std::shared_ptr<Hittable>>& objects, int begin, int end);
+  // Joins two subtrees or primitives under bounding_box, which may be
+  // tighter than their own boxes as long as it holds every point of them a
+  // ray under this node can hit (see buildSpatialBvh).
+  BvhNode(std::shared_ptr<Hittable> left, std::shared_ptr<Hittable> right, const AABB& bounding_box);
 
   bool hit(const Ray& ray, Interval ray_t, HitRecord& rec) const override;
 
+  void hitPacket(const RayPacket& packet, LaneMask active,
+    const Interval* ray_t, double* closest_t, HitRecord* recs,
+    LaneMask& hit_mask) const override;
+
   AABB getAABB() const override;
 
+  // Recomputes every box below this node from its primitives' current
+  // bounds, bottom up, keeping the tree's shape. Cheaper than a rebuild
+  // after primitives move, at the cost of looser boxes; boxes a spatial
+  // split clipped grow back to their primitives' full bounds. Subtrees are
+  // split over up to thread_count threads.
+  void refit(int thread_count = 1);
+
+  // Surface area heuristic cost: the summed area of every node's box over
+  // this node's, i.e. the nodes a random ray through this box is expected to
+  // test. Refits that let it grow well past the built tree's call for a
+  // rebuild.
+  double traversalCost() const;
+
+  // Nodes in this subtree and the primitive slots of its leaves. A
+  // primitive under several leaves is counted once per leaf.
+  void countNodes(long long& nodes, long long& references) const;
+
+  // Children are nodes or primitives; exposed for code that flattens the
+  // tree.
+  const Hittable* leftChild() const { return left.get(); }
+  const Hittable* rightChild() const { return right.get(); }
+
 private:
+    double summedArea() const;
+
     std::shared_ptr<Hittable> left;
     std::shared_ptr<Hittable> right;
     AABB bounding_box;
 };
 
+// Builds a tree over objects with the given builder and records its shape
+// in RenderStats. The median builder reorders objects; spatial splits may
+// add up to duplication_budget times objects.size() extra references, and
+// a positive early_split_budget first splits large triangles into that
+// many more (see splitLargeTriangles).
+BvhNode buildBvh(std::vector<std::shared_ptr<Hittable>>& objects, BvhBuilder builder,
+  double duplication_budget, double early_split_budget = 0.0);
+
 #endif // !BVH_H
\ No newline at end of file
@@ -27,6 +27,8 @@ public:
     b = other.b;
   }
 
+  Color& operator=(const Color& other) = default;
+
   Color(const Vec3& vec)
   {
     r = vec.x;
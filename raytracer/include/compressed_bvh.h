@@ -0,0 +1,66 @@
+#ifndef COMPRESSED_BVH_H
+#define COMPRESSED_BVH_H
+
+#include <cstdint>
+#include <vector>
+#include "bvh.h"
+
+// Children per compressed node.
+constexpr int COMPRESSED_BVH_WIDTH = 8;
+
+// A BvhNode tree collapsed into 8-wide nodes whose child boxes are stored
+// as 8-bit offsets from the node's own box, in the style of compressed
+// wide BVHs (Ylitie et al. 2017): a node is 76 bytes where each of the
+// binary nodes it replaces takes 88 plus a shared_ptr control block.
+// Quantized boxes are rounded outwards, so no box a ray hits is culled and
+// traversal finds the same closest hit as BvhNode, ties going to the later
+// primitive as there.
+//
+// Primitives are referenced, not owned: the source tree has to outlive
+// this, and this has to be rebuilt when the tree is refitted or rebuilt.
+class CompressedBvh : public Hittable {
+public:
+	CompressedBvh() = default;
+	CompressedBvh(const BvhNode& world);
+
+	bool hit(const Ray& ray, Interval ray_t, HitRecord& rec) const override;
+
+	void hitPacket(const RayPacket& packet, LaneMask active,
+		const Interval* ray_t, double* closest_t, HitRecord* recs,
+		LaneMask& hit_mask) const override;
+
+	AABB getAABB() const override { return bounding_box; }
+
+	// Child box k spans origin + child_min[axis][k] * 2^exponent[axis] to
+	// origin + child_max[axis][k] * 2^exponent[axis] on each axis; the
+	// arrays are laid out per axis so all children decode in one pass.
+	// Children are in BvhNode's depth first order. Those in inner_mask are
+	// the consecutive nodes from first_node, the rest the consecutive
+	// primitives from first_primitive.
+	typedef struct QuantizedNode {
+		float origin[3];
+		int8_t exponent[3];
+		uint8_t child_count;
+		uint8_t inner_mask;
+		uint8_t child_min[3][COMPRESSED_BVH_WIDTH];
+		uint8_t child_max[3][COMPRESSED_BVH_WIDTH];
+		int32_t first_node;
+		int32_t first_primitive;
+	}QuantizedNode;
+
+	size_t nodeCount() const { return nodes.size(); }
+	size_t byteSize() const;
+
+private:
+	// Fills nodes[index] from node, then the nodes below it.
+	void addNode(const BvhNode& node, int32_t index);
+
+	// Child k of node: a node index, or -1 - its primitive index.
+	static int32_t childEntry(const QuantizedNode& node, int k);
+
+	std::vector<QuantizedNode> nodes;
+	std::vector<const Hittable*> primitives;
+	AABB bounding_box;
+};
+
+#endif // COMPRESSED_BVH_H
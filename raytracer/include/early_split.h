@@ -0,0 +1,17 @@
+#ifndef EARLY_SPLIT_H
+#define EARLY_SPLIT_H
+
+#include <memory>
+#include <vector>
+#include "hittable.h"
+
+// Early split clipping (Ernst and Greiner 2007), a cheap alternative to
+// spatial splits that runs before any builder. Triangles whose box is
+// mostly empty, such as large floors or long diagonal struts, are cut in
+// half across their box's longest axis, worst first, until budget times
+// objects.size() extra pieces have been made. Returns objects with every
+// split triangle replaced by its TriangleFragments.
+std::vector<std::shared_ptr<Hittable>> splitLargeTriangles(
+	const std::vector<std::shared_ptr<Hittable>>& objects, double budget);
+
+#endif // EARLY_SPLIT_H
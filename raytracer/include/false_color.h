@@ -0,0 +1,16 @@
+#ifndef FALSE_COLOR_H
+#define FALSE_COLOR_H
+
+#include <algorithm>
+#include <cmath>
+
+// Heat ramp for debug images: t = 0 is black, then red, yellow and white at
+// t = 1. Values outside [0, 1] are clamped.
+inline void falseColor(double t, unsigned char* rgb)
+{
+  rgb[0] = static_cast<unsigned char>(std::round(255.0 * std::clamp(3.0 * t, 0.0, 1.0)));
+  rgb[1] = static_cast<unsigned char>(std::round(255.0 * std::clamp(3.0 * t - 1.0, 0.0, 1.0)));
+  rgb[2] = static_cast<unsigned char>(std::round(255.0 * std::clamp(3.0 * t - 2.0, 0.0, 1.0)));
+}
+
+#endif // FALSE_COLOR_H
@@ -4,6 +4,10 @@
 #include "../include/ray.h"
 #include "interval.h"
 #include "aabb.h"
+#include "ray_packet.h"
+#include "render_stats.h"
+
+class Hittable;
 
 typedef struct HitRecord{
   Vec3 point;
@@ -11,6 +15,7 @@ typedef struct HitRecord{
 	bool front_face;
   int material_id;
   double t;
+  const Hittable* object = nullptr; // primitive that was hit, null for planes
   void set_front_face(const Ray& r)
   {
     front_face = r.direction.dot(normal) < 0;
@@ -22,6 +27,28 @@ public:
   virtual ~Hittable() = default;
   virtual bool hit(const Ray& ray, Interval ray_t, HitRecord& rec) const = 0;
   virtual AABB getAABB() const = 0;
+
+  // Intersects the active lanes of a packet. ray_t holds each lane's
+  // interval, closest_t the closest hit found so far; a lane whose hit is at
+  // least as close gets its record replaced and its bit set in hit_mask.
+  // The default falls back to one hit() call per active lane.
+  virtual void hitPacket(const RayPacket& packet, LaneMask active,
+    const Interval* ray_t, double* closest_t, HitRecord* recs,
+    LaneMask& hit_mask) const
+  {
+    for (int lane = 0; lane < packet.size; lane++)
+    {
+      if (!laneActive(active, lane)) continue;
+      HitRecord temp_rec;
+      if (hit(packet.rays[lane], ray_t[lane], temp_rec)
+        && temp_rec.t <= closest_t[lane])
+      {
+        closest_t[lane] = temp_rec.t;
+        recs[lane] = temp_rec;
+        hit_mask |= LaneMask(1) << lane;
+      }
+    }
+  }
 };
 
 #endif //HITTABLE_H
@@ -0,0 +1,67 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <cstdint>
+
+// Spreads the low 21 bits of v so that two zero bits follow each one.
+inline uint64_t expandBits3(uint64_t v)
+{
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffff;
+  v = (v | v << 16) & 0x1f0000ff0000ff;
+  v = (v | v << 8) & 0x100f00f00f00f00f;
+  v = (v | v << 4) & 0x10c30c30c30c30c3;
+  v = (v | v << 2) & 0x1249249249249249;
+  return v;
+}
+
+// Z-order index of a point quantized to 21 bits per axis.
+inline uint64_t morton3D(uint32_t x, uint32_t y, uint32_t z)
+{
+  return expandBits3(x) | (expandBits3(y) << 1) | (expandBits3(z) << 2);
+}
+
+// Spreads the low 16 bits of v so that a zero bit follows each one.
+inline uint32_t expandBits2(uint32_t v)
+{
+  v &= 0xffff;
+  v = (v | v << 8) & 0x00ff00ff;
+  v = (v | v << 4) & 0x0f0f0f0f;
+  v = (v | v << 2) & 0x33333333;
+  v = (v | v << 1) & 0x55555555;
+  return v;
+}
+
+// Z-order index of a 2D point with up to 16 bits per axis.
+inline uint32_t morton2D(uint32_t x, uint32_t y)
+{
+  return expandBits2(x) | (expandBits2(y) << 1);
+}
+
+// Distance of (x, y) along the Hilbert curve through an n x n grid, n a
+// power of two. Unlike Z-order, consecutive cells are always neighbours.
+inline uint64_t hilbert2D(uint32_t n, uint32_t x, uint32_t y)
+{
+  uint64_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2)
+  {
+    uint32_t rx = (x & s) > 0;
+    uint32_t ry = (y & s) > 0;
+    d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+    // Rotate the quadrant so that its sub-curve joins its neighbours.
+    if (ry == 0)
+    {
+      if (rx == 1)
+      {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      uint32_t t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return d;
+}
+
+#endif // MORTON_H
@@ -86,10 +86,72 @@ typedef struct Scene_ {
     std::vector<Plane_> planes;
 } Scene_;
 
+// A change to one sphere of a loaded scene; what is not given stays.
+typedef struct SphereEdit_ {
+    int id;
+    bool has_center = false;
+    Vec3f_ center; // a position, not a vertex index as in scene files
+    bool has_radius = false;
+    float radius;
+    bool has_material = false;
+    int material_id;
+} SphereEdit_;
+
+// A render request against an already loaded scene: one of its cameras
+// with any overrides applied, and where to write the image.
+typedef struct RenderJob_ {
+    Camera_ camera;
+    std::string output_path;
+    // "Lights", "Materials" and "Objects" take the scene file's keys; each
+    // entry replaces the scene's light, material or sphere with the same
+    // _id, or adds a light. These edits persist for later jobs.
+    bool has_ambient_light = false;
+    Vec3f_ ambient_light;
+    std::vector<PointLight_> point_lights;
+    std::vector<Material_> materials;
+    std::vector<SphereEdit_> sphere_edits;
+    bool shutdown = false; // {"Command": "shutdown"} stops the server
+} RenderJob_;
+
+// Pose of one mesh or sphere in a frame of an animation: its scene file
+// geometry scaled, then rotated by rotation_angle degrees about
+// rotation_axis, both about the object's rest-pose center, then
+// translated.
+typedef struct ObjectTransform_ {
+    int id;
+    Vec3f_ scaling = { 1.0f, 1.0f, 1.0f };
+    float rotation_angle = 0.0f;
+    Vec3f_ rotation_axis = { 0.0f, 1.0f, 0.0f };
+    Vec3f_ translation = { 0.0f, 0.0f, 0.0f };
+} ObjectTransform_;
+
+// One frame of an animation; objects it does not list keep their scene
+// file pose.
+typedef struct Frame_ {
+    std::vector<ObjectTransform_> meshes;
+    std::vector<ObjectTransform_> spheres;
+} Frame_;
+
 // --- Function Declaration ---
 
 void parseScene(const std::string& filename, Scene_& scene);
 
+// Parses one JSON job line such as
+// {"CameraId": "1", "Camera": {"Position": "0 0 5", "ImageResolution": "320 240"}, "Output": "out/a.png"}
+// The "Camera" object takes the same keys as a camera in a scene file,
+// "Lights" and "Materials" those of the scene file's sections, e.g.
+// {"Lights": {"PointLight": {"_id": "1", "Position": "0 4 0", "Intensity": "900 900 900"}}, ...}
+// and "Objects" holds sphere edits:
+// {"Objects": {"Sphere": {"_id": "2", "Position": "1 0 -3", "Radius": "0.5"}}, ...}
+bool parseRenderJob(const std::string& line, const Scene_& scene, RenderJob_& job, std::string& error);
+
+// Reads an animation file such as
+// {"Frames": [{"Mesh": {"_id": "1", "Rotation": "30 0 1 0", "Translation": "0 0.1 0"}},
+//             {"Mesh": {"_id": "1", "Rotation": "60 0 1 0", "Scaling": "1.2"}, "Sphere": [...]}]}
+// Rotation is an angle in degrees followed by an axis; Scaling takes one
+// factor or three.
+bool parseFrameSequence(const std::string& filename, std::vector<Frame_>& frames, std::string& error);
+
 inline std::ostream& operator<<(std::ostream& os, const Vec3f_& v) {
     os << "(" << v.x << ", " << v.y << ", " << v.z << ")";
     return os;
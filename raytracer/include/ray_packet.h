@@ -0,0 +1,54 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <bit>
+#include <cstdint>
+#include "ray.h"
+
+// Up to 8x8 coherent rays traced together through the BVH. Origins and
+// directions are also kept in structure-of-arrays form so the per-lane box
+// and triangle loops are branch-free and can be vectorized.
+constexpr int MAX_PACKET_SIZE = 64;
+
+typedef uint64_t LaneMask;
+
+class RayPacket {
+public:
+  int size = 0;
+  Ray rays[MAX_PACKET_SIZE];
+  double origin_x[MAX_PACKET_SIZE];
+  double origin_y[MAX_PACKET_SIZE];
+  double origin_z[MAX_PACKET_SIZE];
+  double direction_x[MAX_PACKET_SIZE];
+  double direction_y[MAX_PACKET_SIZE];
+  double direction_z[MAX_PACKET_SIZE];
+
+  inline void add(const Ray& ray)
+  {
+    rays[size] = ray;
+    origin_x[size] = ray.origin.x;
+    origin_y[size] = ray.origin.y;
+    origin_z[size] = ray.origin.z;
+    direction_x[size] = ray.direction.x;
+    direction_y[size] = ray.direction.y;
+    direction_z[size] = ray.direction.z;
+    size++;
+  }
+
+  inline LaneMask fullMask() const
+  {
+    return size >= MAX_PACKET_SIZE ? ~LaneMask(0) : (LaneMask(1) << size) - 1;
+  }
+};
+
+inline bool laneActive(LaneMask mask, int lane)
+{
+  return (mask >> lane) & 1;
+}
+
+inline int activeLaneCount(LaneMask mask)
+{
+  return std::popcount(mask);
+}
+
+#endif // RAY_PACKET_H
@@ -0,0 +1,137 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include "trace_recorder.h"
+
+enum class RayKind {Primary, Shadow, Reflection, Refraction};
+
+// Counters every render thread accumulates privately and merges into the
+// process-wide totals when it finishes, so the hot paths never synchronize.
+typedef struct RenderCounters {
+  long long primary_rays = 0;
+  long long shadow_rays = 0;
+  long long reflection_rays = 0;
+  long long refraction_rays = 0;
+  long long node_tests = 0;      // ray (or packet lane) against a BVH node box
+  long long primitive_tests = 0; // ray against a sphere, triangle or plane
+  long long occluder_cache_hits = 0;
+  long long occluder_cache_misses = 0;
+  long long primary_hit_repeats = 0; // primary rays hitting the primitive the thread's previous one hit
+
+  long long& rays(RayKind kind)
+  {
+    switch (kind)
+    {
+    case RayKind::Shadow: return shadow_rays;
+    case RayKind::Reflection: return reflection_rays;
+    case RayKind::Refraction: return refraction_rays;
+    default: return primary_rays;
+    }
+  }
+
+  long long totalRays() const
+  {
+    return primary_rays + shadow_rays + reflection_rays + refraction_rays;
+  }
+
+  void add(const RenderCounters& other)
+  {
+    primary_rays += other.primary_rays;
+    shadow_rays += other.shadow_rays;
+    reflection_rays += other.reflection_rays;
+    refraction_rays += other.refraction_rays;
+    node_tests += other.node_tests;
+    primitive_tests += other.primitive_tests;
+    occluder_cache_hits += other.occluder_cache_hits;
+    occluder_cache_misses += other.occluder_cache_misses;
+    primary_hit_repeats += other.primary_hit_repeats;
+  }
+}RenderCounters;
+
+// Shape of the BVH last built, see buildBvh.
+typedef struct BvhStats {
+  std::string builder; // empty until a BVH is built
+  long long nodes = 0;
+  long long references = 0; // primitive slots in leaves, above primitives where they are duplicated
+  long long primitives = 0;
+  double traversal_cost = 0.0; // BvhNode::traversalCost
+  long long node_bytes = 0; // sizeof(BvhNode) per node, without the shared_ptr control blocks
+  long long compressed_nodes = 0; // CompressedBvh built from it, 0 when none
+  long long compressed_bytes = 0;
+}BvhStats;
+
+enum class Stage {Parse, Normals, Bvh, Render, Encode, Count};
+
+namespace RenderStats
+{
+  // The calling thread's counters. Inline so the counting in the
+  // intersection routines stays a thread-local increment.
+  inline RenderCounters& local()
+  {
+    thread_local RenderCounters counters;
+    return counters;
+  }
+
+  // Adds the calling thread's counters to the totals and clears them.
+  void flushThread();
+
+  RenderCounters totals();
+
+  void addStageTime(Stage stage, double seconds);
+  double stageSeconds(Stage stage);
+  const char* stageName(Stage stage);
+
+  void setBvhStats(const BvhStats& stats);
+  BvhStats bvhStats();
+
+  // Clears the totals, the stage times and the BVH shape.
+  void reset();
+
+  void printSummary(std::ostream& out);
+  bool writeJson(const std::string& path);
+}
+
+// Adds the lifetime of the object to a stage's time, and records it as a
+// span when tracing. Time between pause() and resume() is left out, so
+// work another stage times inside it is not counted twice.
+class ScopedStageTimer {
+public:
+  ScopedStageTimer(Stage stage)
+    : stage(stage), span(RenderStats::stageName(stage), "stage"),
+    start(std::chrono::steady_clock::now())
+  {
+  }
+
+  ~ScopedStageTimer()
+  {
+    pause();
+    RenderStats::addStageTime(stage, seconds);
+  }
+
+  void pause()
+  {
+    if (!running) return;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    seconds += elapsed.count();
+    running = false;
+  }
+
+  void resume()
+  {
+    if (running) return;
+    start = std::chrono::steady_clock::now();
+    running = true;
+  }
+
+private:
+  Stage stage;
+  TraceSpan span;
+  std::chrono::steady_clock::time_point start;
+  double seconds = 0.0;
+  bool running = true;
+};
+
+#endif // RENDER_STATS_H
@@ -0,0 +1,19 @@
+#ifndef SBVH_H
+#define SBVH_H
+
+#include "bvh.h"
+
+// Builds a spatial split BVH (Stich et al. 2009). Every node takes the
+// cheaper, by the surface area heuristic, of an object split and a split
+// plane that cuts primitives straddling it into one reference per side,
+// each bounded by the part of the primitive on its side. Long thin
+// triangles then stop inflating boxes far beyond their own area.
+//
+// Spatial splits are only tried where the children of the best object
+// split overlap noticeably, and stop once the duplicated references reach
+// duplication_budget times objects.size(); 0 builds a plain SAH tree.
+// Node boxes are clipped, so refitting the tree loosens them (see
+// BvhNode::refit).
+BvhNode buildSpatialBvh(const std::vector<std::shared_ptr<Hittable>>& objects, double duplication_budget);
+
+#endif // SBVH_H
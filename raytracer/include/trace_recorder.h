@@ -0,0 +1,77 @@
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include <chrono>
+#include <string>
+
+// Optional timeline recorder. Spans are buffered per thread and written as
+// Chrome trace_event JSON, which chrome://tracing and Perfetto open
+// directly. While recording is off a span costs one branch on a global flag.
+namespace TraceRecorder
+{
+  inline bool recording = false;
+
+  inline bool enabled()
+  {
+    return recording;
+  }
+
+  // Starts recording; span times are relative to this call.
+  void start();
+
+  // Microseconds since start().
+  long long now();
+
+  void record(const char* name, const char* category, long long start_us,
+    long long duration_us, const std::string& args);
+
+  // Names the calling thread's track in the trace viewer.
+  void setThreadName(const std::string& name);
+
+  bool write(const std::string& path);
+}
+
+// Records its own lifetime as a complete ("X") event.
+class TraceSpan {
+public:
+  TraceSpan(const char* name, const char* category)
+    : name(name), category(category), active(TraceRecorder::enabled())
+  {
+    if (active) start_us = TraceRecorder::now();
+  }
+
+  ~TraceSpan()
+  {
+    if (active)
+      TraceRecorder::record(name, category, start_us, TraceRecorder::now() - start_us, args);
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  // Extra key/value pairs shown with the span.
+  void arg(const char* key, long long value)
+  {
+    if (active) appendArg(key, std::to_string(value));
+  }
+
+  void arg(const char* key, const std::string& value);
+
+private:
+  void appendArg(const char* key, const std::string& json_value)
+  {
+    if (!args.empty()) args += ", ";
+    args += "\"";
+    args += key;
+    args += "\": ";
+    args += json_value;
+  }
+
+  const char* name;
+  const char* category;
+  bool active;
+  long long start_us = 0;
+  std::string args; // JSON members without the braces
+};
+
+#endif // TRACE_RECORDER_H
@@ -0,0 +1,145 @@
+#include "hdr_writer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// Both formats are little endian on disk, whatever the host is.
+static void putU32(std::string& out, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		out += static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+static void putU64(std::string& out, uint64_t value)
+{
+	for (int i = 0; i < 8; i++)
+		out += static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+static void putF32(std::string& out, float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	putU32(out, bits);
+}
+
+static bool writeFile(const std::string& path, const std::string& data)
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file || !file.write(data.data(), data.size()))
+	{
+		std::cerr << "Error: Could not write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool writePfm(const std::string& path, const std::vector<std::vector<Color>>& image, double scale)
+{
+	const int height = image.size();
+	const int width = height > 0 ? image[0].size() : 0;
+
+	// A negative scale in the header marks the data as little endian.
+	std::string data = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+	data.reserve(data.size() + static_cast<size_t>(width) * height * 12);
+	for (int y = height - 1; y >= 0; y--)
+	{
+		for (const Color& c : image[y])
+		{
+			putF32(data, static_cast<float>(c.r / scale));
+			putF32(data, static_cast<float>(c.g / scale));
+			putF32(data, static_cast<float>(c.b / scale));
+		}
+	}
+	return writeFile(path, data);
+}
+
+// Header attribute: name, type, byte size, value.
+static void putAttribute(std::string& out, const char* name, const char* type, const std::string& value)
+{
+	out += name;
+	out += '\0';
+	out += type;
+	out += '\0';
+	putU32(out, value.size());
+	out += value;
+}
+
+static std::string box2i(int x_max, int y_max)
+{
+	std::string box;
+	putU32(box, 0);
+	putU32(box, 0);
+	putU32(box, x_max);
+	putU32(box, y_max);
+	return box;
+}
+
+bool writeExr(const std::string& path, const std::vector<std::vector<Color>>& image, double scale)
+{
+	constexpr uint32_t EXR_MAGIC = 20000630;
+	constexpr uint32_t EXR_VERSION = 2; // single part scanline
+	constexpr uint32_t PIXEL_TYPE_FLOAT = 2;
+
+	const int height = image.size();
+	const int width = height > 0 ? image[0].size() : 0;
+	if (width == 0)
+	{
+		std::cerr << "Error: Cannot write an empty image to " << path << std::endl;
+		return false;
+	}
+
+	std::string data;
+	putU32(data, EXR_MAGIC);
+	putU32(data, EXR_VERSION);
+
+	// Channels are listed, and stored, in alphabetical order.
+	const char* channel_names[3] = { "B", "G", "R" };
+	std::string channels;
+	for (const char* name : channel_names)
+	{
+		channels += name;
+		channels += '\0';
+		putU32(channels, PIXEL_TYPE_FLOAT);
+		channels += std::string(4, '\0'); // pLinear and reserved
+		putU32(channels, 1); // x sampling
+		putU32(channels, 1); // y sampling
+	}
+	channels += '\0';
+
+	std::string one;
+	putF32(one, 1.0f);
+	std::string window_center;
+	putF32(window_center, 0.0f);
+	putF32(window_center, 0.0f);
+
+	putAttribute(data, "channels", "chlist", channels);
+	putAttribute(data, "compression", "compression", std::string(1, '\0'));
+	putAttribute(data, "dataWindow", "box2i", box2i(width - 1, height - 1));
+	putAttribute(data, "displayWindow", "box2i", box2i(width - 1, height - 1));
+	putAttribute(data, "lineOrder", "lineOrder", std::string(1, '\0')); // increasing y
+	putAttribute(data, "pixelAspectRatio", "float", one);
+	putAttribute(data, "screenWindowCenter", "v2f", window_center);
+	putAttribute(data, "screenWindowWidth", "float", one);
+	data += '\0';
+
+	// Offset table, then one block per scanline: y, byte count, and each
+	// channel's row of samples.
+	const uint32_t row_bytes = static_cast<uint32_t>(width) * 3 * sizeof(float);
+	const uint64_t first_block = data.size() + static_cast<uint64_t>(height) * 8;
+	for (int y = 0; y < height; y++)
+		putU64(data, first_block + static_cast<uint64_t>(y) * (8 + row_bytes));
+
+	data.reserve(first_block + static_cast<size_t>(height) * (8 + row_bytes));
+	for (int y = 0; y < height; y++)
+	{
+		putU32(data, y);
+		putU32(data, row_bytes);
+		for (const Color& c : image[y]) putF32(data, static_cast<float>(c.b / scale));
+		for (const Color& c : image[y]) putF32(data, static_cast<float>(c.g / scale));
+		for (const Color& c : image[y]) putF32(data, static_cast<float>(c.r / scale));
+	}
+	return writeFile(path, data);
+}
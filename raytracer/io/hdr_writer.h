@@ -0,0 +1,20 @@
+#ifndef HDR_WRITER_H
+#define HDR_WRITER_H
+
+#include <string>
+#include <vector>
+#include "../include/color.h"
+
+// Float image writers for the unclamped framebuffer. Pixel values are
+// divided by scale on the way out; the renderer's 0-255 range is written
+// with scale 255 so that 1.0 is display white and highlights go above it.
+// Both print the reason and return false on failure.
+
+// Portable float map: little endian 32-bit RGB, rows stored bottom to top.
+bool writePfm(const std::string& path, const std::vector<std::vector<Color>>& image, double scale);
+
+// Single part scanline OpenEXR with uncompressed 32-bit float B, G, R
+// channels, one scanline per block.
+bool writeExr(const std::string& path, const std::vector<std::vector<Color>>& image, double scale);
+
+#endif // HDR_WRITER_H
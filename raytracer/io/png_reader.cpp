@@ -0,0 +1,370 @@
+#include "png_reader.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+// Inflate (RFC 1951), following the structure of zlib's puff.c: stored,
+// fixed Huffman and dynamic Huffman blocks decoded one symbol at a time.
+// Decoding failures are reported as false all the way up.
+typedef struct BitReader {
+	const unsigned char* data;
+	size_t size;
+	size_t pos = 0;
+	uint32_t bit_buffer = 0;
+	int bit_count = 0;
+	bool overrun = false;
+
+	int bits(int count)
+	{
+		uint32_t value = bit_buffer;
+		while (bit_count < count)
+		{
+			if (pos >= size)
+			{
+				overrun = true;
+				return 0;
+			}
+			value |= static_cast<uint32_t>(data[pos++]) << bit_count;
+			bit_count += 8;
+		}
+		bit_buffer = value >> count;
+		bit_count -= count;
+		return static_cast<int>(value & ((1u << count) - 1));
+	}
+}BitReader;
+
+constexpr int MAX_CODE_BITS = 15;
+
+typedef struct Huffman {
+	short counts[MAX_CODE_BITS + 1]; // number of codes of each length
+	short symbols[288];              // symbols ordered by code
+}Huffman;
+
+// Builds canonical codes from code lengths. Incomplete codes are allowed
+// (a lone distance code is legal), over-subscribed ones are not.
+static bool buildHuffman(Huffman& huffman, const short* lengths, int n)
+{
+	std::memset(huffman.counts, 0, sizeof(huffman.counts));
+	for (int symbol = 0; symbol < n; symbol++)
+		huffman.counts[lengths[symbol]]++;
+	if (huffman.counts[0] == n) return true;
+
+	int left = 1;
+	for (int len = 1; len <= MAX_CODE_BITS; len++)
+	{
+		left <<= 1;
+		left -= huffman.counts[len];
+		if (left < 0) return false;
+	}
+
+	short offsets[MAX_CODE_BITS + 1];
+	offsets[1] = 0;
+	for (int len = 1; len < MAX_CODE_BITS; len++)
+		offsets[len + 1] = offsets[len] + huffman.counts[len];
+	for (int symbol = 0; symbol < n; symbol++)
+	{
+		if (lengths[symbol] != 0)
+			huffman.symbols[offsets[lengths[symbol]]++] = symbol;
+	}
+	return true;
+}
+
+// Returns the next symbol, or -1 on a bad code or truncated input.
+static int decodeSymbol(BitReader& in, const Huffman& huffman)
+{
+	int code = 0;
+	int first = 0;
+	int index = 0;
+	for (int len = 1; len <= MAX_CODE_BITS; len++)
+	{
+		code |= in.bits(1);
+		if (in.overrun) return -1;
+		int count = huffman.counts[len];
+		if (code - count < first)
+			return huffman.symbols[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+static const short LENGTH_BASE[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const short LENGTH_EXTRA[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const short DISTANCE_BASE[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577};
+static const short DISTANCE_EXTRA[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static bool inflateCodes(BitReader& in, const Huffman& lengths, const Huffman& distances,
+	std::vector<unsigned char>& out)
+{
+	while (true)
+	{
+		int symbol = decodeSymbol(in, lengths);
+		if (symbol < 0) return false;
+		if (symbol < 256)
+		{
+			out.push_back(static_cast<unsigned char>(symbol));
+			continue;
+		}
+		if (symbol == 256) return true;
+
+		symbol -= 257;
+		if (symbol >= 29) return false;
+		int length = LENGTH_BASE[symbol] + in.bits(LENGTH_EXTRA[symbol]);
+
+		symbol = decodeSymbol(in, distances);
+		if (symbol < 0 || symbol >= 30) return false;
+		size_t distance = DISTANCE_BASE[symbol] + in.bits(DISTANCE_EXTRA[symbol]);
+		if (in.overrun || distance > out.size()) return false;
+
+		size_t from = out.size() - distance;
+		for (int i = 0; i < length; i++)
+			out.push_back(out[from + i]);
+	}
+}
+
+static bool inflateStored(BitReader& in, std::vector<unsigned char>& out)
+{
+	in.bit_buffer = 0;
+	in.bit_count = 0;
+	if (in.pos + 4 > in.size) return false;
+	unsigned length = in.data[in.pos] | (in.data[in.pos + 1] << 8);
+	unsigned complement = in.data[in.pos + 2] | (in.data[in.pos + 3] << 8);
+	in.pos += 4;
+	if (length != (~complement & 0xffff) || in.pos + length > in.size) return false;
+	out.insert(out.end(), in.data + in.pos, in.data + in.pos + length);
+	in.pos += length;
+	return true;
+}
+
+static bool inflateFixed(BitReader& in, std::vector<unsigned char>& out)
+{
+	static Huffman lengths, distances;
+	static bool built = false;
+	if (!built)
+	{
+		short code_lengths[288];
+		int symbol = 0;
+		for (; symbol < 144; symbol++) code_lengths[symbol] = 8;
+		for (; symbol < 256; symbol++) code_lengths[symbol] = 9;
+		for (; symbol < 280; symbol++) code_lengths[symbol] = 7;
+		for (; symbol < 288; symbol++) code_lengths[symbol] = 8;
+		buildHuffman(lengths, code_lengths, 288);
+		for (symbol = 0; symbol < 30; symbol++) code_lengths[symbol] = 5;
+		buildHuffman(distances, code_lengths, 30);
+		built = true;
+	}
+	return inflateCodes(in, lengths, distances, out);
+}
+
+static bool inflateDynamic(BitReader& in, std::vector<unsigned char>& out)
+{
+	static const short ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+	int length_count = in.bits(5) + 257;
+	int distance_count = in.bits(5) + 1;
+	int code_count = in.bits(4) + 4;
+	if (in.overrun || length_count > 286 || distance_count > 30) return false;
+
+	short code_lengths[320] = {};
+	for (int i = 0; i < code_count; i++)
+		code_lengths[ORDER[i]] = in.bits(3);
+	Huffman code_huffman;
+	if (in.overrun || !buildHuffman(code_huffman, code_lengths, 19)) return false;
+
+	int index = 0;
+	while (index < length_count + distance_count)
+	{
+		int symbol = decodeSymbol(in, code_huffman);
+		if (symbol < 0) return false;
+		if (symbol < 16)
+		{
+			code_lengths[index++] = symbol;
+			continue;
+		}
+		short repeated = 0;
+		int repeat;
+		if (symbol == 16)
+		{
+			if (index == 0) return false;
+			repeated = code_lengths[index - 1];
+			repeat = 3 + in.bits(2);
+		}
+		else if (symbol == 17) repeat = 3 + in.bits(3);
+		else repeat = 11 + in.bits(7);
+		if (in.overrun || index + repeat > length_count + distance_count) return false;
+		while (repeat--) code_lengths[index++] = repeated;
+	}
+	if (code_lengths[256] == 0) return false;
+
+	Huffman lengths, distances;
+	if (!buildHuffman(lengths, code_lengths, length_count)
+		|| !buildHuffman(distances, code_lengths + length_count, distance_count))
+		return false;
+	return inflateCodes(in, lengths, distances, out);
+}
+
+// Inflates a zlib stream (2-byte header, deflate data, Adler-32 ignored).
+static bool zlibInflate(const std::vector<unsigned char>& compressed, std::vector<unsigned char>& out)
+{
+	if (compressed.size() < 2 || (compressed[0] & 0x0f) != 8
+		|| ((compressed[0] << 8) | compressed[1]) % 31 != 0 || (compressed[1] & 0x20))
+		return false;
+
+	BitReader in{compressed.data() + 2, compressed.size() - 2};
+	bool last = false;
+	while (!last)
+	{
+		last = in.bits(1);
+		int type = in.bits(2);
+		if (in.overrun) return false;
+		bool ok = false;
+		if (type == 0) ok = inflateStored(in, out);
+		else if (type == 1) ok = inflateFixed(in, out);
+		else if (type == 2) ok = inflateDynamic(in, out);
+		if (!ok) return false;
+	}
+	return true;
+}
+
+static uint32_t readBigEndian(const unsigned char* p)
+{
+	return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static unsigned char paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = std::abs(p - a);
+	int pb = std::abs(p - b);
+	int pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	if (pb <= pc) return b;
+	return c;
+}
+
+// Reverses the per-row filters in place; raw holds one filter byte per row.
+static bool unfilter(std::vector<unsigned char>& raw, int height, size_t stride, int bpp)
+{
+	for (int y = 0; y < height; y++)
+	{
+		unsigned char* row = raw.data() + y * (stride + 1);
+		unsigned char filter = row[0];
+		row++;
+		const unsigned char* prior = y > 0 ? row - (stride + 1) : nullptr;
+		for (size_t x = 0; x < stride; x++)
+		{
+			int a = x >= size_t(bpp) ? row[x - bpp] : 0;
+			int b = prior ? prior[x] : 0;
+			int c = prior && x >= size_t(bpp) ? prior[x - bpp] : 0;
+			switch (filter)
+			{
+			case 0: break;
+			case 1: row[x] += a; break;
+			case 2: row[x] += b; break;
+			case 3: row[x] += (a + b) / 2; break;
+			case 4: row[x] += paeth(a, b, c); break;
+			default: return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool readPng(const std::string& path, int& width, int& height, std::vector<unsigned char>& rgb)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cerr << "Could not open image: " << path << std::endl;
+		return false;
+	}
+	std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	static const unsigned char SIGNATURE[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+	if (bytes.size() < 8 || std::memcmp(bytes.data(), SIGNATURE, 8) != 0)
+	{
+		std::cerr << "Not a PNG file: " << path << std::endl;
+		return false;
+	}
+
+	int bit_depth = 0, color_type = 0, interlace = 0;
+	std::vector<unsigned char> compressed;
+	size_t pos = 8;
+	while (pos + 12 <= bytes.size())
+	{
+		uint32_t length = readBigEndian(&bytes[pos]);
+		std::string type(reinterpret_cast<const char*>(&bytes[pos + 4]), 4);
+		const unsigned char* chunk = &bytes[pos + 8];
+		if (length > bytes.size() - pos - 12) break;
+
+		if (type == "IHDR" && length >= 13)
+		{
+			width = readBigEndian(chunk);
+			height = readBigEndian(chunk + 4);
+			bit_depth = chunk[8];
+			color_type = chunk[9];
+			interlace = chunk[12];
+		}
+		else if (type == "IDAT")
+			compressed.insert(compressed.end(), chunk, chunk + length);
+		else if (type == "IEND")
+			break;
+		pos += 12 + length;
+	}
+
+	int channels = 0;
+	switch (color_type)
+	{
+	case 0: channels = 1; break;
+	case 2: channels = 3; break;
+	case 4: channels = 2; break;
+	case 6: channels = 4; break;
+	}
+	if (bit_depth != 8 || channels == 0 || interlace != 0 || width <= 0 || height <= 0)
+	{
+		std::cerr << "Unsupported PNG format (only 8-bit, non-interlaced, non-palette images): "
+			<< path << std::endl;
+		return false;
+	}
+
+	size_t stride = size_t(width) * channels;
+	std::vector<unsigned char> raw;
+	raw.reserve((stride + 1) * height);
+	if (!zlibInflate(compressed, raw) || raw.size() < (stride + 1) * height
+		|| !unfilter(raw, height, stride, channels))
+	{
+		std::cerr << "Corrupt PNG data: " << path << std::endl;
+		return false;
+	}
+
+	rgb.resize(size_t(width) * height * 3);
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char* row = raw.data() + y * (stride + 1) + 1;
+		for (int x = 0; x < width; x++)
+		{
+			const unsigned char* pixel = row + x * channels;
+			unsigned char* out = &rgb[(size_t(y) * width + x) * 3];
+			bool gray = channels < 3;
+			out[0] = pixel[0];
+			out[1] = gray ? pixel[0] : pixel[1];
+			out[2] = gray ? pixel[0] : pixel[2];
+		}
+	}
+	return true;
+}
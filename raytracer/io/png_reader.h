@@ -0,0 +1,13 @@
+#ifndef PNG_READER_H
+#define PNG_READER_H
+
+#include <string>
+#include <vector>
+
+// Minimal PNG decoder, enough to read back the reference images under
+// outputs/: 8-bit grayscale, RGB, gray+alpha and RGBA, non-interlaced. The
+// image is returned as tightly packed 8-bit RGB rows, top to bottom; alpha
+// is dropped. Prints the reason and returns false for anything else.
+bool readPng(const std::string& path, int& width, int& height, std::vector<unsigned char>& rgb);
+
+#endif // PNG_READER_H
@@ -0,0 +1,112 @@
+#include "light_tree.h"
+
+#include <algorithm>
+#include <numeric>
+
+static double brightestChannel(const Color& c)
+{
+	return std::max(c.r, std::max(c.g, c.b));
+}
+
+static double squaredDistanceToBox(const Vec3& point, const AABB& box)
+{
+	double squared = 0.0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		double p = point[axis];
+		double gap = 0.0;
+		if (p < box[axis].min) gap = box[axis].min - p;
+		else if (p > box[axis].max) gap = p - box[axis].max;
+		squared += gap * gap;
+	}
+	return squared;
+}
+
+LightTree::LightTree(const std::vector<PointLight>& lights)
+{
+	if (lights.empty()) return;
+
+	std::vector<int> ids(lights.size());
+	std::iota(ids.begin(), ids.end(), 0);
+	nodes.reserve(2 * lights.size());
+	build(lights, ids, 0, static_cast<int>(ids.size()));
+}
+
+int LightTree::build(const std::vector<PointLight>& lights, std::vector<int>& ids, int begin, int end)
+{
+	int index = static_cast<int>(nodes.size());
+	nodes.push_back(LightNode());
+
+	if (end - begin == 1)
+	{
+		const PointLight& light = lights[ids[begin]];
+		nodes[index].bounds = AABB(light.position, light.position);
+		nodes[index].intensity = brightestChannel(light.intensity);
+		nodes[index].left = -1;
+		nodes[index].right = -1;
+		nodes[index].light = ids[begin];
+		return index;
+	}
+
+	AABB bounds(lights[ids[begin]].position, lights[ids[begin]].position);
+	for (int i = begin + 1; i < end; i++)
+		bounds = AABB(bounds, AABB(lights[ids[i]].position, lights[ids[i]].position));
+
+	int axis = 0;
+	for (int i = 1; i < 3; i++)
+	{
+		if (bounds[i].getLength() > bounds[axis].getLength()) axis = i;
+	}
+
+	int mid = (begin + end) / 2;
+	std::nth_element(ids.begin() + begin, ids.begin() + mid, ids.begin() + end,
+		[&lights, axis](int a, int b) {
+			return lights[a].position[axis] < lights[b].position[axis];
+		});
+
+	int left = build(lights, ids, begin, mid);
+	int right = build(lights, ids, mid, end);
+
+	nodes[index].bounds = AABB(nodes[left].bounds, nodes[right].bounds);
+	nodes[index].intensity = nodes[left].intensity + nodes[right].intensity;
+	nodes[index].left = left;
+	nodes[index].right = right;
+	nodes[index].light = -1;
+	return index;
+}
+
+void LightTree::collect(const Vec3& point, double threshold, double error_bound,
+	std::vector<int>& light_ids) const
+{
+	if (nodes.empty()) return;
+
+	size_t first = light_ids.size();
+	double skipped = 0.0;
+	thread_local std::vector<int> stack;
+	stack.clear();
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		const LightNode& node = nodes[stack.back()];
+		stack.pop_back();
+
+		double squared = squaredDistanceToBox(point, node.bounds);
+		double bound = squared > 0.0 ? node.intensity / squared : INFINITY;
+		if (bound < threshold && skipped + bound <= error_bound)
+		{
+			skipped += bound;
+			continue;
+		}
+
+		if (node.light >= 0)
+		{
+			light_ids.push_back(node.light);
+		}
+		else
+		{
+			stack.push_back(node.right);
+			stack.push_back(node.left);
+		}
+	}
+	std::sort(light_ids.begin() + first, light_ids.end());
+}
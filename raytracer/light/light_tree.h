@@ -0,0 +1,38 @@
+#ifndef LIGHT_TREE_H
+#define LIGHT_TREE_H
+
+#include <vector>
+#include "light.h"
+#include "../include/aabb.h"
+
+// Bounding volume hierarchy over the point lights. Every node knows the
+// summed intensity of the lights below it, so at a shading point a whole
+// subtree can be bounded by intensity / distance^2 to its box and skipped
+// when that bound is negligible.
+class LightTree {
+public:
+	LightTree() = default;
+	LightTree(const std::vector<PointLight>& lights);
+
+	// Appends the indices (into the light list the tree was built from) of
+	// the lights worth shading at point, in their original order. A subtree
+	// is skipped when its contribution bound is below threshold, as long as
+	// the bounds skipped so far at this point stay within error_bound.
+	void collect(const Vec3& point, double threshold, double error_bound,
+		std::vector<int>& light_ids) const;
+
+private:
+	typedef struct LightNode {
+		AABB bounds;
+		double intensity; // sum of the brightest channel of each light
+		int left;
+		int right;
+		int light; // index of the light for leaves, -1 for inner nodes
+	}LightNode;
+
+	int build(const std::vector<PointLight>& lights, std::vector<int>& ids, int begin, int end);
+
+	std::vector<LightNode> nodes;
+};
+
+#endif // LIGHT_TREE_H
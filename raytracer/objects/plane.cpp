@@ -13,6 +13,7 @@ Plane::Plane(const Plane_& _plane, const std::vector<Vec3f_>& _vertex_data)
 }
 bool Plane::hit(const Ray& ray, const Interval& interval, HitRecord& rec) const
 {
+	RenderStats::local().primitive_tests++;
 	double denom = normal.dot(ray.direction);
 	if (std::abs(denom) > 1e-6)
 	{
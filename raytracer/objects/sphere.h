@@ -5,6 +5,12 @@
 #include "../include/parser.hpp"
 #include "../include/aabb.h"
 
+// Pointer-free copy of a sphere for shared scene segments.
+typedef struct SphereData {
+	Vec3 center;
+	double radius;
+	int material_id;
+}SphereData;
 
 class Sphere : public Hittable {
 public:
@@ -21,11 +27,31 @@ public:
 
 	bool hit(const Ray& ray, Interval ray_t, HitRecord& rec) const override
 	{
+		return intersect(getData(), this, ray, ray_t, rec);
+	}
+
+	SphereData getData() const { return SphereData{ center, radius, material_id }; }
+
+	// Moves or resizes the sphere in place; the BVH above it needs a refit.
+	void setData(const SphereData& data)
+	{
+		center = data.center;
+		radius = data.radius;
+		material_id = data.material_id;
+		bounding_box = AABB(center - Vec3(radius, radius, radius),
+			center + Vec3(radius, radius, radius));
+	}
+
+	// hit() on bare sphere data; the record points at object.
+	static bool intersect(const SphereData& sphere, const Hittable* object,
+		const Ray& ray, Interval ray_t, HitRecord& rec)
+	{
+		RenderStats::local().primitive_tests++;
 
-		Vec3 oc = ray.origin - center;
+		Vec3 oc = ray.origin - sphere.center;
 		double a = ray.direction.dot(ray.direction);
 		double b = oc.dot(ray.direction);
-		double c = oc.dot(oc) - radius * radius;
+		double c = oc.dot(oc) - sphere.radius * sphere.radius;
 		double discriminant = b * b - a * c;
 
 		// Intersection occurs
@@ -39,12 +65,13 @@ public:
 				double t = (t1 >= 0) ? t1 : t2;
 
 				Vec3 hitPoint = ray.origin + ray.direction * t;
-				Vec3 normal = (hitPoint - center).normalize();
+				Vec3 normal = (hitPoint - sphere.center).normalize();
 
 				rec.t = t;
 				rec.point = hitPoint;
 				rec.normal = normal;
-				rec.material_id = material_id;
+				rec.material_id = sphere.material_id;
+				rec.object = object;
 				rec.set_front_face(ray);
 				return true;
 			}
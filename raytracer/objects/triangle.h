@@ -5,120 +5,174 @@
 #include "../include/parser.hpp"
 #include "../include/aabb.h"
 
+// Everything a triangle is intersected against. It holds no pointers, so a
+// shared scene segment can store it as is and intersect it in place.
+typedef struct TriangleData {
+	Vec3 normal;
+	Vec3 indices[3];
+	AABB bounding_box;
+	int material_id;
+	bool smooth_shading;
+	Vec3 per_vertex_normals[3];
+}TriangleData;
 
 class Triangle : public Hittable {
 public:
 
 	Triangle(Vec3 _indices[3], int _material_id)
-		: indices{_indices[0], _indices[1], _indices[2]},
-		material_id(_material_id)
 	{
-		Vec3 min = indices[0];
-		Vec3 max = indices[0];
-		for (int i = 1; i < 3; i++)
-		{
-			min.x = fmin(indices[i].x, min.x);
-			max.x = fmax(indices[i].x, max.x);
-			min.y = fmin(indices[i].y, min.y);
-			max.y = fmax(indices[i].y, max.y);
-			min.z = fmin(indices[i].z, min.z);
-			max.z = fmax(indices[i].z, max.z);
-		}
-		bounding_box = AABB(min, max);
-		Vec3 vec1 = indices[1] - indices[0];
-		Vec3 vec2 = indices[2] - indices[0];
-		vec1 = vec1.cross(vec2);
-		vec1.normalize();
-		this->normal = vec1;
+		data.indices[0] = _indices[0];
+		data.indices[1] = _indices[1];
+		data.indices[2] = _indices[2];
+		data.material_id = _material_id;
+		data.smooth_shading = false;
+		computeGeometry();
 	}
 
 	Triangle(Vec3 _indices[3], int _material_id, Vec3 _per_vertex_normals[3])
-		: indices{ _indices[0], 
-		_indices[1], 
-		_indices[2] },
-		material_id(_material_id), 
-		smooth_shading(true), 
-		per_vertex_normals{ _per_vertex_normals[0], 
-		_per_vertex_normals[1],
-		_per_vertex_normals[2] }
 	{
-		Vec3 min = indices[0];
-		Vec3 max = indices[0];
-		for (int i = 1; i < 3; i++)
-		{
-			min.x = fmin(indices[i].x, min.x);
-			max.x = fmax(indices[i].x, max.x);
-			min.y = fmin(indices[i].y, min.y);
-			max.y = fmax(indices[i].y, max.y);
-			min.z = fmin(indices[i].z, min.z);
-			max.z = fmax(indices[i].z, max.z);
-		}
-		bounding_box = AABB(min, max);
-		Vec3 vec1 = indices[1] - indices[0];
-		Vec3 vec2 = indices[2] - indices[0];
-		vec1 = vec1.cross(vec2);
-		vec1.normalize();
-		this->normal = vec1;
+		data.indices[0] = _indices[0];
+		data.indices[1] = _indices[1];
+		data.indices[2] = _indices[2];
+		data.material_id = _material_id;
+		data.smooth_shading = true;
+		data.per_vertex_normals[0] = _per_vertex_normals[0];
+		data.per_vertex_normals[1] = _per_vertex_normals[1];
+		data.per_vertex_normals[2] = _per_vertex_normals[2];
+		computeGeometry();
+	}
+
+	bool hit(const Ray& ray, Interval ray_t, HitRecord& rec) const override
+	{
+		return intersect(data, this, ray, ray_t, rec);
+	}
+
+	void hitPacket(const RayPacket& packet, LaneMask active,
+		const Interval* ray_t, double* closest_t, HitRecord* recs,
+		LaneMask& hit_mask) const override
+	{
+		intersectPacket(data, this, packet, active, ray_t, closest_t, recs, hit_mask);
 	}
 
+	AABB getAABB() const override { return data.bounding_box; }
 
+	const TriangleData& getData() const { return data; }
 
-	bool hit(const Ray& ray, Interval ray_t, HitRecord& rec) const override
+	// Moves the corners, and the vertex normals of a smooth triangle, in
+	// place; the BVH above it needs a refit.
+	void setVertices(const Vec3 _indices[3], const Vec3 _per_vertex_normals[3])
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			data.indices[i] = _indices[i];
+			if (data.smooth_shading)
+				data.per_vertex_normals[i] = _per_vertex_normals[i];
+		}
+		computeGeometry();
+	}
+
+	// hit() and hitPacket() on bare triangle data; records point at object.
+	static bool intersect(const TriangleData& tri, const Hittable* object,
+		const Ray& ray, Interval ray_t, HitRecord& rec)
 	{
-		Vec3 c1 = indices[0] - indices[1];
-		Vec3 c2 = indices[0] - indices[2];
+		RenderStats::local().primitive_tests++;
+		Vec3 c1 = tri.indices[0] - tri.indices[1];
+		Vec3 c2 = tri.indices[0] - tri.indices[2];
 		Vec3 c3 = ray.direction;
 		double detA = det(c1, c2, c3);
 		if (detA == 0) return false;
 
-		c1 = indices[0] - ray.origin;
+		c1 = tri.indices[0] - ray.origin;
 		double beta = det(c1, c2, c3) / detA;
 
 		c2 = c1;
-		c1 = indices[0] - indices[1];
+		c1 = tri.indices[0] - tri.indices[1];
 		double gamma = det(c1, c2, c3) / detA;
 
 		c3 = c2;
-		c2 = indices[0] - indices[2];
+		c2 = tri.indices[0] - tri.indices[2];
 		double t = det(c1, c2, c3) / detA;
 
 		if (t < ray_t.min + 0.00000001 || 0.00000001 + t > ray_t.max) return false;
 
 		if (beta + gamma <= 1 && beta + 0.00000001 >= 0 && gamma + 0.00000001 >= 0)
 		{
-			rec.t = t;
-			rec.point = ray.origin + ray.direction * t;
-			rec.material_id = material_id;
-			if (this->smooth_shading)
-			{
-				Vec3 barycentric_coords = barycentricCoefficients(rec.point);
-				rec.normal = per_vertex_normals[0] * barycentric_coords.x +
-					per_vertex_normals[1] * barycentric_coords.y +
-					per_vertex_normals[2] * barycentric_coords.z;
-				rec.normal.normalize();
-			}
-			else
-			{
-				rec.normal = this->normal;
-			}
-			rec.set_front_face(ray);
+			fillRecord(tri, object, ray, t, rec);
 			return true;
 		}
 		return false;
-		
+
 	}
 
-	AABB getAABB() const override { return bounding_box; }
+	// Cramer's rule from intersect(), evaluated for all lanes in
+	// structure-of-arrays form with the same operation order, so packet and
+	// single-ray results match bit for bit.
+	static void intersectPacket(const TriangleData& tri, const Hittable* object,
+		const RayPacket& packet, LaneMask active,
+		const Interval* ray_t, double* closest_t, HitRecord* recs,
+		LaneMask& hit_mask)
+	{
+		RenderStats::local().primitive_tests += activeLaneCount(active);
+		const Vec3 c1 = tri.indices[0] - tri.indices[1];
+		const Vec3 c2 = tri.indices[0] - tri.indices[2];
+		double t[MAX_PACKET_SIZE];
+		double beta[MAX_PACKET_SIZE];
+		double gamma[MAX_PACKET_SIZE];
+		double detA[MAX_PACKET_SIZE];
+
+		for (int lane = 0; lane < packet.size; lane++)
+		{
+			const double dx = packet.direction_x[lane];
+			const double dy = packet.direction_y[lane];
+			const double dz = packet.direction_z[lane];
+			const double ox = tri.indices[0].x - packet.origin_x[lane];
+			const double oy = tri.indices[0].y - packet.origin_y[lane];
+			const double oz = tri.indices[0].z - packet.origin_z[lane];
+
+			detA[lane] = det(c1.x, c1.y, c1.z, c2.x, c2.y, c2.z, dx, dy, dz);
+			beta[lane] = det(ox, oy, oz, c2.x, c2.y, c2.z, dx, dy, dz) / detA[lane];
+			gamma[lane] = det(c1.x, c1.y, c1.z, ox, oy, oz, dx, dy, dz) / detA[lane];
+			t[lane] = det(c1.x, c1.y, c1.z, c2.x, c2.y, c2.z, ox, oy, oz) / detA[lane];
+		}
+
+		for (int lane = 0; lane < packet.size; lane++)
+		{
+			if (!laneActive(active, lane) || detA[lane] == 0) continue;
+			if (t[lane] < ray_t[lane].min + 0.00000001 || 0.00000001 + t[lane] > ray_t[lane].max) continue;
+			if (!(beta[lane] + gamma[lane] <= 1 && beta[lane] + 0.00000001 >= 0 && gamma[lane] + 0.00000001 >= 0)) continue;
+			if (t[lane] > closest_t[lane]) continue;
+
+			closest_t[lane] = t[lane];
+			fillRecord(tri, object, packet.rays[lane], t[lane], recs[lane]);
+			hit_mask |= LaneMask(1) << lane;
+		}
+	}
 
 private:
-	Vec3 normal;
-	Vec3 indices[3];
-	AABB bounding_box;
-	int material_id;
-	bool smooth_shading = false;
-	Vec3 per_vertex_normals[3];
+	TriangleData data;
 
-	inline double det(const Vec3& c0, const Vec3& c1, const Vec3& c2) const
+	void computeGeometry()
+	{
+		Vec3 min = data.indices[0];
+		Vec3 max = data.indices[0];
+		for (int i = 1; i < 3; i++)
+		{
+			min.x = fmin(data.indices[i].x, min.x);
+			max.x = fmax(data.indices[i].x, max.x);
+			min.y = fmin(data.indices[i].y, min.y);
+			max.y = fmax(data.indices[i].y, max.y);
+			min.z = fmin(data.indices[i].z, min.z);
+			max.z = fmax(data.indices[i].z, max.z);
+		}
+		data.bounding_box = AABB(min, max);
+		Vec3 vec1 = data.indices[1] - data.indices[0];
+		Vec3 vec2 = data.indices[2] - data.indices[0];
+		vec1 = vec1.cross(vec2);
+		vec1.normalize();
+		data.normal = vec1;
+	}
+
+	static inline double det(const Vec3& c0, const Vec3& c1, const Vec3& c2)
 	{
 		double temp1 = c0.x *
 			(c1.y * c2.z - c1.z * c2.y);
@@ -132,11 +186,49 @@ private:
 		return temp1 - temp2 + temp3;
 	}
 
-	inline Vec3 barycentricCoefficients(const Vec3& point) const
+	static inline double det(double c0x, double c0y, double c0z,
+		double c1x, double c1y, double c1z,
+		double c2x, double c2y, double c2z)
+	{
+		double temp1 = c0x *
+			(c1y * c2z - c1z * c2y);
+
+		double temp2 = c1x *
+			(c0y * c2z - c0z * c2y);
+
+		double temp3 = c2x *
+			(c0y * c1z - c0z * c1y);
+
+		return temp1 - temp2 + temp3;
+	}
+
+	static inline void fillRecord(const TriangleData& tri, const Hittable* object,
+		const Ray& ray, double t, HitRecord& rec)
+	{
+		rec.t = t;
+		rec.point = ray.origin + ray.direction * t;
+		rec.material_id = tri.material_id;
+		rec.object = object;
+		if (tri.smooth_shading)
+		{
+			Vec3 barycentric_coords = barycentricCoefficients(tri, rec.point);
+			rec.normal = tri.per_vertex_normals[0] * barycentric_coords.x +
+				tri.per_vertex_normals[1] * barycentric_coords.y +
+				tri.per_vertex_normals[2] * barycentric_coords.z;
+			rec.normal.normalize();
+		}
+		else
+		{
+			rec.normal = tri.normal;
+		}
+		rec.set_front_face(ray);
+	}
+
+	static inline Vec3 barycentricCoefficients(const TriangleData& tri, const Vec3& point)
 	{
-		Vec3 v0 = indices[1] - indices[0];
-		Vec3 v1 = indices[2] - indices[0];
-		Vec3 v2 = point - indices[0];
+		Vec3 v0 = tri.indices[1] - tri.indices[0];
+		Vec3 v1 = tri.indices[2] - tri.indices[0];
+		Vec3 v2 = point - tri.indices[0];
 		double d00 = v0.dot(v0);
 		double d01 = v0.dot(v1);
 		double d11 = v1.dot(v1);
@@ -152,4 +244,4 @@ private:
 
 };
 
-#endif // !TRIANGLE_H
\ No newline at end of file
+#endif // !TRIANGLE_H
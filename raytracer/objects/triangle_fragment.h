@@ -0,0 +1,57 @@
+#ifndef TRIANGLE_FRAGMENT_H
+#define TRIANGLE_FRAGMENT_H
+
+#include <memory>
+#include <vector>
+#include "triangle.h"
+
+// A convex piece of a triangle the early split pass cut off, for the BVH to
+// sort on its own tighter box. Rays are still intersected against the
+// whole triangle and records point at it, so fragments of one triangle
+// find the same hits. Corners are kept as barycentric weights, so the box
+// follows the triangle when it moves.
+class TriangleFragment : public Hittable {
+public:
+	TriangleFragment(std::shared_ptr<Triangle> _triangle, std::vector<Vec3> _weights)
+		: triangle(_triangle), weights(std::move(_weights))
+	{
+	}
+
+	bool hit(const Ray& ray, Interval ray_t, HitRecord& rec) const override
+	{
+		return triangle->hit(ray, ray_t, rec);
+	}
+
+	void hitPacket(const RayPacket& packet, LaneMask active,
+		const Interval* ray_t, double* closest_t, HitRecord* recs,
+		LaneMask& hit_mask) const override
+	{
+		triangle->hitPacket(packet, active, ray_t, closest_t, recs, hit_mask);
+	}
+
+	AABB getAABB() const override
+	{
+		Vec3 low(INFINITY), high(-INFINITY);
+		for (const Vec3& weight : weights)
+		{
+			Vec3 corner = cornerAt(weight);
+			low = Vec3(std::min(low.x, corner.x), std::min(low.y, corner.y), std::min(low.z, corner.z));
+			high = Vec3(std::max(high.x, corner.x), std::max(high.y, corner.y), std::max(high.z, corner.z));
+		}
+		return AABB(low, high);
+	}
+
+	const Triangle* getTriangle() const { return triangle.get(); }
+
+private:
+	Vec3 cornerAt(const Vec3& weight) const
+	{
+		const TriangleData& data = triangle->getData();
+		return data.indices[0] * weight.x + data.indices[1] * weight.y + data.indices[2] * weight.z;
+	}
+
+	std::shared_ptr<Triangle> triangle;
+	std::vector<Vec3> weights; // of the triangle's corners, per fragment corner
+};
+
+#endif // TRIANGLE_FRAGMENT_H
@@ -55,19 +55,55 @@ static double fresnelReflectance(double r_parallel, double r_perpendicular)
 	return (r_parallel * r_parallel + r_perpendicular * r_perpendicular) / 2.0;
 }
 
+double conductorReflectance(double cos_theta, const Material& mat)
+{
+	double k = mat.absorption_index; // Assuming k is the same for r, g, b
+	double n = static_cast<double>(mat.refraction_index);
+	double rs_num = (n * n) + (k * k)
+		- (n * cos_theta * static_cast<double>(2.0))
+		+ (cos_theta * cos_theta);
+	double rs_den = (n * n) + (k * k)
+		+ (n * cos_theta * static_cast<double>(2.0))
+		+ (cos_theta * cos_theta);
+	double rs = rs_num / rs_den;
+
+	double rp_num = ((n * n) + (k * k)) * (cos_theta * cos_theta)
+		- (n * cos_theta * static_cast<double>(2.0))
+		+ 1.0;
+	double rp_den = ((n * n) + (k * k)) * (cos_theta * cos_theta)
+		+ (n * cos_theta * static_cast<double>(2.0))
+		+ 1.0;
+	double rp = rp_num / rp_den;
+	return (rs + rp) * 0.5;
+}
+
+double dielectricReflectance(double cos_theta, double sin2_theta_t, double n1, double n2)
+{
+	if (sin2_theta_t > 1.0) return 1.0; // total internal reflection
+	double cos_theta_t = sqrt(1.0 - sin2_theta_t);
+	double r_par = r_parallel(cos_theta, cos_theta_t, n1, n2);
+	double r_perp = r_perpendicular(cos_theta, cos_theta_t, n1, n2);
+	return fresnelReflectance(r_par, r_perp);
+}
+
+
+std::atomic<int> BaseRayTracer::next_generation(0);
 
 BaseRayTracer::BaseRayTracer(Color& background_color,
 	LightSources& light_sources,
-	BvhNode& world,
+	LightTree& light_tree,
+	const Hittable& world,
 	std::vector<Plane>& planes,
 	MaterialManager& material_manager,
 	RendererInfo& renderer_info)
 	:background_color(background_color),
 	 light_sources(light_sources),
+	light_tree(light_tree),
 		world(world),
 	planes(planes),
 		material_manager(material_manager),
-	renderer_info(renderer_info)
+	renderer_info(renderer_info),
+	generation(next_generation++)
 {
 }
 
@@ -75,29 +111,151 @@ Color BaseRayTracer::traceRay(const Ray& ray) const
 {
 	// Placeholder implementation: return background color
 	double min_t = INFINITY;
-	return computeColor(ray, renderer_info.max_recursion_depth + 1);
+	return computeColor(ray, renderer_info.max_recursion_depth + 1, RayKind::Primary);
+}
+
+// Counts primary rays that hit the same primitive as the thread's previous
+// primary ray, which shows how coherent the pixel order is.
+static void countPrimaryHit(bool hit, const HitRecord& rec)
+{
+	thread_local const Hittable* previous = nullptr;
+	const Hittable* object = hit ? rec.object : nullptr;
+	if (object && object == previous)
+		RenderStats::local().primary_hit_repeats++;
+	previous = object;
 }
 
-Color BaseRayTracer::computeColor(const Ray& ray, int depth) const
+Color BaseRayTracer::computeColor(const Ray& ray, int depth, RayKind kind) const
 {
 	if (depth <= 0) return Color(0, 0, 0);
+	RenderStats::local().rays(kind)++;
 
 	HitRecord rec;
+	bool hit_anything = intersect(ray, rec);
+	if (kind == RayKind::Primary)
+		countPrimaryHit(hit_anything, rec);
+	return resolveHit(ray, depth, hit_anything, rec);
+}
+
+bool BaseRayTracer::intersectPrimary(const Ray& ray, OUT HitRecord& rec) const
+{
+	RenderStats::local().primary_rays++;
+	bool hit_anything = intersect(ray, rec);
+	countPrimaryHit(hit_anything, rec);
+	return hit_anything;
+}
+
+Color BaseRayTracer::shadePrimary(const Ray& ray, bool hit_anything, HitRecord& rec) const
+{
+	return resolveHit(ray, renderer_info.max_recursion_depth + 1, hit_anything, rec);
+}
+
+// Closest hit among the planes and the BVH.
+bool BaseRayTracer::intersect(const Ray& ray, OUT HitRecord& rec) const
+{
 	bool hit_plane = false;
 	hit_plane = this->hitPlanes(ray, Interval(renderer_info.shadow_ray_epsilon, INFINITY), rec);
 
 	double closest_t = hit_plane ? rec.t : INFINITY;
 
-	if (!world.hit(ray, Interval(renderer_info.shadow_ray_epsilon, closest_t), rec))
+	bool hit_world = world.hit(ray, Interval(renderer_info.shadow_ray_epsilon, closest_t), rec);
+	return hit_plane || hit_world;
+}
+
+// Primary rays of a packet share one BVH descent; planes are few, so they
+// are still tested per lane. Shading and every secondary bounce diverge and
+// fall back to single rays through computeColor.
+void BaseRayTracer::tracePacket(const RayPacket& packet, Color* colors) const
+{
+	int depth = renderer_info.max_recursion_depth + 1;
+	RenderStats::local().primary_rays += packet.size;
+	HitRecord recs[MAX_PACKET_SIZE];
+	LaneMask hit_mask = intersectPacket(packet, recs);
+
+	for (int lane = 0; lane < packet.size; lane++)
+	{
+		countPrimaryHit(laneActive(hit_mask, lane), recs[lane]);
+		colors[lane] = resolveHit(packet.rays[lane], depth, laneActive(hit_mask, lane), recs[lane]);
+	}
+}
+
+// Closest hit per lane, with the same plane-then-world rules as intersect.
+LaneMask BaseRayTracer::intersectPacket(const RayPacket& packet, HitRecord* recs) const
+{
+	Interval ray_t[MAX_PACKET_SIZE];
+	double closest_t[MAX_PACKET_SIZE];
+	LaneMask hit_mask = 0;
+
+	for (int lane = 0; lane < packet.size; lane++)
+	{
+		bool hit_plane = hitPlanes(packet.rays[lane],
+			Interval(renderer_info.shadow_ray_epsilon, INFINITY), recs[lane]);
+		if (hit_plane) hit_mask |= LaneMask(1) << lane;
+		ray_t[lane] = Interval(renderer_info.shadow_ray_epsilon, hit_plane ? recs[lane].t : INFINITY);
+		closest_t[lane] = INFINITY;
+	}
+
+	world.hitPacket(packet, packet.fullMask(), ray_t, closest_t, recs, hit_mask);
+	return hit_mask;
+}
+
+// Lanes whose shadow ray is blocked before reaching its light. Lanes
+// blocked by their light's cached occluder skip the BVH descent.
+LaneMask BaseRayTracer::occludedPacket(const RayPacket& packet, const double* distances,
+	const int* light_ids) const
+{
+	OccluderCache& cache = occluderCache();
+	RenderCounters& counters = RenderStats::local();
+	counters.shadow_rays += packet.size;
+	HitRecord recs[MAX_PACKET_SIZE];
+	Interval ray_t[MAX_PACKET_SIZE];
+	double closest_t[MAX_PACKET_SIZE];
+	LaneMask occluded = 0;
+	LaneMask traverse = 0;
+
+	for (int lane = 0; lane < packet.size; lane++)
+	{
+		ray_t[lane] = Interval(0, distances[lane]);
+		closest_t[lane] = INFINITY;
+		if (hitsCachedOccluder(cache, packet.rays[lane], distances[lane], light_ids[lane]))
+		{
+			counters.occluder_cache_hits++;
+			occluded |= LaneMask(1) << lane;
+		}
+		else
+		{
+			counters.occluder_cache_misses++;
+			traverse |= LaneMask(1) << lane;
+		}
+	}
+
+	LaneMask world_hits = 0;
+	world.hitPacket(packet, traverse, ray_t, closest_t, recs, world_hits);
+
+	for (int lane = 0; lane < packet.size; lane++)
 	{
-		if (!hit_plane)
+		if (laneActive(world_hits, lane) && recs[lane].t <= distances[lane])
+		{
+			cache.occluders[light_ids[lane]] = recs[lane].object;
+			occluded |= LaneMask(1) << lane;
+		}
+		else if (laneActive(traverse, lane) && hitPlanes(packet.rays[lane], ray_t[lane], recs[lane]))
 		{
-			if (depth == renderer_info.max_recursion_depth + 1)
-				return Color(background_color);
-			else
-				return Color(0, 0, 0);
+			occluded |= LaneMask(1) << lane;
 		}
 	}
+	return occluded;
+}
+
+Color BaseRayTracer::resolveHit(const Ray& ray, int depth, bool hit_anything, HitRecord& rec) const
+{
+	if (!hit_anything)
+	{
+		if (depth == renderer_info.max_recursion_depth + 1)
+			return Color(background_color);
+		else
+			return Color(0, 0, 0);
+	}
 	if (renderer_info.backface_culling && !rec.front_face)
 		return Color(0, 0, 0);
 	return applyShading(ray, depth, rec);
@@ -114,7 +272,7 @@ Color BaseRayTracer::applyShading(const Ray& ray,
 		Vec3 wo = ray.direction * -1;
 		Vec3 wr = (rec.normal * (2 * (rec.normal.dot(wo)))) - wo;
 		Ray reflectedRay = Ray(rec.point + rec.normal * renderer_info.shadow_ray_epsilon, wr);
-		color += computeColor(reflectedRay, depth - 1) * Color(mat.mirror_reflectance);
+		color += computeColor(reflectedRay, depth - 1, RayKind::Reflection) * Color(mat.mirror_reflectance);
 	}
 	else if ((mat.type).compare("conductor") == 0)
 	{
@@ -123,27 +281,10 @@ Color BaseRayTracer::applyShading(const Ray& ray,
 		wr.normalize();
 		wo.normalize();
 		double cos_theta = wo.dot(rec.normal);
-		double k = mat.absorption_index; // Assuming k is the same for r, g, b
-		double n = static_cast<double>(mat.refraction_index);
-		double rs_num = (n * n) + (k * k)
-			- (n * cos_theta * static_cast<double>(2.0))
-			+ (cos_theta * cos_theta);
-		double rs_den = (n * n) + (k * k)
-			+ (n * cos_theta * static_cast<double>(2.0))
-			+ (cos_theta * cos_theta);
-		double rs = rs_num / rs_den;
-
-		double rp_num = ((n * n) + (k * k)) * (cos_theta * cos_theta)
-			- (n * cos_theta * static_cast<double>(2.0))
-			+ 1.0;
-		double rp_den = ((n * n) + (k * k)) * (cos_theta * cos_theta)
-			+ (n * cos_theta * static_cast<double>(2.0))
-			+ 1.0;
-		double rp = rp_num / rp_den;
-		double f_r = (rs + rp) * 0.5;
+		double f_r = conductorReflectance(cos_theta, mat);
 
 		Ray reflectedRay = Ray(rec.point + rec.normal * renderer_info.shadow_ray_epsilon, wr);
-		color += computeColor(reflectedRay, depth - 1) * f_r * mat.mirror_reflectance;
+		color += computeColor(reflectedRay, depth - 1, RayKind::Reflection) * f_r * mat.mirror_reflectance;
 	}
 	else if (mat.type == "dielectric")
 	{
@@ -158,15 +299,7 @@ Color BaseRayTracer::applyShading(const Ray& ray,
 		double eta = n1 / n2;
 		double cosTheta = std::clamp(wo.dot(normal), -1.0, 1.0);
 		double sin2ThetaT = eta * eta * (1 - cosTheta * cosTheta);
-		double F_r = 1.0;
-
-		if (sin2ThetaT <= 1.0)
-		{
-			double cosThetaT = sqrt(1.0 - sin2ThetaT);
-			double r_par = r_parallel(cosTheta, cosThetaT, n1, n2);
-			double r_perp = r_perpendicular(cosTheta, cosThetaT, n1, n2);
-			F_r = fresnelReflectance(r_par, r_perp);
-		}
+		double F_r = dielectricReflectance(cosTheta, sin2ThetaT, n1, n2);
 
 		// Reflection
 		Vec3 wr = reflect(wo, normal).normalize();
@@ -178,10 +311,10 @@ Color BaseRayTracer::applyShading(const Ray& ray,
 		{
 			Vec3 wt = (wo * -1) * eta + normal * (eta * cosTheta - sqrt(1 - sin2ThetaT));
 			Ray refractedRay(rec.point - normal * renderer_info.shadow_ray_epsilon, wt.normalize());
-			refractedColor = computeColor(refractedRay, depth - 1);
+			refractedColor = computeColor(refractedRay, depth - 1, RayKind::Refraction);
 		}
 
-		Color reflectedColor = computeColor(reflectedRay, depth - 1);
+		Color reflectedColor = computeColor(reflectedRay, depth - 1, RayKind::Reflection);
 		Color L = reflectedColor * F_r + refractedColor * (1 - F_r);
 
 		// Absorption when exiting
@@ -196,33 +329,48 @@ Color BaseRayTracer::applyShading(const Ray& ray,
 		return color + L;
 	}
 
-	for (const auto& light : light_sources.point_lights)
+	// Nothing below recurses, so one list per thread is enough.
+	thread_local std::vector<int> light_ids;
+	light_ids.clear();
+	const bool cull = cullsLights();
+	if (cull) collectLights(rec.point, light_ids);
+	const size_t light_count = cull ? light_ids.size() : light_sources.point_lights.size();
+
+	for (size_t i = 0; i < light_count; i++)
 	{
+		const PointLight& light = light_sources.point_lights[cull ? light_ids[i] : i];
 		Vec3 wi = Vec3(light.position) - rec.point;
 		double distance = wi.length();
 		wi.normalize();
 		Ray shadowRay = Ray(rec.point + rec.normal * renderer_info.shadow_ray_epsilon, wi);
-		HitRecord shadowRec;
-		HitRecord planeShadowRec;
-		if (!world.hit(shadowRay, Interval(0, distance), shadowRec) 
-			&& !hitPlanes(shadowRay, Interval(0, distance), planeShadowRec))
+		if (!occluded(shadowRay, distance, cull ? light_ids[i] : static_cast<int>(i)))
 		{
-			// Diffuse
-			double cosTheta = std::max(double(0.0f), rec.normal.dot(wi));
-			color += Color(mat.diffuse_reflectance) * Color(light.intensity) * (cosTheta / (distance * distance));
-
-			// Specular
-			Vec3 wo = (ray.origin - rec.point);
-			wo.normalize();
-			Vec3 h = (wi + wo);
-			h.normalize();
-			double cosAlpha = std::max(double(0.0f), rec.normal.dot(h));
-			color += Color(mat.specular_reflectance) * Color(light.intensity) * (pow(cosAlpha, mat.phong_exponent) / (distance * distance));
+			Color diffuse, specular;
+			directLighting(ray, rec, mat, light, wi, distance, diffuse, specular);
+			color += diffuse;
+			color += specular;
 		}
 	}
 	return color;
 }
 
+void BaseRayTracer::directLighting(const Ray& ray, const HitRecord& rec,
+	const Material& mat, const PointLight& light, const Vec3& wi, double distance,
+	OUT Color& diffuse, OUT Color& specular) const
+{
+	// Diffuse
+	double cosTheta = std::max(double(0.0f), rec.normal.dot(wi));
+	diffuse = Color(mat.diffuse_reflectance) * Color(light.intensity) * (cosTheta / (distance * distance));
+
+	// Specular
+	Vec3 wo = (ray.origin - rec.point);
+	wo.normalize();
+	Vec3 h = (wi + wo);
+	h.normalize();
+	double cosAlpha = std::max(double(0.0f), rec.normal.dot(h));
+	specular = Color(mat.specular_reflectance) * Color(light.intensity) * (pow(cosAlpha, mat.phong_exponent) / (distance * distance));
+}
+
 bool BaseRayTracer::hitPlanes(const Ray& ray, Interval ray_t, HitRecord& rec) const
 {
 	bool hit_anything = false;
@@ -242,5 +390,60 @@ bool BaseRayTracer::hitPlanes(const Ray& ray, Interval ray_t, HitRecord& rec) co
 	return hit_anything;
 }
 
+bool BaseRayTracer::occluded(const Ray& shadow_ray, double distance, int light_id) const
+{
+	OccluderCache& cache = occluderCache();
+	RenderCounters& counters = RenderStats::local();
+	counters.shadow_rays++;
+	if (hitsCachedOccluder(cache, shadow_ray, distance, light_id))
+	{
+		counters.occluder_cache_hits++;
+		return true;
+	}
+	counters.occluder_cache_misses++;
+
+	// Spheres can report hits past the light (see hitsCachedOccluder);
+	// whether the BVH reaches them depends on its shape.
+	HitRecord shadowRec;
+	if (world.hit(shadow_ray, Interval(0, distance), shadowRec) && shadowRec.t <= distance)
+	{
+		cache.occluders[light_id] = shadowRec.object;
+		return true;
+	}
+	HitRecord planeShadowRec;
+	return hitPlanes(shadow_ray, Interval(0, distance), planeShadowRec);
+}
+
+// Sphere::hit does not clip against the interval, so the distance is checked
+// here; a cached hit then always implies a hit through the BVH as well.
+bool BaseRayTracer::hitsCachedOccluder(const OccluderCache& cache, const Ray& shadow_ray,
+	double distance, int light_id) const
+{
+	const Hittable* cached = cache.occluders[light_id];
+	HitRecord shadowRec;
+	return cached && cached->hit(shadow_ray, Interval(0, distance), shadowRec)
+		&& shadowRec.t <= distance;
+}
+
+BaseRayTracer::OccluderCache& BaseRayTracer::occluderCache() const
+{
+	thread_local OccluderCache cache;
+	// Lights can be added to a loaded scene between renders.
+	if (cache.generation != generation || cache.occluders.size() != light_sources.point_lights.size())
+	{
+		cache.generation = generation;
+		cache.occluders.assign(light_sources.point_lights.size(), nullptr);
+	}
+	return cache;
+}
 
+bool BaseRayTracer::cullsLights() const
+{
+	return renderer_info.light_cull_threshold > 0.0;
+}
 
+void BaseRayTracer::collectLights(const Vec3& point, OUT std::vector<int>& light_ids) const
+{
+	light_tree.collect(point, renderer_info.light_cull_threshold,
+		renderer_info.light_cull_error_bound, light_ids);
+}
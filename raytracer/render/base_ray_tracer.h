@@ -2,31 +2,85 @@
 #define BASE_RAY_TRACER_H
 #include "rendering_technique.h"
 #include "../objects/plane.h"
+#include "../light/light_tree.h"
+#include "../include/render_stats.h"
 #define OUT
 
+#include <atomic>
+
+double conductorReflectance(double cos_theta, const Material& mat);
+double dielectricReflectance(double cos_theta, double sin2_theta_t, double n1, double n2);
+
 class BaseRayTracer : public RenderingTechnique {
 public:
 	BaseRayTracer( Color& background_color,
 		LightSources& light_sources,
-		BvhNode& world,
+		LightTree& light_tree,
+		const Hittable& world,
 		std::vector<Plane>& planes,
 		MaterialManager& material_manager,
 		RendererInfo& renderer_info);
 
 	Color traceRay(const Ray& ray) const override;
 
-	Color computeColor(const Ray& ray, int depth) const;
+	void tracePacket(const RayPacket& packet, Color* colors) const;
+
+	LaneMask intersectPacket(const RayPacket& packet, HitRecord* recs) const;
+
+	LaneMask occludedPacket(const RayPacket& packet, const double* distances,
+		const int* light_ids) const;
+
+	bool occluded(const Ray& shadow_ray, double distance, int light_id) const;
+
+	Color computeColor(const Ray& ray, int depth, RayKind kind) const;
+
+	bool intersect(const Ray& ray, OUT HitRecord& rec) const;
+
+	// computeColor for a camera ray in two halves, so the hit can be kept
+	// and shaded again later: the first counts and intersects the ray, the
+	// second shades whatever it found.
+	bool intersectPrimary(const Ray& ray, OUT HitRecord& rec) const;
+	Color shadePrimary(const Ray& ray, bool hit_anything, HitRecord& rec) const;
+
+	Color resolveHit(const Ray& ray, int depth, bool hit_anything, HitRecord& rec) const;
 
 	Color applyShading(const Ray& ray, int depth, HitRecord& rec) const;
 
 	bool hitPlanes(const Ray& ray, Interval ray_t, HitRecord& rec) const;
 
+	bool cullsLights() const;
+
+	void collectLights(const Vec3& point, OUT std::vector<int>& light_ids) const;
+
+	void directLighting(const Ray& ray, const HitRecord& rec,
+		const Material& mat, const PointLight& light, const Vec3& wi, double distance,
+		OUT Color& diffuse, OUT Color& specular) const;
+
 	Color& background_color;
 	LightSources& light_sources;
-	BvhNode& world;
+	LightTree& light_tree;
+	const Hittable& world;
 	std::vector<Plane>& planes;
 	MaterialManager& material_manager;
 	RendererInfo& renderer_info;
+
+private:
+	// Last primitive that blocked a shadow ray toward each light, kept per
+	// worker thread. Neighbouring pixels are usually shadowed by the same
+	// primitive, so it is tested before a full traversal.
+	typedef struct OccluderCache {
+		int generation = -1;
+		std::vector<const Hittable*> occluders;
+	}OccluderCache;
+
+	OccluderCache& occluderCache() const;
+
+	bool hitsCachedOccluder(const OccluderCache& cache, const Ray& shadow_ray,
+		double distance, int light_id) const;
+
+	// Distinguishes tracers so a thread never reuses another scene's cache.
+	static std::atomic<int> next_generation;
+	const int generation;
 };
 
 #endif // BASE_RAY_TRACER_H
\ No newline at end of file
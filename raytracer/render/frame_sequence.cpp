@@ -0,0 +1,224 @@
+#include "frame_sequence.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+
+// Faces a worker thread poses at a time.
+constexpr size_t POSE_BATCH_SIZE = 1024;
+
+// An ObjectTransform_ ready to apply around one object's pivot.
+typedef struct Pose {
+	Vec3 pivot;
+	Vec3 scaling = Vec3(1.0);
+	Vec3 axis = Vec3(0.0, 1.0, 0.0);
+	double cos_angle = 1.0;
+	double sin_angle = 0.0;
+	Vec3 translation;
+
+	// Rodrigues' rotation about the unit axis.
+	Vec3 rotate(const Vec3& v) const
+	{
+		return v * cos_angle + axis.cross(v) * sin_angle + axis * (axis.dot(v) * (1.0 - cos_angle));
+	}
+
+	Vec3 point(const Vec3& p) const { return pivot + rotate((p - pivot) * scaling) + translation; }
+
+	// Normals take the inverse scaling, so they stay perpendicular to the
+	// scaled surface.
+	Vec3 normal(const Vec3& n) const { return rotate(n / scaling).normalize(); }
+}Pose;
+
+static Pose makePose(const ObjectTransform_& transform, const Vec3& pivot)
+{
+	Pose pose;
+	pose.pivot = pivot;
+	pose.scaling = Vec3(transform.scaling);
+	Vec3 axis(transform.rotation_axis);
+	if (axis.length() > 0.0)
+		pose.axis = axis.normalize();
+	double radians = transform.rotation_angle * M_PI / 180.0;
+	pose.cos_angle = std::cos(radians);
+	pose.sin_angle = std::sin(radians);
+	pose.translation = Vec3(transform.translation);
+	return pose;
+}
+
+// Index of the object with id, or -1.
+template <typename Raw>
+static int findById(const std::vector<Raw>& objects, int id)
+{
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		if (objects[i].id == id) return static_cast<int>(i);
+	}
+	return -1;
+}
+
+static std::string frameImageName(const std::string& image_name, size_t frame)
+{
+	std::filesystem::path path(image_name);
+	char number[16];
+	std::snprintf(number, sizeof(number), "_%04zu", frame);
+	return path.stem().string() + number + path.extension().string();
+}
+
+bool renderFrameSequence(LoadedScene& loaded_scene, const std::string& frames_path)
+{
+	if (loaded_scene.shared_scene)
+	{
+		std::cerr << "Animations need the scene built in this process, not an attached one" << std::endl;
+		return false;
+	}
+	std::vector<Frame_> frames;
+	std::string error;
+	if (!parseFrameSequence(frames_path, frames, error))
+	{
+		std::cerr << "Could not read " << frames_path << ": " << error << std::endl;
+		return false;
+	}
+
+	const Scene_& raw_scene = loaded_scene.raw_scene;
+	for (const Frame_& frame : frames)
+	{
+		for (const ObjectTransform_& transform : frame.meshes)
+		{
+			if (findById(raw_scene.meshes, transform.id) < 0)
+			{
+				std::cerr << "Animation moves mesh " << transform.id << ", which the scene does not have" << std::endl;
+				return false;
+			}
+		}
+		for (const ObjectTransform_& transform : frame.spheres)
+		{
+			if (findById(raw_scene.spheres, transform.id) < 0)
+			{
+				std::cerr << "Animation moves sphere " << transform.id << ", which the scene does not have" << std::endl;
+				return false;
+			}
+		}
+	}
+
+	// Every frame poses from the rest geometry, so error does not build up.
+	// Objects a frame leaves out go back to rest.
+	std::vector<std::vector<TriangleData>> rest_meshes(loaded_scene.mesh_objects.size());
+	std::vector<Vec3> mesh_pivots(loaded_scene.mesh_objects.size());
+	std::vector<bool> mesh_animated(loaded_scene.mesh_objects.size(), false);
+	std::vector<bool> sphere_animated(loaded_scene.sphere_objects.size(), false);
+	for (const Frame_& frame : frames)
+	{
+		for (const ObjectTransform_& transform : frame.meshes)
+			mesh_animated[findById(raw_scene.meshes, transform.id)] = true;
+		for (const ObjectTransform_& transform : frame.spheres)
+			sphere_animated[findById(raw_scene.spheres, transform.id)] = true;
+	}
+	std::vector<std::pair<int, int>> animated_faces; // (mesh, face)
+	for (size_t m = 0; m < loaded_scene.mesh_objects.size(); m++)
+	{
+		if (!mesh_animated[m]) continue;
+		AABB bounds;
+		for (size_t f = 0; f < loaded_scene.mesh_objects[m].size(); f++)
+		{
+			const TriangleData& data = loaded_scene.mesh_objects[m][f]->getData();
+			rest_meshes[m].push_back(data);
+			bounds = AABB(bounds, data.bounding_box);
+			animated_faces.push_back(std::make_pair(static_cast<int>(m), static_cast<int>(f)));
+		}
+		mesh_pivots[m] = Vec3(bounds.x.min + bounds.x.max, bounds.y.min + bounds.y.max,
+			bounds.z.min + bounds.z.max) * 0.5;
+	}
+	std::vector<SphereData> rest_spheres;
+	for (const Sphere* sphere : loaded_scene.sphere_objects)
+		rest_spheres.push_back(sphere->getData());
+
+	const RenderManager& render_manager = loaded_scene.render_manager;
+	const std::string output_dir = "./output";
+	if (!render_manager.createOutputDirectory(output_dir))
+		return false;
+
+	const int num_threads = workerThreadCount(loaded_scene.renderer_info,
+		static_cast<int>((animated_faces.size() + POSE_BATCH_SIZE - 1) / POSE_BATCH_SIZE));
+	bool all_saved = true;
+	for (size_t f = 0; f < frames.size(); f++)
+	{
+		const Frame_& frame = frames[f];
+		auto start = std::chrono::steady_clock::now();
+
+		std::vector<Pose> mesh_poses(rest_meshes.size());
+		for (size_t m = 0; m < rest_meshes.size(); m++)
+			mesh_poses[m] = makePose(ObjectTransform_{}, mesh_pivots[m]);
+		for (const ObjectTransform_& transform : frame.meshes)
+		{
+			int m = findById(raw_scene.meshes, transform.id);
+			mesh_poses[m] = makePose(transform, mesh_pivots[m]);
+		}
+
+		std::atomic<size_t> next_batch(0);
+		std::vector<std::thread> threads;
+		for (int thread_id = 0; thread_id < num_threads; thread_id++)
+		{
+			threads.emplace_back([&]() {
+				for (size_t begin = next_batch++ * POSE_BATCH_SIZE; begin < animated_faces.size();
+					begin = next_batch++ * POSE_BATCH_SIZE)
+				{
+					size_t end = std::min(begin + POSE_BATCH_SIZE, animated_faces.size());
+					for (size_t k = begin; k < end; k++)
+					{
+						const int m = animated_faces[k].first;
+						const int face = animated_faces[k].second;
+						const TriangleData& rest = rest_meshes[m][face];
+						const Pose& pose = mesh_poses[m];
+						Vec3 corners[3];
+						Vec3 normals[3];
+						for (int i = 0; i < 3; i++)
+						{
+							corners[i] = pose.point(rest.indices[i]);
+							normals[i] = rest.smooth_shading ? pose.normal(rest.per_vertex_normals[i]) : Vec3();
+						}
+						loaded_scene.mesh_objects[m][face]->setVertices(corners, normals);
+					}
+				}
+			});
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+
+		// A sphere stays a sphere under the largest of its scaling factors.
+		for (size_t s = 0; s < rest_spheres.size(); s++)
+		{
+			if (!sphere_animated[s]) continue;
+			SphereData data = rest_spheres[s];
+			for (const ObjectTransform_& transform : frame.spheres)
+			{
+				if (findById(raw_scene.spheres, transform.id) != static_cast<int>(s)) continue;
+				Pose pose = makePose(transform, data.center);
+				data.center = pose.point(data.center);
+				data.radius *= std::max({ std::abs(pose.scaling.x), std::abs(pose.scaling.y), std::abs(pose.scaling.z) });
+			}
+			loaded_scene.sphere_objects[s]->setData(data);
+		}
+
+		bool rebuilt = loaded_scene.refitWorld();
+		std::chrono::duration<double> update_time = std::chrono::steady_clock::now() - start;
+		std::cout << "Frame " << f << ": posed and " << (rebuilt ? "rebuilt" : "refitted")
+			<< " the BVH in " << update_time.count() << " s (traversal cost "
+			<< loaded_scene.scene.world.traversalCost() / loaded_scene.bvh_built_cost << "x the built tree's)" << std::endl;
+
+		for (const Camera& scene_camera : loaded_scene.scene.cameras)
+		{
+			Camera cam = scene_camera;
+			cam.image_name = frameImageName(scene_camera.image_name, f);
+			all_saved = render_manager.renderCamera(cam, output_dir) && all_saved;
+		}
+	}
+
+	RenderStats::printSummary(std::cout);
+	return all_saved;
+}
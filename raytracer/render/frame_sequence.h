@@ -0,0 +1,16 @@
+#ifndef FRAME_SEQUENCE_H
+#define FRAME_SEQUENCE_H
+
+#include <string>
+#include "../scene/loaded_scene.h"
+
+// Renders an animation of a loaded scene (see parseFrameSequence). For
+// every frame the listed meshes and spheres are posed from their scene file
+// geometry, the BVH is refitted around them, or rebuilt once refits have
+// degraded it (see LoadedScene::refitWorld), and every camera writes
+// <image>_<frame>.png into ./output. Topology never changes between
+// frames. Needs the scene built in this process; returns false if the
+// animation cannot be read or names objects the scene does not have.
+bool renderFrameSequence(LoadedScene& loaded_scene, const std::string& frames_path);
+
+#endif // FRAME_SEQUENCE_H
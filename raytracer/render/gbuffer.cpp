@@ -0,0 +1,77 @@
+#include "gbuffer.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+// Files hold the raw structs; they are a cache for this build on this host,
+// not an exchange format.
+constexpr char GBUFFER_MAGIC[8] = "RTGBUF";
+constexpr uint32_t GBUFFER_VERSION = 1;
+
+typedef struct GBufferFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t sample_size;
+	GBufferKey key;
+	uint64_t sample_count;
+}GBufferFileHeader;
+
+bool GBufferKey::operator==(const GBufferKey& other) const
+{
+	return std::memcmp(view, other.view, sizeof(view)) == 0
+		&& width == other.width && height == other.height && geometry == other.geometry;
+}
+
+bool saveGBuffer(const std::string& path, const GBuffer& gbuffer)
+{
+	GBufferFileHeader header{};
+	std::memcpy(header.magic, GBUFFER_MAGIC, sizeof(header.magic));
+	header.version = GBUFFER_VERSION;
+	header.sample_size = sizeof(GBufferSample);
+	header.key = gbuffer.key;
+	header.sample_count = gbuffer.samples.size();
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file
+		|| !file.write(reinterpret_cast<const char*>(&header), sizeof(header))
+		|| !file.write(reinterpret_cast<const char*>(gbuffer.samples.data()),
+			gbuffer.samples.size() * sizeof(GBufferSample)))
+	{
+		std::cerr << "Error: Could not write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool loadGBuffer(const std::string& path, const GBufferKey& key, GBuffer& gbuffer)
+{
+	if (!std::filesystem::exists(path))
+		return false;
+	std::ifstream file(path, std::ios::binary);
+	GBufferFileHeader header;
+	if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| std::memcmp(header.magic, GBUFFER_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != GBUFFER_VERSION || header.sample_size != sizeof(GBufferSample))
+	{
+		std::cerr << path << " is not a G-buffer of this build" << std::endl;
+		return false;
+	}
+	if (!(header.key == key)
+		|| header.sample_count != static_cast<uint64_t>(key.width) * key.height)
+	{
+		std::cout << path << " was stored for another view or scene" << std::endl;
+		return false;
+	}
+
+	std::vector<GBufferSample> samples(header.sample_count);
+	if (!file.read(reinterpret_cast<char*>(samples.data()), samples.size() * sizeof(GBufferSample)))
+	{
+		std::cerr << path << " is truncated" << std::endl;
+		return false;
+	}
+	gbuffer.key = header.key;
+	gbuffer.samples = std::move(samples);
+	return true;
+}
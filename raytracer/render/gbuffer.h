@@ -0,0 +1,55 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../include/vec3.h"
+#include "../include/aabb.h"
+
+// What a camera's primary hits depend on: its view and resolution, and a
+// fingerprint of the scene geometry (see LoadedScene::geometry_key).
+// Lights and material parameters are not part of it, so a G-buffer stays
+// valid while only those change.
+typedef struct GBufferKey {
+	double view[12] = {}; // eye, top-left corner of the image plane, pixel steps along u and v
+	int32_t width = 0;
+	int32_t height = 0;
+	uint64_t geometry = 0;
+
+	bool operator==(const GBufferKey& other) const;
+}GBufferKey;
+
+// The primary hit of one pixel center, as shading needs it.
+typedef struct GBufferSample {
+	Vec3 point;
+	Vec3 normal;
+	double t = 0.0;
+	int32_t material_id = 0;
+	uint8_t hit = 0;
+	uint8_t front_face = 0;
+}GBufferSample;
+
+// Primary hits of one camera, row by row. Images shaded from it match a
+// full render exactly; only secondary and shadow rays are traced again.
+typedef struct GBuffer {
+	GBufferKey key;
+	std::vector<GBufferSample> samples;
+}GBuffer;
+
+// What an edit to a loaded scene changed, for working out which stored
+// pixels it can affect.
+typedef struct SceneChange {
+	std::vector<AABB> boxes; // old and new bounds of every primitive that moved or changed material
+	std::vector<int> materials; // ids of materials whose parameters changed
+	bool lights = false; // a point light or the ambient light changed or was added
+
+	bool empty() const { return boxes.empty() && materials.empty() && !lights; }
+}SceneChange;
+
+// Both print the reason and return false on failure. loadGBuffer is quiet
+// when path does not exist, and refuses a file written for another key.
+bool saveGBuffer(const std::string& path, const GBuffer& gbuffer);
+bool loadGBuffer(const std::string& path, const GBufferKey& key, GBuffer& gbuffer);
+
+#endif // GBUFFER_H
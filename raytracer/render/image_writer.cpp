@@ -0,0 +1,56 @@
+#include "image_writer.h"
+#include "render_manager.h"
+
+ImageWriter::ImageWriter(const RenderManager& render_manager, size_t capacity)
+  : render_manager(render_manager),
+  capacity(std::max<size_t>(1, capacity)),
+  worker(&ImageWriter::run, this)
+{
+}
+
+ImageWriter::~ImageWriter()
+{
+  finish();
+}
+
+void ImageWriter::submit(const std::string& outputDir, const std::string& fileName,
+  std::vector<std::vector<Color>> image)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  queue_changed.wait(lock, [this]() { return queue.size() < capacity; });
+  queue.push_back(WriteJob{ outputDir, fileName, std::move(image) });
+  queue_changed.notify_all();
+}
+
+bool ImageWriter::finish()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  queue_changed.notify_all();
+  if (worker.joinable())
+    worker.join();
+  return all_written;
+}
+
+void ImageWriter::run()
+{
+  TraceRecorder::setThreadName("image writer");
+  while (true)
+  {
+    WriteJob job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      queue_changed.wait(lock, [this]() { return !queue.empty() || stopping; });
+      if (queue.empty()) return;
+      job = std::move(queue.front());
+      queue.pop_front();
+    }
+    queue_changed.notify_all();
+
+    bool written = render_manager.saveImage(job.output_dir, job.file_name, job.image);
+    std::lock_guard<std::mutex> lock(mutex);
+    all_written = all_written && written;
+  }
+}
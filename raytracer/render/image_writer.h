@@ -0,0 +1,51 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/color.h"
+
+class RenderManager;
+
+// Background I/O thread that PNG encodes and writes finished images, so the
+// next camera renders while the previous one is being saved. The queue is
+// bounded: submit blocks while `capacity` images are already waiting, which
+// caps the memory held by frames in flight.
+class ImageWriter {
+public:
+  ImageWriter(const RenderManager& render_manager, size_t capacity = 2);
+  ~ImageWriter();
+  ImageWriter(const ImageWriter&) = delete;
+  ImageWriter& operator=(const ImageWriter&) = delete;
+
+  void submit(const std::string& outputDir, const std::string& fileName,
+    std::vector<std::vector<Color>> image);
+
+  // Waits until every submitted image is written and stops the thread.
+  // Returns false if any write failed.
+  bool finish();
+
+private:
+  typedef struct WriteJob {
+    std::string output_dir;
+    std::string file_name;
+    std::vector<std::vector<Color>> image;
+  }WriteJob;
+
+  void run();
+
+  const RenderManager& render_manager;
+  const size_t capacity;
+  std::mutex mutex;
+  std::condition_variable queue_changed;
+  std::deque<WriteJob> queue;
+  bool stopping = false;
+  bool all_written = true;
+  std::thread worker;
+};
+
+#endif // IMAGE_WRITER_H
@@ -1,21 +1,30 @@
 #include "render_manager.h"
+#include "image_writer.h"
+#include "wavefront_integrator.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "../io/stb_image_write.h"
+#include "../include/false_color.h"
+#include "../io/hdr_writer.h"
 
 #include <iostream>
 #include <filesystem>
 #include <cmath>
+#include <cstdio>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 
 RenderManager::RenderManager(const Scene& _scene,
   const MaterialManager& _material_manager,
   const RendererInfo _renderer_info,
-  const BaseRayTracer& _rendering_technique)
+  const BaseRayTracer& _rendering_technique,
+  const uint64_t& _geometry_key)
   : scene(_scene),
   material_manager(_material_manager),
   renderer_info(_renderer_info),
-  technique(_rendering_technique)
+  technique(_rendering_technique),
+  geometry_key(_geometry_key)
 {
 }
 
@@ -24,48 +33,198 @@ void RenderManager::render() const
 {
 	const std::filesystem::path saveDir = "./output";
 
+	if (!createOutputDirectory(saveDir))
+		return;
+
+	// Camera N is encoded and written while camera N + 1 renders.
+	ImageWriter writer(*this);
+	if (progressive())
+	{
+		for(const auto& cam : scene.cameras)
+		{
+			std::vector<std::vector<Color>> image;
+			renderImage(cam, saveDir.string(), image);
+			writer.submit(saveDir.string(), cam.image_name, std::move(image));
+		}
+	}
+	else if (!renderer_info.gbuffer_dir.empty() && usesGBuffer())
+	{
+		renderWithGBufferFiles(saveDir.string(), writer);
+	}
+	else
+	{
+		renderAllCameras(saveDir.string(), writer);
+	}
+	for(const auto& cam : scene.cameras)
+	{
+		writeTraversalCost(cam, saveDir.string());
+	}
+	writer.finish();
+
+	RenderStats::printSummary(std::cout);
+}
+
+bool RenderManager::renderCamera(const Camera& cam, const std::string& outputDir,
+	GBuffer* gbuffer) const
+{
+	std::vector<std::vector<Color>> image;
+	renderImage(cam, outputDir, image, gbuffer);
+	bool saved = saveImage(outputDir, cam.image_name, image);
+	return writeTraversalCost(cam, outputDir) && saved;
+}
+
+// The tiles of every camera form one pool, in camera order, so workers
+// move on to the next camera while the last tiles of the previous one are
+// still rendering, and small cameras do not leave threads idle. Whichever
+// worker finishes a camera's last tile hands the image to the writer.
+void RenderManager::renderAllCameras(const std::string& outputDir, ImageWriter& writer) const
+{
+	ScopedStageTimer timer(Stage::Render);
+	const size_t camera_count = scene.cameras.size();
+	std::vector<std::vector<std::vector<Color>>> images(camera_count);
+	std::vector<int> first_tile(camera_count + 1, 0);
+	std::vector<std::atomic<int>> tiles_left(camera_count);
+	for (size_t c = 0; c < camera_count; c++)
+	{
+		const Camera& cam = scene.cameras[c];
+		cam.prepareImage(images[c]);
+		int tile_count = cam.tileCount(renderer_info);
+		first_tile[c + 1] = first_tile[c] + tile_count;
+		tiles_left[c] = tile_count;
+	}
+	const int total_tiles = first_tile[camera_count];
+
+	std::atomic<int> next_tile(0);
+	std::vector<std::thread> threads;
+	const int num_threads = workerThreadCount(renderer_info, total_tiles);
+	for (int thread_id = 0; thread_id < num_threads; thread_id++)
+	{
+		threads.emplace_back([&, thread_id]() {
+			TraceRecorder::setThreadName("render worker " + std::to_string(thread_id));
+			WavefrontIntegrator integrator(technique);
+			for (int tile = next_tile++; tile < total_tiles; tile = next_tile++)
+			{
+				size_t c = std::upper_bound(first_tile.begin(), first_tile.end(), tile) - first_tile.begin() - 1;
+				const Camera& cam = scene.cameras[c];
+				cam.renderTileAt(technique, integrator, tile - first_tile[c], images[c]);
+				if (--tiles_left[c] == 0)
+					writer.submit(outputDir, cam.image_name, std::move(images[c]));
+			}
+			RenderStats::flushThread();
+		});
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+void RenderManager::renderWithGBufferFiles(const std::string& outputDir, ImageWriter& writer) const
+{
+	if (!createOutputDirectory(renderer_info.gbuffer_dir))
+		return;
+	for (const auto& cam : scene.cameras)
+	{
+		std::string gbuffer_path = (std::filesystem::path(renderer_info.gbuffer_dir)
+			/ (std::filesystem::path(cam.image_name).stem().string() + ".gbuf")).string();
+		GBuffer gbuffer;
+		bool stored = loadGBuffer(gbuffer_path, gbufferKey(cam), gbuffer);
+		if (stored)
+			std::cout << "Shading stored primary hits from " << gbuffer_path << std::endl;
+
+		std::vector<std::vector<Color>> image;
+		renderImage(cam, outputDir, image, &gbuffer);
+		if (!stored && saveGBuffer(gbuffer_path, gbuffer))
+			std::cout << "Stored primary hits in " << gbuffer_path << std::endl;
+		writer.submit(outputDir, cam.image_name, std::move(image));
+	}
+}
+
+bool RenderManager::usesGBuffer() const
+{
+	return !progressive() && renderer_info.aa_min_samples <= 1 && renderer_info.aa_max_samples <= 1;
+}
+
+GBufferKey RenderManager::gbufferKey(const Camera& cam) const
+{
+	return cam.gbufferKey(geometry_key);
+}
+
+int RenderManager::updateImage(const Camera& cam, const SceneChange& change, GBuffer& gbuffer,
+	std::vector<std::vector<Color>>& image) const
+{
+	std::vector<uint8_t> dirty;
+	cam.dirtyTiles(technique, gbuffer, change, dirty);
+	cam.rerenderTiles(technique, dirty, !change.boxes.empty(), gbuffer, image);
+	gbuffer.key = gbufferKey(cam);
+	return static_cast<int>(std::count(dirty.begin(), dirty.end(), 1));
+}
+
+bool RenderManager::progressive() const
+{
+	return renderer_info.progressive_seconds > 0.0 || renderer_info.progressive_noise > 0.0;
+}
+
+void RenderManager::renderImage(const Camera& cam, const std::string& outputDir,
+	std::vector<std::vector<Color>>& image, GBuffer* gbuffer) const
+{
+	if (gbuffer && usesGBuffer())
+	{
+		GBufferKey key = gbufferKey(cam);
+		if (!(gbuffer->key == key))
+		{
+			cam.fillGBuffer(technique, *gbuffer);
+			gbuffer->key = key;
+		}
+		cam.renderFromGBuffer(technique, *gbuffer, image);
+	}
+	else if (progressive())
+	{
+		cam.renderProgressive(technique, image,
+			[this, &outputDir, &cam](const std::vector<std::vector<Color>>& current) {
+				saveImage(outputDir, cam.image_name, current);
+			});
+	}
+	else
+	{
+		cam.render(technique, image);
+	}
+}
+
+bool RenderManager::writeTraversalCost(const Camera& cam, const std::string& outputDir) const
+{
+	if (!renderer_info.traversal_heatmap)
+		return true;
+	std::vector<std::vector<int>> cost;
+	cam.renderTraversalCost(technique, cost);
+	std::string cost_name = std::filesystem::path(cam.image_name).stem().string() + "_cost.png";
+	return saveTraversalCost(outputDir, cost_name, cost);
+}
+
+bool RenderManager::createOutputDirectory(const std::filesystem::path& saveDir) const
+{
 	if (!std::filesystem::exists(saveDir))
 	{
 		std::cout << "Output folder not exists, creating one" << saveDir.string() << std::endl;
 		try
 		{
-			std::filesystem::create_directory(saveDir);
+			std::filesystem::create_directories(saveDir);
 		}
 		catch (const std::filesystem::filesystem_error& e)
 		{
 			std::cerr << "couldnt create file" << e.what() << std::endl;
-			return;
+			return false;
 		}
 	}
-	for(const auto& cam : scene.cameras)
-	{
-		std::vector<std::vector<Color>> image;
-		cam.render(technique, image);
-		// Here you would typically save the image to a file
-		
-		saveImage(saveDir.string(), cam.image_name, image);
-	}
+	return true;
 }
 
-void RenderManager::saveImage(const std::string& outputDir,
-                            const std::string& fileName,
-                           std::vector<std::vector<Color>>& image) const
+std::vector<unsigned char> RenderManager::quantizeImage(const std::vector<std::vector<Color>>& image)
 {
-  if (image.empty() || image[0].empty())
-  {
-    std::cerr << "Error: Image buffer is empty or has zero width/height." 
-      << std::endl;
-    return;
-  }
-
   int height = image.size();
-  int width = image[0].size();
+  int width = height > 0 ? image[0].size() : 0;
   int channels = 3; // RGB
 
-  std::filesystem::path outputPath = 
-    std::filesystem::path(outputDir) / fileName;
-  std::string fullPath = outputPath.string();
-
   std::vector<unsigned char> data(width * height * channels);
 
   for (int y = 0; y < height; ++y)
@@ -94,9 +253,59 @@ void RenderManager::saveImage(const std::string& outputDir,
       data[index + 2] = b;
     }
   }
+  return data;
+}
 
-  int success = stbi_write_png(fullPath.c_str(), 
-    width, height, channels, data.data(), width * channels);
+bool RenderManager::saveImage(const std::string& outputDir,
+                            const std::string& fileName,
+                           const std::vector<std::vector<Color>>& image) const
+{
+  if (image.empty() || image[0].empty())
+  {
+    std::cerr << "Error: Image buffer is empty or has zero width/height." 
+      << std::endl;
+    return false;
+  }
+
+  int height = image.size();
+  int width = image[0].size();
+  int channels = 3; // RGB
+
+  std::filesystem::path outputPath = 
+    std::filesystem::path(outputDir) / fileName;
+  if (renderer_info.image_format == ImageFormat::Pfm)
+    outputPath.replace_extension(".pfm");
+  else if (renderer_info.image_format == ImageFormat::Exr)
+    outputPath.replace_extension(".exr");
+  std::string fullPath = outputPath.string();
+
+  ScopedStageTimer timer(Stage::Encode);
+  // The image is written next to its final name and renamed over it, so
+  // the file is never seen half written, e.g. when a progressive render is
+  // stopped during a checkpoint.
+  const std::string tempPath = fullPath + ".tmp";
+  // Float formats take the framebuffer as is, with 255 mapped to 1.0; a
+  // .pfm or .exr image name picks them without the option.
+  const std::string extension = outputPath.extension().string();
+  int success;
+  if (extension == ".pfm")
+  {
+    success = writePfm(tempPath, image, 255.0);
+  }
+  else if (extension == ".exr")
+  {
+    success = writeExr(tempPath, image, 255.0);
+  }
+  else
+  {
+    std::vector<unsigned char> data = quantizeImage(image);
+    success = stbi_write_png(tempPath.c_str(),
+      width, height, channels, data.data(), width * channels);
+  }
+  if (success && std::rename(tempPath.c_str(), fullPath.c_str()) != 0)
+    success = 0;
+  if (!success)
+    std::remove(tempPath.c_str());
 
   if (success)
   {
@@ -106,4 +315,47 @@ void RenderManager::saveImage(const std::string& outputDir,
   {
     std::cerr << "Error: Could not save image: " << fullPath << std::endl;
   }
+  return success;
+}
+
+bool RenderManager::saveTraversalCost(const std::string& outputDir,
+  const std::string& fileName,
+  const std::vector<std::vector<int>>& cost) const
+{
+  if (cost.empty() || cost[0].empty())
+    return false;
+
+  int height = cost.size();
+  int width = cost[0].size();
+  int max_cost = 0;
+  long long total_cost = 0;
+  for (const auto& row : cost)
+  {
+    for (int c : row)
+    {
+      max_cost = std::max(max_cost, c);
+      total_cost += c;
+    }
+  }
+
+  std::vector<unsigned char> data(width * height * 3);
+  for (int y = 0; y < height; ++y)
+  {
+    for (int x = 0; x < width; ++x)
+    {
+      double t = max_cost > 0 ? static_cast<double>(cost[y][x]) / max_cost : 0.0;
+      falseColor(t, &data[(y * width + x) * 3]);
+    }
+  }
+
+  std::string fullPath = (std::filesystem::path(outputDir) / fileName).string();
+  if (!stbi_write_png(fullPath.c_str(), width, height, 3, data.data(), width * 3))
+  {
+    std::cerr << "Error: Could not save image: " << fullPath << std::endl;
+    return false;
+  }
+  std::cout << "Saved traversal cost heatmap: " << fullPath << " (max " << max_cost
+    << ", mean " << static_cast<double>(total_cost) / (width * height)
+    << " node and primitive tests per primary ray)" << std::endl;
+  return true;
 }
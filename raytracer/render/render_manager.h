@@ -1,27 +1,82 @@
 #ifndef RENDER_MANAGER_H
 #define RENDER_MANAGER_H
 
+#include <filesystem>
 #include "../include/color.h"
 #include "../scene/scene.h"
 #include "base_ray_tracer.h"
+#include "gbuffer.h"
 #include "../material/material_manager.h"
 
+class ImageWriter;
+
 class RenderManager {
 public:
   RenderManager(const Scene& _scene,
     const MaterialManager& _material_manager,
     const RendererInfo _renderer_info,
-    const BaseRayTracer& _rendering_technique);
+    const BaseRayTracer& _rendering_technique,
+    const uint64_t& _geometry_key);
     void render() const;
 
+  // Renders one camera and writes its image into outputDir. When a gbuffer
+  // is given and usesGBuffer(), the image is shaded from its primary hits,
+  // which are traced into it first unless it already holds this camera's.
+  bool renderCamera(const Camera& cam, const std::string& outputDir,
+    GBuffer* gbuffer = nullptr) const;
+
+  // Whether the options allow shading from stored primary hits: one ray
+  // through each pixel center and no progressive refinement.
+  bool usesGBuffer() const;
+
+  GBufferKey gbufferKey(const Camera& cam) const;
+
+  // Renders cam, progressively when requested or from gbuffer as in
+  // renderCamera; intermediate progressive images are written to
+  // outputDir.
+  void renderImage(const Camera& cam, const std::string& outputDir,
+    std::vector<std::vector<Color>>& image, GBuffer* gbuffer = nullptr) const;
+
+  // Brings image and gbuffer, both rendered before change was applied to
+  // the scene, up to date by re-rendering only the tiles change can
+  // affect. Returns how many tiles that was.
+  int updateImage(const Camera& cam, const SceneChange& change, GBuffer& gbuffer,
+    std::vector<std::vector<Color>>& image) const;
+
+  // Writes <image>_cost.png when the traversal heatmap is on.
+  bool writeTraversalCost(const Camera& cam, const std::string& outputDir) const;
+
+  bool createOutputDirectory(const std::filesystem::path& saveDir) const;
+
+  // Writes the image as PNG, or as float PFM/EXR when the image format
+  // option or fileName's extension asks for it.
+  bool saveImage(const std::string& outputDir, const std::string& fileName,
+    const std::vector<std::vector<Color>>& image) const;
+
+  // Writes a traversal cost image as a false-color PNG scaled to its
+  // largest cost.
+  bool saveTraversalCost(const std::string& outputDir, const std::string& fileName,
+    const std::vector<std::vector<int>>& cost) const;
+
+  // Clamps and rounds the image to the 8-bit RGB rows written to PNG.
+  static std::vector<unsigned char> quantizeImage(const std::vector<std::vector<Color>>& image);
+
 private:
-  void saveImage(const std::string& outputDir, const std::string& fileName, std::vector<std::vector<Color>>& image)
-    const;
+  bool progressive() const;
+
+  // Renders every camera from one shared pool of tiles, submitting each
+  // image to writer as soon as its last tile is done.
+  void renderAllCameras(const std::string& outputDir, ImageWriter& writer) const;
+
+  // Renders camera by camera, shading from <gbuffer_dir>/<image>.gbuf when
+  // it matches the camera and storing it when it does not.
+  void renderWithGBufferFiles(const std::string& outputDir, ImageWriter& writer) const;
 
   const Scene& scene;
   const MaterialManager& material_manager;
   const RendererInfo renderer_info;
 	const BaseRayTracer& technique;
+  const uint64_t& geometry_key; // changes as the scene is edited
   
 };
 
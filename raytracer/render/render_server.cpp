@@ -0,0 +1,231 @@
+#include "render_server.h"
+
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static std::string escapeJson(const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\') escaped += '\\';
+		if (c == '\n') { escaped += "\\n"; continue; }
+		escaped += c;
+	}
+	return escaped;
+}
+
+static std::string errorResponse(const std::string& message)
+{
+	return "{\"status\": \"error\", \"message\": \"" + escapeJson(message) + "\"}";
+}
+
+// MSG_NOSIGNAL: a client that hung up ends its connection, not the server.
+static bool writeAll(int fd, const std::string& data)
+{
+	size_t written = 0;
+	while (written < data.size())
+	{
+		ssize_t n = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		written += n;
+	}
+	return true;
+}
+
+RenderServer::RenderServer(LoadedScene& loaded_scene)
+	: loaded_scene(loaded_scene)
+{
+}
+
+void RenderServer::serveStream(std::istream& in, std::ostream& out)
+{
+	std::string line;
+	bool shutdown = false;
+	while (!shutdown && std::getline(in, line))
+	{
+		if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+		out << handleJob(line, shutdown) << std::endl;
+	}
+}
+
+bool RenderServer::serveSocket(const std::string& socket_path)
+{
+	sockaddr_un address{};
+	if (socket_path.size() >= sizeof(address.sun_path))
+	{
+		std::cerr << "Socket path too long: " << socket_path << std::endl;
+		return false;
+	}
+	address.sun_family = AF_UNIX;
+	std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+	int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server_fd < 0)
+	{
+		std::cerr << "Could not create socket: " << std::strerror(errno) << std::endl;
+		return false;
+	}
+	unlink(socket_path.c_str());
+	if (bind(server_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+		|| listen(server_fd, 16) < 0)
+	{
+		std::cerr << "Could not listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+		close(server_fd);
+		return false;
+	}
+	std::cout << "Render server listening on " << socket_path << std::endl;
+
+	bool shutdown = false;
+	while (!shutdown)
+	{
+		int client_fd = accept(server_fd, nullptr, nullptr);
+		if (client_fd < 0)
+		{
+			if (errno == EINTR) continue;
+			std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+			break;
+		}
+
+		std::string pending;
+		char buffer[4096];
+		bool connected = true;
+		while (connected && !shutdown)
+		{
+			ssize_t n = read(client_fd, buffer, sizeof(buffer));
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) break;
+			pending.append(buffer, n);
+
+			size_t newline;
+			while (!shutdown && (newline = pending.find('\n')) != std::string::npos)
+			{
+				std::string line = pending.substr(0, newline);
+				pending.erase(0, newline + 1);
+				if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+				connected = writeAll(client_fd, handleJob(line, shutdown) + "\n");
+			}
+		}
+		close(client_fd);
+	}
+
+	close(server_fd);
+	unlink(socket_path.c_str());
+	return true;
+}
+
+std::string RenderServer::handleJob(const std::string& line, bool& shutdown)
+{
+	try
+	{
+		return runJob(line, shutdown);
+	}
+	catch (const std::exception& e)
+	{
+		views.clear();
+		return errorResponse(std::string("job failed: ") + e.what());
+	}
+}
+
+std::string RenderServer::runJob(const std::string& line, bool& shutdown)
+{
+	RenderJob_ job;
+	std::string error;
+	if (!parseRenderJob(line, loaded_scene.raw_scene, job, error))
+		return errorResponse(error);
+	if (job.shutdown)
+	{
+		shutdown = true;
+		return "{\"status\": \"ok\", \"message\": \"shutting down\"}";
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	const int revision_before = revision;
+	const uint64_t geometry_before = loaded_scene.geometry_key;
+	SceneChange change;
+	if (!loaded_scene.applyChanges(job, change, error))
+		return errorResponse(error);
+	if (!change.empty())
+		revision++;
+
+	const std::filesystem::path output_path(job.output_path);
+	const std::filesystem::path output_dir = output_path.has_parent_path()
+		? output_path.parent_path() : std::filesystem::path(".");
+	Camera camera(job.camera);
+	camera.image_name = output_path.filename().string();
+
+	const RenderManager& render_manager = loaded_scene.render_manager;
+	if (!render_manager.createOutputDirectory(output_dir))
+		return errorResponse("could not create " + output_dir.string());
+
+	std::ostringstream cache_fields;
+	CachedView* view = cachedView(camera);
+	if (view)
+	{
+		// The cached image is current up to this job's edits only if nothing
+		// else changed the scene since it was rendered.
+		if (view->revision == revision_before && view->gbuffer.key == camera.gbufferKey(geometry_before))
+		{
+			int tiles = render_manager.updateImage(camera, change, view->gbuffer, view->image);
+			cache_fields << ", \"gbuffer\": \"updated\", \"tiles\": " << tiles;
+		}
+		else
+		{
+			bool reused = view->gbuffer.key == render_manager.gbufferKey(camera);
+			render_manager.renderImage(camera, output_dir.string(), view->image, &view->gbuffer);
+			cache_fields << ", \"gbuffer\": \"" << (reused ? "reused" : "filled") << "\"";
+		}
+		view->revision = revision;
+		bool saved = render_manager.saveImage(output_dir.string(), camera.image_name, view->image);
+		if (!render_manager.writeTraversalCost(camera, output_dir.string()) || !saved)
+			return errorResponse("could not write " + job.output_path);
+	}
+	else if (!render_manager.renderCamera(camera, output_dir.string()))
+	{
+		return errorResponse("could not write " + job.output_path);
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::ostringstream response;
+	response << "{\"status\": \"ok\", \"output\": \"" << escapeJson(job.output_path)
+		<< "\", \"seconds\": " << elapsed.count() << cache_fields.str() << "}";
+	return response.str();
+}
+
+RenderServer::CachedView* RenderServer::cachedView(const Camera& camera)
+{
+	const RenderManager& render_manager = loaded_scene.render_manager;
+	const int capacity = loaded_scene.renderer_info.gbuffer_cache;
+	if (capacity <= 0 || !render_manager.usesGBuffer())
+		return nullptr;
+
+	const GBufferKey key = render_manager.gbufferKey(camera);
+	for (auto it = views.begin(); it != views.end(); ++it)
+	{
+		GBufferKey view_key = it->gbuffer.key;
+		view_key.geometry = key.geometry;
+		if (view_key == key)
+		{
+			views.splice(views.end(), views, it);
+			return &views.back();
+		}
+	}
+	if (static_cast<int>(views.size()) >= capacity)
+	{
+		views.splice(views.end(), views, views.begin());
+		views.back() = CachedView();
+	}
+	else
+	{
+		views.emplace_back();
+	}
+	return &views.back();
+}
@@ -0,0 +1,59 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <iostream>
+#include <list>
+#include <string>
+#include "../scene/loaded_scene.h"
+
+// Long-running mode that keeps one loaded scene, BVH included, resident and
+// renders a stream of jobs against it. Jobs are JSON lines (see
+// parseRenderJob) read from stdin or from clients of a Unix socket; every
+// job is answered with one JSON line:
+//   {"status": "ok", "output": "out/a.png", "seconds": 0.42}
+//   {"status": "error", "message": "..."}
+// With a G-buffer cache the primary hits and images of recent views are
+// kept. A job that edits the scene then re-renders only the tiles of its
+// view the edit can affect, and one that only changes lights or materials
+// skips primary rays. Such responses also carry "gbuffer": "filled",
+// "reused" (hits reused, every pixel shaded) or "updated" with the number
+// of "tiles" re-rendered.
+class RenderServer {
+public:
+	RenderServer(LoadedScene& loaded_scene);
+
+	// Serves jobs from in until end of input or a shutdown command.
+	void serveStream(std::istream& in, std::ostream& out);
+
+	// Listens on a Unix socket at socket_path and serves its clients one
+	// after another until a shutdown command. Returns false if the socket
+	// cannot be set up.
+	bool serveSocket(const std::string& socket_path);
+
+private:
+	// Runs one job line and returns the response line. Sets shutdown when
+	// the line asks the server to stop. A job that throws is answered with
+	// an error, and the cached views, which it may have left half updated,
+	// are dropped; the scene stays loaded for the next job.
+	std::string handleJob(const std::string& line, bool& shutdown);
+	std::string runJob(const std::string& line, bool& shutdown);
+
+	// A view rendered with the G-buffer cache on.
+	typedef struct CachedView {
+		GBuffer gbuffer;
+		std::vector<std::vector<Color>> image;
+		int revision = -1; // scene revision image was rendered at
+	}CachedView;
+
+	// The cached view camera looks through, whatever the geometry it was
+	// rendered with; the least recently used one is recycled when the cache
+	// is full. Null when caching is off or cannot apply to the render
+	// options.
+	CachedView* cachedView(const Camera& camera);
+
+	LoadedScene& loaded_scene;
+	std::list<CachedView> views; // most recently used last
+	int revision = 0; // counts jobs that edited the scene
+};
+
+#endif // RENDER_SERVER_H
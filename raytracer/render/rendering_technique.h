@@ -7,11 +7,50 @@
 #include "../material/material_manager.h"
 #include "../include/bvh.h"
 
+enum class Integrator {
+	Recursive, // depth-first, one pixel at a time (computeColor)
+	Wavefront  // breadth-first over a tile (WavefrontIntegrator)
+};
+
+enum class ImageFormat {
+	Png, // 8-bit, clamped
+	Pfm, // 32-bit float, unclamped
+	Exr  // 32-bit float, unclamped
+};
+
+enum class PixelOrder {
+	Scanline, // row by row
+	Morton,   // Z-order curve
+	Hilbert   // Hilbert curve
+};
+
 typedef struct RendererInfo {
 	float shadow_ray_epsilon;
 	float intersection_test_epsilon;
 	int max_recursion_depth;
 	bool backface_culling;
+	int packet_size = 0; // side of the primary ray packets (4 or 8), 0 traces single rays
+	Integrator integrator = Integrator::Recursive;
+	int thread_count = 0; // render worker threads, 0 uses every hardware thread
+	PixelOrder pixel_order = PixelOrder::Scanline; // order tiles, and pixels or packets within a tile, are traced in
+	double light_cull_threshold = 0.0; // lights below this intensity / distance^2 are skipped, 0 disables culling
+	double light_cull_error_bound = INFINITY; // cap on the summed contribution skipped at one point
+	int aa_min_samples = 1; // stratified samples every pixel starts with, rounded down to a square grid
+	int aa_max_samples = 1; // per-pixel budget for adaptive anti-aliasing, 1 shoots one ray through the center
+	double aa_threshold = 4.0; // noise (standard error, 0-255 luminance) or neighbour contrast that earns more samples
+	double progressive_seconds = 0.0; // progressive rendering time budget per camera, 0 for none
+	double progressive_noise = 0.0; // progressive rendering stops once every pixel's noise is below this, 0 for none
+	int progressive_max_samples = 256; // per-pixel cap for progressive rendering
+	double progressive_write_interval = 5.0; // seconds between intermediate image writes
+	ImageFormat image_format = ImageFormat::Png; // format of camera images; other than PNG replaces the image name's extension
+	bool traversal_heatmap = false; // also write each camera's primary ray traversal cost as <image>_cost.png
+	std::string gbuffer_dir; // keep each camera's primary hits in <dir>/<image>.gbuf and shade from them while they match, empty for none
+	BvhBuilder bvh_builder = BvhBuilder::Median; // how scene.world is built and rebuilt
+	double sbvh_duplication_budget = 0.3; // spatial splits may add this fraction of the primitive count as duplicate references
+	double early_split_budget = 0.0; // large triangles are split into up to this fraction of the primitive count extra pieces before the build, 0 disables
+	bool compressed_bvh = false; // trace an 8-wide BVH with 8-bit quantized child boxes built from scene.world
+	double bvh_rebuild_ratio = 1.5; // a refitted BVH is rebuilt once its traversal cost exceeds this multiple of the built tree's
+	int gbuffer_cache = 0; // server mode: primary hits of this many recent views kept in memory for relighting jobs
 }RendererInfo;
 
 
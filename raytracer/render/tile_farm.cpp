@@ -0,0 +1,390 @@
+#include "tile_farm.h"
+#include "image_writer.h"
+#include "wavefront_integrator.h"
+#include "../include/render_stats.h"
+#include "../include/trace_recorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Tiles per request: enough to hide the round trip, few enough that the
+// last tiles of a frame still spread over every worker.
+constexpr int TILES_PER_RANGE = 4;
+
+// How long a worker keeps trying to reach a coordinator that is not up yet.
+constexpr int CONNECT_ATTEMPTS = 50;
+constexpr int CONNECT_RETRY_MS = 100;
+
+// Messages are raw structs; both ends are this executable on one host.
+// Coordinator to worker: a range of one camera's tiles, camera -1 when
+// there is no work left. Worker to coordinator: per tile a header followed
+// by rows * cols RGB pixels as doubles, row by row.
+typedef struct TileRange {
+	int32_t camera;
+	int32_t first_tile;
+	int32_t tile_count;
+}TileRange;
+
+typedef struct TileHeader {
+	int32_t tile;
+	int32_t row;
+	int32_t col;
+	int32_t rows;
+	int32_t cols;
+}TileHeader;
+
+static bool readAll(int fd, void* data, size_t size)
+{
+	char* bytes = static_cast<char*>(data);
+	while (size > 0)
+	{
+		ssize_t n = read(fd, bytes, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		bytes += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool writeAll(int fd, const void* data, size_t size)
+{
+	const char* bytes = static_cast<const char*>(data);
+	while (size > 0)
+	{
+		ssize_t n = send(fd, bytes, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		bytes += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool socketAddress(const std::string& socket_path, sockaddr_un& address)
+{
+	address = sockaddr_un{};
+	if (socket_path.size() >= sizeof(address.sun_path))
+	{
+		std::cerr << "Socket path too long: " << socket_path << std::endl;
+		return false;
+	}
+	address.sun_family = AF_UNIX;
+	std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+	return true;
+}
+
+static int listenOn(const std::string& socket_path)
+{
+	sockaddr_un address;
+	if (!socketAddress(socket_path, address))
+		return -1;
+	int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server_fd < 0)
+	{
+		std::cerr << "Could not create socket: " << std::strerror(errno) << std::endl;
+		return -1;
+	}
+	unlink(socket_path.c_str());
+	if (bind(server_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+		|| listen(server_fd, 64) < 0)
+	{
+		std::cerr << "Could not listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+		close(server_fd);
+		return -1;
+	}
+	return server_fd;
+}
+
+static int connectTo(const std::string& socket_path)
+{
+	sockaddr_un address;
+	if (!socketAddress(socket_path, address))
+		return -1;
+	for (int attempt = 0; attempt < CONNECT_ATTEMPTS; attempt++)
+	{
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			std::cerr << "Could not create socket: " << std::strerror(errno) << std::endl;
+			return -1;
+		}
+		if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+			return fd;
+		close(fd);
+		std::this_thread::sleep_for(std::chrono::milliseconds(CONNECT_RETRY_MS));
+	}
+	std::cerr << "Could not connect to coordinator at " << socket_path << std::endl;
+	return -1;
+}
+
+static pid_t spawnWorker(const std::vector<std::string>& args)
+{
+	std::vector<char*> argv;
+	for (const std::string& arg : args)
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	argv.push_back(nullptr);
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		execv("/proc/self/exe", argv.data());
+		_exit(127);
+	}
+	if (pid < 0)
+		std::cerr << "Could not start worker: " << std::strerror(errno) << std::endl;
+	return pid;
+}
+
+// Reaps the children that have exited and returns how many are left.
+static size_t reapWorkers(std::vector<pid_t>& children, bool wait)
+{
+	children.erase(std::remove_if(children.begin(), children.end(), [wait](pid_t pid) {
+		return waitpid(pid, nullptr, wait ? 0 : WNOHANG) != 0;
+	}), children.end());
+	return children.size();
+}
+
+bool runTileCoordinator(LoadedScene& loaded_scene, const std::string& socket_path,
+	int spawn_workers, const std::vector<std::string>& worker_args)
+{
+	const std::vector<Camera>& cameras = loaded_scene.scene.cameras;
+	const RendererInfo& renderer_info = loaded_scene.renderer_info;
+	const RenderManager& render_manager = loaded_scene.render_manager;
+	const std::string output_dir = "./output";
+	if (!render_manager.createOutputDirectory(output_dir))
+		return false;
+
+	int server_fd = listenOn(socket_path);
+	if (server_fd < 0)
+		return false;
+	std::cout << "Tile coordinator listening on " << socket_path << std::endl;
+
+	std::vector<pid_t> children;
+	for (int i = 0; i < spawn_workers; i++)
+	{
+		pid_t pid = spawnWorker(worker_args);
+		if (pid > 0) children.push_back(pid);
+	}
+
+	auto acceptWorker = [&]() {
+		pollfd listener{ server_fd, POLLIN, 0 };
+		if (poll(&listener, 1, CONNECT_RETRY_MS) <= 0)
+			return -1;
+		return accept(server_fd, nullptr, nullptr);
+	};
+
+	ImageWriter writer(render_manager);
+	bool finished = true;
+	{
+		ScopedStageTimer timer(Stage::Render);
+		std::vector<std::vector<std::vector<Color>>> images(cameras.size());
+		std::vector<int> tiles_left(cameras.size());
+		std::deque<TileRange> pending;
+		for (size_t c = 0; c < cameras.size(); c++)
+		{
+			cameras[c].prepareImage(images[c]);
+			tiles_left[c] = cameras[c].tileCount(renderer_info);
+			for (int first = 0; first < tiles_left[c]; first += TILES_PER_RANGE)
+			{
+				int count = std::min(TILES_PER_RANGE, tiles_left[c] - first);
+				pending.push_back(TileRange{ static_cast<int32_t>(c), first, count });
+			}
+		}
+
+		// outstanding counts ranges not yet received in full, including the
+		// ones out with a worker.
+		std::mutex mutex;
+		std::condition_variable work_changed;
+		size_t outstanding = pending.size();
+		std::atomic<int> connected(0);
+
+		auto serveWorker = [&](int fd) {
+			std::vector<double> pixels;
+			bool alive = true;
+			while (alive)
+			{
+				TileRange range{ -1, 0, 0 };
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					work_changed.wait(lock, [&]() { return !pending.empty() || outstanding == 0; });
+					if (!pending.empty())
+					{
+						range = pending.front();
+						pending.pop_front();
+					}
+				}
+				alive = writeAll(fd, &range, sizeof(range));
+				if (range.camera < 0)
+					break;
+
+				const Camera& cam = cameras[range.camera];
+				for (int k = 0; alive && k < range.tile_count; k++)
+				{
+					TileHeader header;
+					int row, col, rows, cols;
+					alive = readAll(fd, &header, sizeof(header));
+					if (alive)
+					{
+						cam.tileRect(renderer_info, header.tile, row, col, rows, cols);
+						alive = header.tile >= range.first_tile && header.tile < range.first_tile + range.tile_count
+							&& header.row == row && header.col == col && header.rows == rows && header.cols == cols;
+					}
+					if (!alive) break;
+					pixels.resize(static_cast<size_t>(rows) * cols * 3);
+					alive = readAll(fd, pixels.data(), pixels.size() * sizeof(double));
+					for (int i = 0; alive && i < rows; i++)
+					{
+						for (int j = 0; j < cols; j++)
+						{
+							const double* p = &pixels[(static_cast<size_t>(i) * cols + j) * 3];
+							images[range.camera][row + i][col + j] = Color(p[0], p[1], p[2]);
+						}
+					}
+				}
+
+				// A range counts only once all of it has arrived; a broken one
+				// is rendered again from the start by whoever asks next.
+				bool camera_done = false;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (alive)
+					{
+						outstanding--;
+						tiles_left[range.camera] -= range.tile_count;
+						camera_done = tiles_left[range.camera] == 0;
+					}
+					else
+					{
+						std::cerr << "Lost a tile worker, reassigning its tiles" << std::endl;
+						pending.push_front(range);
+					}
+				}
+				work_changed.notify_all();
+				if (camera_done)
+					writer.submit(output_dir, cam.image_name, std::move(images[range.camera]));
+			}
+			close(fd);
+			connected--;
+		};
+
+		std::vector<std::thread> connections;
+
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (outstanding == 0) break;
+			}
+			if (spawn_workers > 0 && connected == 0 && reapWorkers(children, false) == 0)
+			{
+				std::cerr << "Every tile worker exited before the images were done" << std::endl;
+				finished = false;
+				break;
+			}
+			int fd = acceptWorker();
+			if (fd >= 0)
+			{
+				connected++;
+				connections.emplace_back(serveWorker, fd);
+			}
+		}
+		for (auto& connection : connections)
+		{
+			connection.join();
+		}
+	}
+
+	// Spawned workers still loading the scene are told to stop when they
+	// connect.
+	while (reapWorkers(children, false) > 0)
+	{
+		int fd = acceptWorker();
+		if (fd < 0) continue;
+		TileRange done{ -1, 0, 0 };
+		writeAll(fd, &done, sizeof(done));
+		close(fd);
+	}
+	close(server_fd);
+	unlink(socket_path.c_str());
+
+	finished = writer.finish() && finished;
+	RenderStats::printSummary(std::cout);
+	return finished;
+}
+
+bool runTileWorker(LoadedScene& loaded_scene, const std::string& socket_path)
+{
+	int fd = connectTo(socket_path);
+	if (fd < 0)
+		return false;
+
+	const std::vector<Camera>& cameras = loaded_scene.scene.cameras;
+	const RendererInfo& renderer_info = loaded_scene.renderer_info;
+	WavefrontIntegrator integrator(loaded_scene.ray_tracer);
+	std::vector<std::vector<std::vector<Color>>> images(cameras.size());
+	std::vector<double> pixels;
+
+	bool ok = true;
+	TileRange range;
+	while ((ok = readAll(fd, &range, sizeof(range))) && range.camera >= 0)
+	{
+		if (range.camera >= static_cast<int>(cameras.size()) || range.first_tile < 0
+			|| range.first_tile + range.tile_count > cameras[range.camera].tileCount(renderer_info))
+		{
+			std::cerr << "Coordinator sent a tile range this scene does not have" << std::endl;
+			close(fd);
+			return false;
+		}
+		const Camera& cam = cameras[range.camera];
+		std::vector<std::vector<Color>>& image = images[range.camera];
+		if (image.empty())
+			cam.prepareImage(image);
+
+		for (int tile = range.first_tile; ok && tile < range.first_tile + range.tile_count; tile++)
+		{
+			cam.renderTileAt(loaded_scene.ray_tracer, integrator, tile, image);
+			TileHeader header{ tile, 0, 0, 0, 0 };
+			int row, col, rows, cols;
+			cam.tileRect(renderer_info, tile, row, col, rows, cols);
+			header.row = row;
+			header.col = col;
+			header.rows = rows;
+			header.cols = cols;
+
+			pixels.clear();
+			for (int i = row; i < row + rows; i++)
+			{
+				for (int j = col; j < col + cols; j++)
+				{
+					pixels.push_back(image[i][j].r);
+					pixels.push_back(image[i][j].g);
+					pixels.push_back(image[i][j].b);
+				}
+			}
+			ok = writeAll(fd, &header, sizeof(header))
+				&& writeAll(fd, pixels.data(), pixels.size() * sizeof(double));
+		}
+	}
+	if (!ok)
+		std::cerr << "Lost the connection to the coordinator" << std::endl;
+	close(fd);
+
+	RenderStats::flushThread();
+	RenderStats::printSummary(std::cout);
+	return ok;
+}
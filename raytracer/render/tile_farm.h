@@ -0,0 +1,26 @@
+#ifndef TILE_FARM_H
+#define TILE_FARM_H
+
+#include <string>
+#include <vector>
+#include "../scene/loaded_scene.h"
+
+// Renders one scene with several processes. The coordinator listens on a
+// Unix socket and hands out small ranges of tiles, camera by camera, to
+// every worker that connects; workers load the scene and BVH once, render
+// each range on one thread and stream the pixels back, and the
+// coordinator assembles and writes the images into ./output. A range lost
+// with a worker's connection is handed to the next worker that asks.
+
+// Runs the coordinator. spawn_workers local workers are started by running
+// this executable with worker_args; more can join at any time with
+// --tile-worker. Returns false if the socket cannot be set up or every
+// spawned worker died before the images were finished.
+bool runTileCoordinator(LoadedScene& loaded_scene, const std::string& socket_path,
+	int spawn_workers, const std::vector<std::string>& worker_args);
+
+// Connects to the coordinator at socket_path, retrying for a few seconds,
+// and renders ranges until told there is no work left.
+bool runTileWorker(LoadedScene& loaded_scene, const std::string& socket_path);
+
+#endif // TILE_FARM_H
@@ -0,0 +1,279 @@
+#include "wavefront_integrator.h"
+#include "../include/morton.h"
+
+#include <algorithm>
+#include <numeric>
+
+static int materialTypeRank(const std::string& type)
+{
+	if (type == "mirror") return 1;
+	if (type == "conductor") return 2;
+	if (type == "dielectric") return 3;
+	return 0;
+}
+
+WavefrontIntegrator::WavefrontIntegrator(const BaseRayTracer& tracer)
+	: tracer(tracer),
+	scene_bounds(tracer.world.getAABB())
+{
+}
+
+void WavefrontIntegrator::traceTile(const std::vector<Ray>& primary_rays,
+	OUT std::vector<Color>& colors) const
+{
+	colors.assign(primary_rays.size(), Color(0, 0, 0));
+
+	std::vector<PathRay> paths;
+	paths.reserve(primary_rays.size());
+	for (size_t i = 0; i < primary_rays.size(); i++)
+	{
+		paths.push_back(PathRay{ primary_rays[i], Color(1, 1, 1), static_cast<int>(i),
+			tracer.renderer_info.max_recursion_depth + 1, RayKind::Primary });
+	}
+
+	std::vector<PathHit> hits;
+	std::vector<PathRay> next_paths;
+	std::vector<ShadowRay> shadow_rays;
+	while (!paths.empty())
+	{
+		intersect(paths, hits, colors);
+
+		next_paths.clear();
+		shadow_rays.clear();
+		shade(paths, hits, next_paths, shadow_rays, colors);
+
+		traceShadowRays(shadow_rays, colors);
+		paths.swap(next_paths);
+	}
+}
+
+void WavefrontIntegrator::intersect(const std::vector<PathRay>& paths,
+	OUT std::vector<PathHit>& hits,
+	OUT std::vector<Color>& colors) const
+{
+	hits.clear();
+	std::vector<int> order = coherentOrder(paths);
+
+	for (size_t begin = 0; begin < order.size(); begin += MAX_PACKET_SIZE)
+	{
+		size_t end = std::min(order.size(), begin + MAX_PACKET_SIZE);
+		RayPacket packet;
+		RenderCounters& counters = RenderStats::local();
+		for (size_t i = begin; i < end; i++)
+		{
+			packet.add(paths[order[i]].ray);
+			counters.rays(paths[order[i]].kind)++;
+		}
+
+		HitRecord recs[MAX_PACKET_SIZE];
+		LaneMask hit_mask = tracer.intersectPacket(packet, recs);
+
+		for (int lane = 0; lane < packet.size; lane++)
+		{
+			const PathRay& path = paths[order[begin + lane]];
+			if (!laneActive(hit_mask, lane))
+			{
+				if (path.depth == tracer.renderer_info.max_recursion_depth + 1)
+					colors[path.pixel] += path.weight * Color(tracer.background_color);
+				continue;
+			}
+			if (tracer.renderer_info.backface_culling && !recs[lane].front_face)
+				continue;
+			hits.push_back(PathHit{ order[begin + lane], recs[lane] });
+		}
+	}
+}
+
+void WavefrontIntegrator::shade(const std::vector<PathRay>& paths,
+	std::vector<PathHit>& hits,
+	OUT std::vector<PathRay>& next_paths,
+	OUT std::vector<ShadowRay>& shadow_rays,
+	OUT std::vector<Color>& colors) const
+{
+	const MaterialManager& materials = tracer.material_manager;
+	const double epsilon = tracer.renderer_info.shadow_ray_epsilon;
+
+	// Group the hits so each material type is shaded in one run. The key is
+	// the type's rank, then the material id, worked out once per hit.
+	std::vector<uint64_t> keys(hits.size());
+	for (size_t i = 0; i < hits.size(); i++)
+	{
+		const int material_id = hits[i].rec.material_id;
+		uint64_t rank = materialTypeRank(materials.getMaterialById(material_id).type);
+		keys[i] = (rank << 32) | static_cast<uint32_t>(material_id);
+	}
+	std::vector<int> order(hits.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(),
+		[&keys](int a, int b) { return keys[a] < keys[b]; });
+	std::vector<PathHit> sorted_hits;
+	sorted_hits.reserve(hits.size());
+	for (int i : order)
+		sorted_hits.push_back(hits[i]);
+	hits.swap(sorted_hits);
+
+	std::vector<int> light_ids;
+	for (const PathHit& hit : hits)
+	{
+		const PathRay& path = paths[hit.path];
+		const HitRecord& rec = hit.rec;
+		const Material& mat = materials.getMaterialById(rec.material_id);
+		const bool spawn = path.depth - 1 > 0;
+
+		colors[path.pixel] += path.weight
+			* (Color(mat.ambient_reflectance) * Color(tracer.light_sources.ambient_light));
+
+		if (mat.type == "mirror")
+		{
+			if (spawn)
+			{
+				Vec3 wo = path.ray.direction * -1;
+				Vec3 wr = (rec.normal * (2 * (rec.normal.dot(wo)))) - wo;
+				next_paths.push_back(PathRay{ Ray(rec.point + rec.normal * epsilon, wr),
+					path.weight * Color(mat.mirror_reflectance), path.pixel, path.depth - 1,
+					RayKind::Reflection });
+			}
+		}
+		else if (mat.type == "conductor")
+		{
+			if (spawn)
+			{
+				Vec3 wo = path.ray.direction * -1;
+				Vec3 wr = (rec.normal * (2 * (rec.normal.dot(wo)))) - wo;
+				wr.normalize();
+				wo.normalize();
+				double f_r = conductorReflectance(wo.dot(rec.normal), mat);
+				next_paths.push_back(PathRay{ Ray(rec.point + rec.normal * epsilon, wr),
+					path.weight * f_r * Color(mat.mirror_reflectance), path.pixel, path.depth - 1,
+					RayKind::Reflection });
+			}
+		}
+		else if (mat.type == "dielectric")
+		{
+			if (!spawn) continue;
+
+			Vec3 wo = path.ray.direction * -1;
+			Vec3 normal = rec.normal;
+			double n1, n2;
+			bool entering = rec.front_face;
+
+			if (entering) { n1 = 1.0; n2 = mat.refraction_index; }
+			else { n1 = mat.refraction_index; n2 = 1.0; normal = normal * -1; }
+
+			double eta = n1 / n2;
+			double cosTheta = std::clamp(wo.dot(normal), -1.0, 1.0);
+			double sin2ThetaT = eta * eta * (1 - cosTheta * cosTheta);
+			double F_r = dielectricReflectance(cosTheta, sin2ThetaT, n1, n2);
+
+			// Absorption when exiting scales everything seen through the surface
+			Color weight = path.weight;
+			if (!entering)
+			{
+				double d = rec.t;
+				weight.r *= exp(-mat.absorption_coefficient.x * d);
+				weight.g *= exp(-mat.absorption_coefficient.y * d);
+				weight.b *= exp(-mat.absorption_coefficient.z * d);
+			}
+
+			Vec3 wo_unit = wo;
+			wo_unit.normalize();
+			Vec3 wr = (normal * (2 * (normal.dot(wo_unit)))) - wo_unit;
+			next_paths.push_back(PathRay{ Ray(rec.point + normal * epsilon, wr.normalize()),
+				weight * F_r, path.pixel, path.depth - 1, RayKind::Reflection });
+
+			if (sin2ThetaT <= 1.0)
+			{
+				Vec3 wt = (wo * -1) * eta + normal * (eta * cosTheta - sqrt(1 - sin2ThetaT));
+				next_paths.push_back(PathRay{ Ray(rec.point - normal * epsilon, wt.normalize()),
+					weight * (1 - F_r), path.pixel, path.depth - 1, RayKind::Refraction });
+			}
+			continue; // dielectrics take no direct lighting
+		}
+
+		light_ids.clear();
+		const bool cull = tracer.cullsLights();
+		if (cull) tracer.collectLights(rec.point, light_ids);
+		const size_t light_count = cull ? light_ids.size() : tracer.light_sources.point_lights.size();
+
+		for (size_t i = 0; i < light_count; i++)
+		{
+			const PointLight& light = tracer.light_sources.point_lights[cull ? light_ids[i] : i];
+			Vec3 wi = Vec3(light.position) - rec.point;
+			double distance = wi.length();
+			wi.normalize();
+
+			Color diffuse, specular;
+			tracer.directLighting(path.ray, rec, mat, light, wi, distance, diffuse, specular);
+			shadow_rays.push_back(ShadowRay{ Ray(rec.point + rec.normal * epsilon, wi), distance,
+				cull ? light_ids[i] : static_cast<int>(i), diffuse * path.weight, specular * path.weight, path.pixel });
+		}
+	}
+}
+
+void WavefrontIntegrator::traceShadowRays(const std::vector<ShadowRay>& shadow_rays,
+	OUT std::vector<Color>& colors) const
+{
+	std::vector<int> order = coherentOrder(shadow_rays);
+	std::vector<bool> visible(shadow_rays.size(), false);
+
+	for (size_t begin = 0; begin < order.size(); begin += MAX_PACKET_SIZE)
+	{
+		size_t end = std::min(order.size(), begin + MAX_PACKET_SIZE);
+		RayPacket packet;
+		double distances[MAX_PACKET_SIZE];
+		int lights[MAX_PACKET_SIZE];
+		for (size_t i = begin; i < end; i++)
+		{
+			distances[packet.size] = shadow_rays[order[i]].distance;
+			lights[packet.size] = shadow_rays[order[i]].light;
+			packet.add(shadow_rays[order[i]].ray);
+		}
+
+		LaneMask occluded = tracer.occludedPacket(packet, distances, lights);
+		for (int lane = 0; lane < packet.size; lane++)
+			visible[order[begin + lane]] = !laneActive(occluded, lane);
+	}
+
+	// Accumulate in generation order so each pixel sums its lights the same
+	// way applyShading does.
+	for (size_t i = 0; i < shadow_rays.size(); i++)
+	{
+		if (!visible[i]) continue;
+		colors[shadow_rays[i].pixel] += shadow_rays[i].diffuse;
+		colors[shadow_rays[i].pixel] += shadow_rays[i].specular;
+	}
+}
+
+template <typename T>
+std::vector<int> WavefrontIntegrator::coherentOrder(const std::vector<T>& rays) const
+{
+	std::vector<uint64_t> keys(rays.size());
+	for (size_t i = 0; i < rays.size(); i++)
+		keys[i] = sortKey(rays[i].ray);
+
+	std::vector<int> order(rays.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(),
+		[&keys](int a, int b) { return keys[a] < keys[b]; });
+	return order;
+}
+
+// Direction octant in the top bits, then the Morton code of the origin
+// within the scene bounds, so neighbouring keys share both.
+uint64_t WavefrontIntegrator::sortKey(const Ray& ray) const
+{
+	uint64_t octant = (ray.direction.x < 0 ? 1 : 0)
+		| (ray.direction.y < 0 ? 2 : 0)
+		| (ray.direction.z < 0 ? 4 : 0);
+
+	uint32_t cell[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const Interval& extent = scene_bounds[axis];
+		double length = extent.getLength();
+		double offset = length > 0 ? (ray.origin[axis] - extent.min) / length : 0.0;
+		offset = std::clamp(offset, 0.0, 1.0);
+		cell[axis] = static_cast<uint32_t>(offset * ((1 << 20) - 1));
+	}
+	return (octant << 60) | morton3D(cell[0], cell[1], cell[2]);
+}
@@ -0,0 +1,68 @@
+#ifndef WAVEFRONT_INTEGRATOR_H
+#define WAVEFRONT_INTEGRATOR_H
+
+#include <vector>
+#include "base_ray_tracer.h"
+
+// Breadth-first alternative to BaseRayTracer::computeColor. Instead of
+// following each pixel's recursion tree depth-first, a whole tile advances
+// one bounce at a time: every ray of the current bounce is intersected in
+// packets, the hits are shaded grouped by material, and the shadow,
+// reflection and refraction rays they spawn are queued and sorted by
+// direction and origin before the next round.
+constexpr int WAVEFRONT_TILE_SIZE = 64;
+
+class WavefrontIntegrator {
+public:
+	WavefrontIntegrator(const BaseRayTracer& tracer);
+
+	// colors[i] receives the radiance of primary_rays[i].
+	void traceTile(const std::vector<Ray>& primary_rays,
+		OUT std::vector<Color>& colors) const;
+
+private:
+	typedef struct PathRay {
+		Ray ray;
+		Color weight; // product of the reflectances along the path
+		int pixel;
+		int depth;
+		RayKind kind;
+	}PathRay;
+
+	typedef struct ShadowRay {
+		Ray ray;
+		double distance;
+		int light;
+		Color diffuse;
+		Color specular;
+		int pixel;
+	}ShadowRay;
+
+	typedef struct PathHit {
+		int path;
+		HitRecord rec;
+	}PathHit;
+
+	void intersect(const std::vector<PathRay>& paths,
+		OUT std::vector<PathHit>& hits,
+		OUT std::vector<Color>& colors) const;
+
+	void shade(const std::vector<PathRay>& paths,
+		std::vector<PathHit>& hits,
+		OUT std::vector<PathRay>& next_paths,
+		OUT std::vector<ShadowRay>& shadow_rays,
+		OUT std::vector<Color>& colors) const;
+
+	void traceShadowRays(const std::vector<ShadowRay>& shadow_rays,
+		OUT std::vector<Color>& colors) const;
+
+	template <typename T>
+	std::vector<int> coherentOrder(const std::vector<T>& rays) const;
+
+	uint64_t sortKey(const Ray& ray) const;
+
+	const BaseRayTracer& tracer;
+	AABB scene_bounds;
+};
+
+#endif // WAVEFRONT_INTEGRATOR_H
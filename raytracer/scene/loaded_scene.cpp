@@ -0,0 +1,424 @@
+#include "loaded_scene.h"
+#include "../objects/sphere.h"
+#include "../objects/triangle.h"
+
+#include <algorithm>
+#include <iostream>
+
+static double getAreaTriangle(Vec3 v1, Vec3 v2, Vec3 v3)
+{
+  Vec3 edge1 = v2 - v1;
+  Vec3 edge2 = v3 - v1;
+  Vec3 cross_product = edge1.cross(edge2);
+  double area = 0.5 * cross_product.length();
+  return area;
+}
+
+static Scene_ parseSceneFile(const std::string& scene_filename)
+{
+  ScopedStageTimer timer(Stage::Parse);
+  Scene_ raw_scene;
+  std::cout << "Parsing scene file: " << scene_filename << std::endl;
+  parseScene(scene_filename, raw_scene);
+  return raw_scene;
+}
+
+// Area-weighted average of the face normals around each vertex.
+static std::vector<Vec3> computeVertexNormals(const Scene_& raw_scene, const Mesh_& raw_mesh)
+{
+  ScopedStageTimer timer(Stage::Normals);
+  std::vector<std::vector<std::pair<Vec3, double>>> per_vertex_triangles; // pair<triangle_normal, area> for each vertex
+  per_vertex_triangles.resize(raw_scene.vertex_data.size());
+  for(const Triangle_& raw_triangle : raw_mesh.faces)
+  {
+    Vec3 v0 = Vec3(raw_scene.vertex_data[raw_triangle.v0_id]);
+    Vec3 v1 = Vec3(raw_scene.vertex_data[raw_triangle.v1_id]);
+    Vec3 v2 = Vec3(raw_scene.vertex_data[raw_triangle.v2_id]);
+    double area = getAreaTriangle(v0, v1, v2);
+    Vec3 edge1 = v1 - v0;
+    Vec3 edge2 = v2 - v0;
+    Vec3 face_normal = edge1.cross(edge2).normalize();
+    per_vertex_triangles[raw_triangle.v0_id].push_back(std::make_pair(face_normal, area));
+    per_vertex_triangles[raw_triangle.v1_id].push_back(std::make_pair(face_normal, area));
+    per_vertex_triangles[raw_triangle.v2_id].push_back(std::make_pair(face_normal, area));
+  }
+  std::vector<Vec3> vertex_normals;
+  for (const auto& v : per_vertex_triangles)
+  {
+    Vec3 normal(0.0, 0.0, 0.0);
+    double total_area = 0.0;
+    for (const auto& pair : v)
+    {
+      normal = normal + pair.first * pair.second;
+      total_area += pair.second;
+    }
+    if (total_area > 0.0)
+    {
+      normal = normal / total_area;
+      normal.normalize();
+    }
+    vertex_normals.push_back(normal);
+  }
+  return vertex_normals;
+}
+
+static std::vector<std::shared_ptr<Hittable>> buildWorldObjects(const Scene_& raw_scene)
+{
+  TraceSpan span("build primitives", "build");
+  std::vector<std::shared_ptr<Hittable>> world_objects;
+  for (const Sphere_& raw_sphere : raw_scene.spheres)
+  {
+    Vec3 center = Vec3(raw_scene.vertex_data[raw_sphere.center_vertex_id]);
+    double radius = static_cast<double>(raw_sphere.radius);
+    int material_id = raw_sphere.material_id;
+		world_objects.push_back(
+      std::make_shared<Sphere>(center, radius, material_id));
+  }
+
+  for(const Triangle_ & raw_triangle : raw_scene.triangles)
+  {
+    Vec3 indices[3] = { raw_scene.vertex_data[raw_triangle.v0_id], 
+      raw_scene.vertex_data[raw_triangle.v1_id], 
+      raw_scene.vertex_data[raw_triangle.v2_id]};
+
+    world_objects.push_back(
+      std::make_shared<Triangle>(indices, raw_triangle.material_id));
+	}
+
+
+  for(const Mesh_& raw_mesh : raw_scene.meshes)
+  {
+    if (raw_mesh.smooth_shading)
+    {
+			std::vector<Vec3> vertex_normals = computeVertexNormals(raw_scene, raw_mesh);
+      for (const Triangle_& raw_triangle : raw_mesh.faces)
+      {
+        Vec3 indices[3] = { raw_scene.vertex_data[raw_triangle.v0_id],
+          raw_scene.vertex_data[raw_triangle.v1_id],
+          raw_scene.vertex_data[raw_triangle.v2_id] };
+
+				Vec3 per_vertex_normals[3] = {
+          vertex_normals[raw_triangle.v0_id],
+          vertex_normals[raw_triangle.v1_id],
+					vertex_normals[raw_triangle.v2_id] };
+
+        world_objects.push_back(
+          std::make_shared<Triangle>(indices, raw_triangle.material_id, per_vertex_normals));
+      }
+    }
+    else
+    {
+      for (const Triangle_& raw_triangle : raw_mesh.faces)
+      {
+        Vec3 indices[3] = { raw_scene.vertex_data[raw_triangle.v0_id],
+          raw_scene.vertex_data[raw_triangle.v1_id],
+          raw_scene.vertex_data[raw_triangle.v2_id] };
+
+        world_objects.push_back(
+          std::make_shared<Triangle>(indices, raw_triangle.material_id));
+      }
+    }
+	}
+
+
+  return world_objects;
+}
+
+// buildWorldObjects puts the spheres first, then the triangles, then each
+// mesh's faces. Taken before the BVH build reorders world_objects.
+static std::vector<Sphere*> sphereObjects(const std::vector<std::shared_ptr<Hittable>>& world_objects,
+  const Scene_& raw_scene)
+{
+  std::vector<Sphere*> spheres;
+  if (world_objects.empty())
+    return spheres;
+  for (size_t i = 0; i < raw_scene.spheres.size(); i++)
+    spheres.push_back(static_cast<Sphere*>(world_objects[i].get()));
+  return spheres;
+}
+
+static std::vector<std::vector<Triangle*>> meshObjects(const std::vector<std::shared_ptr<Hittable>>& world_objects,
+  const Scene_& raw_scene)
+{
+  std::vector<std::vector<Triangle*>> meshes;
+  if (world_objects.empty())
+    return meshes;
+  size_t next = raw_scene.spheres.size() + raw_scene.triangles.size();
+  for (const Mesh_& raw_mesh : raw_scene.meshes)
+  {
+    std::vector<Triangle*> faces;
+    for (size_t i = 0; i < raw_mesh.faces.size(); i++)
+      faces.push_back(static_cast<Triangle*>(world_objects[next++].get()));
+    meshes.push_back(faces);
+  }
+  return meshes;
+}
+
+static std::vector<Plane> buildPlanes(const Scene_& raw_scene)
+{
+  std::vector<Plane> planes;
+  for(const Plane_& raw_plane : raw_scene.planes)
+  {
+    planes.push_back(Plane(raw_plane, raw_scene.vertex_data));
+  }
+  return planes;
+}
+
+// One per sphere, triangle and mesh face, as buildWorldObjects makes them.
+static size_t primitiveCount(const Scene_& raw_scene)
+{
+  size_t count = raw_scene.spheres.size() + raw_scene.triangles.size();
+  for (const Mesh_& raw_mesh : raw_scene.meshes)
+    count += raw_mesh.faces.size();
+  return count;
+}
+
+static std::unique_ptr<SharedScene> attachSharedScene(const std::string& name, const Scene_& raw_scene,
+  uint64_t geometry_key)
+{
+  if (name.empty())
+    return nullptr;
+  std::unique_ptr<SharedScene> shared_scene = SharedScene::attach(name, primitiveCount(raw_scene), geometry_key);
+  if (!shared_scene)
+    std::cerr << "Building the scene in this process instead" << std::endl;
+  return shared_scene;
+}
+
+// FNV-1a over the raw geometry, as parsed.
+static void hashBytes(uint64_t& hash, const void* data, size_t size)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; i++)
+  {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+}
+
+template <typename T>
+static void hashValue(uint64_t& hash, const T& value)
+{
+  hashBytes(hash, &value, sizeof(value));
+}
+
+static uint64_t geometryKey(const Scene_& raw_scene)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+  hashValue(hash, raw_scene.shadow_ray_epsilon);
+  for (const Vec3f_& v : raw_scene.vertex_data)
+  {
+    hashValue(hash, v.x);
+    hashValue(hash, v.y);
+    hashValue(hash, v.z);
+  }
+  for (const Sphere_& sphere : raw_scene.spheres)
+  {
+    hashValue(hash, sphere.material_id);
+    hashValue(hash, sphere.center_vertex_id);
+    hashValue(hash, sphere.radius);
+  }
+  auto hashTriangle = [&hash](const Triangle_& triangle) {
+    hashValue(hash, triangle.material_id);
+    hashValue(hash, triangle.v0_id);
+    hashValue(hash, triangle.v1_id);
+    hashValue(hash, triangle.v2_id);
+  };
+  for (const Triangle_& triangle : raw_scene.triangles)
+    hashTriangle(triangle);
+  for (const Mesh_& mesh : raw_scene.meshes)
+  {
+    hashValue(hash, mesh.smooth_shading);
+    hashValue(hash, mesh.faces.size());
+    for (const Triangle_& triangle : mesh.faces)
+      hashTriangle(triangle);
+  }
+  for (const Plane_& plane : raw_scene.planes)
+  {
+    hashValue(hash, plane.material_id);
+    hashValue(hash, plane.point_vertex_id);
+    hashValue(hash, plane.normal.x);
+    hashValue(hash, plane.normal.y);
+    hashValue(hash, plane.normal.z);
+  }
+  return hash;
+}
+
+static RendererInfo sceneRendererInfo(const Scene_& raw_scene, RendererInfo options)
+{
+  options.shadow_ray_epsilon = raw_scene.shadow_ray_epsilon;
+  options.intersection_test_epsilon = raw_scene.intersection_test_epsilon;
+  options.max_recursion_depth = raw_scene.max_recursion_depth;
+  return options;
+}
+
+// Adds its size to the BVH statistics.
+static CompressedBvh compressBvh(const BvhNode& world)
+{
+  ScopedStageTimer timer(Stage::Bvh);
+  CompressedBvh compressed(world);
+  BvhStats stats = RenderStats::bvhStats();
+  stats.compressed_nodes = static_cast<long long>(compressed.nodeCount());
+  stats.compressed_bytes = static_cast<long long>(compressed.byteSize());
+  RenderStats::setBvhStats(stats);
+  return compressed;
+}
+
+LoadedScene::LoadedScene(const std::string& scene_filename, const RendererInfo& options,
+  const std::string& shared_scene_name)
+  : raw_scene(parseSceneFile(scene_filename)),
+  geometry_key(geometryKey(raw_scene)),
+  shared_scene(attachSharedScene(shared_scene_name, raw_scene, geometry_key)),
+  world_objects(shared_scene ? std::vector<std::shared_ptr<Hittable>>() : buildWorldObjects(raw_scene)),
+  sphere_objects(sphereObjects(world_objects, raw_scene)),
+  mesh_objects(meshObjects(world_objects, raw_scene)),
+  planes(buildPlanes(raw_scene)),
+  material_manager(raw_scene.materials),
+  scene(raw_scene, world_objects, options, !shared_scene),
+  compressed_world(options.compressed_bvh && !shared_scene
+    ? std::make_unique<CompressedBvh>(compressBvh(scene.world)) : nullptr),
+  renderer_info(sceneRendererInfo(raw_scene, options)),
+  ray_tracer(scene.background_color, scene.light_sources, scene.light_tree,
+    world(), planes, material_manager, renderer_info),
+  render_manager(scene, material_manager, renderer_info, ray_tracer, geometry_key),
+  bvh_built_cost(shared_scene ? 0.0 : scene.world.traversalCost()),
+  first_moved_center(raw_scene.vertex_data.size())
+{
+  // Only the mapped copy of the geometry is kept.
+  if (shared_scene)
+  {
+    std::vector<Vec3f_>().swap(raw_scene.vertex_data);
+    std::vector<Mesh_>().swap(raw_scene.meshes);
+    std::vector<Triangle_>().swap(raw_scene.triangles);
+    std::vector<Sphere_>().swap(raw_scene.spheres);
+  }
+}
+
+const Hittable& LoadedScene::world() const
+{
+  if (shared_scene)
+    return *shared_scene;
+  if (compressed_world)
+    return *compressed_world;
+  return scene.world;
+}
+
+bool LoadedScene::applyChanges(const RenderJob_& job, OUT SceneChange& change, OUT std::string& error)
+{
+  if (shared_scene && !job.sphere_edits.empty())
+  {
+    error = "sphere edits are unsupported on attached scenes";
+    return false;
+  }
+  for (const SphereEdit_& edit : job.sphere_edits)
+  {
+    if (std::none_of(raw_scene.spheres.begin(), raw_scene.spheres.end(),
+      [&edit](const Sphere_& other) { return other.id == edit.id; }))
+    {
+      error = "no sphere with id " + std::to_string(edit.id);
+      return false;
+    }
+  }
+
+  if (job.has_ambient_light)
+  {
+    raw_scene.ambient_light = job.ambient_light;
+    scene.light_sources.ambient_light = Color(job.ambient_light.x, job.ambient_light.y, job.ambient_light.z);
+    change.lights = true;
+  }
+
+  // Scene keeps its lights in the raw scene's order.
+  for (const PointLight_& raw_light : job.point_lights)
+  {
+    PointLight light(raw_light.id, Vec3(raw_light.position),
+      Color(raw_light.intensity.x, raw_light.intensity.y, raw_light.intensity.z));
+    size_t i = 0;
+    while (i < raw_scene.point_lights.size() && raw_scene.point_lights[i].id != raw_light.id)
+      i++;
+    if (i == raw_scene.point_lights.size())
+    {
+      raw_scene.point_lights.push_back(raw_light);
+      scene.light_sources.point_lights.push_back(light);
+    }
+    else
+    {
+      raw_scene.point_lights[i] = raw_light;
+      scene.light_sources.point_lights[i] = light;
+    }
+    change.lights = true;
+  }
+  if (!job.point_lights.empty())
+  {
+    TraceSpan span("light tree", "build");
+    scene.light_tree = LightTree(scene.light_sources.point_lights);
+  }
+
+  for (const Material_& raw_material : job.materials)
+  {
+    for (Material_& material : raw_scene.materials)
+    {
+      if (material.id == raw_material.id)
+        material = raw_material;
+    }
+    change.materials.push_back(raw_material.id);
+  }
+  if (!job.materials.empty())
+    material_manager = MaterialManager(raw_scene.materials);
+
+  // A moved center goes in as a vertex of its own, so primitives sharing
+  // the old one stay put; later moves of the same sphere reuse it.
+  for (const SphereEdit_& edit : job.sphere_edits)
+  {
+    for (size_t i = 0; i < raw_scene.spheres.size(); i++)
+    {
+      Sphere_& raw_sphere = raw_scene.spheres[i];
+      if (raw_sphere.id != edit.id) continue;
+      if (edit.has_center)
+      {
+        if (static_cast<size_t>(raw_sphere.center_vertex_id) >= first_moved_center)
+        {
+          raw_scene.vertex_data[raw_sphere.center_vertex_id] = edit.center;
+        }
+        else
+        {
+          raw_scene.vertex_data.push_back(edit.center);
+          raw_sphere.center_vertex_id = static_cast<int>(raw_scene.vertex_data.size() - 1);
+        }
+      }
+      if (edit.has_radius) raw_sphere.radius = edit.radius;
+      if (edit.has_material) raw_sphere.material_id = edit.material_id;
+
+      Sphere& sphere = *sphere_objects[i];
+      change.boxes.push_back(sphere.getAABB());
+      sphere.setData(SphereData{ Vec3(raw_scene.vertex_data[raw_sphere.center_vertex_id]),
+        static_cast<double>(raw_sphere.radius), raw_sphere.material_id });
+      change.boxes.push_back(sphere.getAABB());
+    }
+  }
+  if (!job.sphere_edits.empty())
+  {
+    refitWorld();
+    geometry_key = geometryKey(raw_scene);
+  }
+  return true;
+}
+
+bool LoadedScene::refitWorld()
+{
+  bool rebuild;
+  {
+    ScopedStageTimer timer(Stage::Bvh);
+    scene.world.refit(workerThreadCount(renderer_info, static_cast<int>(world_objects.size())));
+    rebuild = scene.world.traversalCost() > bvh_built_cost * renderer_info.bvh_rebuild_ratio;
+    if (rebuild)
+    {
+      TraceSpan span("rebuild bvh", "build");
+      scene.world = buildBvh(world_objects, renderer_info.bvh_builder, renderer_info.sbvh_duplication_budget,
+        renderer_info.early_split_budget);
+      bvh_built_cost = scene.world.traversalCost();
+    }
+  }
+  // Assigned in place: the ray tracer holds a reference to it.
+  if (compressed_world)
+    *compressed_world = compressBvh(scene.world);
+  return rebuild;
+}
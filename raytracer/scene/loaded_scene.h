@@ -0,0 +1,69 @@
+#ifndef LOADED_SCENE_H
+#define LOADED_SCENE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "scene.h"
+#include "shared_scene.h"
+#include "../include/parser.hpp"
+#include "../include/compressed_bvh.h"
+#include "../objects/plane.h"
+#include "../material/material_manager.h"
+#include "../render/base_ray_tracer.h"
+#include "../render/render_manager.h"
+
+// A parsed scene together with everything built from it: primitives, BVH,
+// materials and the ray tracer bound to them. Building it is the expensive
+// part of a run, so it is kept whole and reused for every render. Members
+// refer to each other, so it is neither copied nor moved.
+//
+// With a shared_scene_name the primitives and BVH come from a block
+// another process published (see SharedScene) and the parsed geometry is
+// dropped; if it cannot be attached the scene is built here as usual.
+class LoadedScene {
+public:
+	LoadedScene(const std::string& scene_filename, const RendererInfo& options,
+		const std::string& shared_scene_name = "");
+	LoadedScene(const LoadedScene&) = delete;
+	LoadedScene& operator=(const LoadedScene&) = delete;
+
+	Scene_ raw_scene;
+	// Fingerprint of what primary hits depend on: geometry, material
+	// assignment and the shadow ray epsilon, which is also the closest t a
+	// hit may have, but not lights or material parameters. Keys stored
+	// G-buffers.
+	uint64_t geometry_key;
+	std::unique_ptr<SharedScene> shared_scene; // null when the scene is built here
+	std::vector<std::shared_ptr<Hittable>> world_objects;
+	std::vector<Sphere*> sphere_objects; // in raw_scene.spheres order, empty with a shared scene
+	std::vector<std::vector<Triangle*>> mesh_objects; // faces of each of raw_scene.meshes, likewise
+	std::vector<Plane> planes;
+	MaterialManager material_manager;
+	Scene scene;
+	std::unique_ptr<CompressedBvh> compressed_world; // with options.compressed_bvh, traced in place of scene.world
+	RendererInfo renderer_info;
+	BaseRayTracer ray_tracer;
+	RenderManager render_manager;
+	double bvh_built_cost; // scene.world's traversal cost when last built
+	size_t first_moved_center; // raw_scene.vertex_data from here on are centers of spheres edits moved, one per sphere
+
+	// The BVH rays are traced against: the shared one, the compressed one
+	// or scene.world.
+	const Hittable& world() const;
+
+	// Applies a job's edits for this and every later render: lights and
+	// materials are replaced by id or added, edited spheres are moved and
+	// the BVH refitted around them. Sphere edits need geometry built here.
+	// With a shared scene, or an unknown sphere id, nothing is applied and
+	// false is returned with the reason in error.
+	bool applyChanges(const RenderJob_& job, OUT SceneChange& change, OUT std::string& error);
+
+	// Updates scene.world after primitives moved: refits it in parallel, or
+	// rebuilds it when the refit left its traversal cost above
+	// renderer_info.bvh_rebuild_ratio times the built tree's. The compressed
+	// BVH is rebuilt from it either way. Returns true when it rebuilt.
+	bool refitWorld();
+};
+
+#endif // LOADED_SCENE_H
@@ -7,7 +7,8 @@ Scene::Scene() {
 		// Constructor implementation (if needed)
 }
 
-Scene::Scene(const Scene_& raw_scene, std::vector<std::shared_ptr<Hittable>>& objects)
+Scene::Scene(const Scene_& raw_scene, std::vector<std::shared_ptr<Hittable>>& objects,
+	const RendererInfo& options, bool build_bvh)
 	: background_color(raw_scene.background_color.x, raw_scene.background_color.y, raw_scene.background_color.z)
 {
 	for (const auto& raw_camera : raw_scene.cameras) {
@@ -22,8 +23,16 @@ Scene::Scene(const Scene_& raw_scene, std::vector<std::shared_ptr<Hittable>>& ob
 	light_sources.ambient_light = Color(raw_scene.ambient_light.x,
 		raw_scene.ambient_light.y,
 		raw_scene.ambient_light.z);
+	{
+		TraceSpan span("light tree", "build");
+		light_tree = LightTree(light_sources.point_lights);
+	}
 		
-	world = BvhNode(objects, 0, static_cast<int>(objects.size() - 1));
+	if (!build_bvh)
+		return;
+	ScopedStageTimer timer(Stage::Bvh);
+	world = buildBvh(objects, options.bvh_builder, options.sbvh_duplication_budget,
+		options.early_split_budget);
 }
 
 Scene::~Scene() {
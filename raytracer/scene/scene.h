@@ -9,17 +9,22 @@
 #include "../material/material_manager.h"
 #include "bvh.h"
 #include "../light/light.h"
+#include "../light/light_tree.h"
 
 
 class Scene{
 public:
 	Scene();
-	Scene(const Scene_& raw_scene, std::vector<std::shared_ptr<Hittable>>& objects);
+	// Builds world with options.bvh_builder; leaves it empty when build_bvh
+	// is false, for scenes whose geometry lives elsewhere.
+	Scene(const Scene_& raw_scene, std::vector<std::shared_ptr<Hittable>>& objects,
+		const RendererInfo& options, bool build_bvh = true);
 	~Scene();
 
 	std::vector<Camera> cameras;
 	Color background_color;
 	LightSources light_sources;
+	LightTree light_tree;
 	BvhNode world;
 };
 
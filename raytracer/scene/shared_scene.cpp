@@ -0,0 +1,375 @@
+#include "shared_scene.h"
+#include "../objects/triangle_fragment.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+constexpr char SHARED_SCENE_MAGIC[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+constexpr uint32_t SHARED_SCENE_VERSION = 2;
+
+// Record sizes are stored so that a block written by a build with a
+// different layout is refused rather than misread.
+typedef struct SharedSceneHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t node_size;
+	uint32_t triangle_size;
+	uint32_t sphere_size;
+	uint64_t scene_key; // geometry and material ids it was published from
+	uint64_t node_count;
+	uint64_t triangle_count;
+	uint64_t sphere_count;
+	uint64_t nodes_offset;
+	uint64_t triangles_offset;
+	uint64_t spheres_offset;
+	uint64_t size;
+}SharedSceneHeader;
+
+static size_t alignUp(size_t offset)
+{
+	return (offset + 15) & ~static_cast<size_t>(15);
+}
+
+// POSIX shared memory names are a slash followed by a name without one.
+static bool isSharedMemoryName(const std::string& name)
+{
+	return name.size() > 1 && name[0] == '/' && name.find('/', 1) == std::string::npos;
+}
+
+static int openBlock(const std::string& name, int flags, mode_t mode)
+{
+	return isSharedMemoryName(name) ? shm_open(name.c_str(), flags, mode)
+		: open(name.c_str(), flags, mode);
+}
+
+// Numbers the nodes and primitives under a BvhNode. A primitive can sit
+// under several leaves (sibling ranges share their middle object, split
+// triangles leave fragments) and is stored once.
+class SceneFlattener {
+public:
+	bool flatten(const BvhNode& world)
+	{
+		if (!world.leftChild())
+			return true;
+		if (!collectPrimitives(&world))
+			return false;
+		addNode(world);
+		return true;
+	}
+
+	std::vector<SharedScene::FlatNode> nodes;
+	std::vector<TriangleData> triangles;
+	std::vector<SphereData> spheres;
+
+private:
+	// A fragment is stored as the triangle it intersects.
+	static const Hittable* primitive(const Hittable* object)
+	{
+		if (const TriangleFragment* fragment = dynamic_cast<const TriangleFragment*>(object))
+			return fragment->getTriangle();
+		return object;
+	}
+
+	bool collectPrimitives(const Hittable* object)
+	{
+		object = primitive(object);
+		if (const BvhNode* node = dynamic_cast<const BvhNode*>(object))
+			return collectPrimitives(node->leftChild()) && collectPrimitives(node->rightChild());
+		if (const Triangle* triangle = dynamic_cast<const Triangle*>(object))
+		{
+			if (triangle_ids.emplace(object, triangles.size()).second)
+				triangles.push_back(triangle->getData());
+			return true;
+		}
+		if (const Sphere* sphere = dynamic_cast<const Sphere*>(object))
+		{
+			if (sphere_ids.emplace(object, spheres.size()).second)
+				spheres.push_back(sphere->getData());
+			return true;
+		}
+		std::cerr << "Error: Only triangles and spheres can be put in a shared scene" << std::endl;
+		return false;
+	}
+
+	int32_t addNode(const BvhNode& node)
+	{
+		int32_t index = nodes.size();
+		nodes.push_back(SharedScene::FlatNode{ node.getAABB(), { 0, 0 } });
+		int32_t left = childIndex(node.leftChild());
+		int32_t right = childIndex(node.rightChild());
+		nodes[index].children[0] = left;
+		nodes[index].children[1] = right;
+		return index;
+	}
+
+	int32_t childIndex(const Hittable* object)
+	{
+		if (const BvhNode* node = dynamic_cast<const BvhNode*>(object))
+			return addNode(*node);
+		object = primitive(object);
+		auto triangle = triangle_ids.find(object);
+		if (triangle != triangle_ids.end())
+			return -1 - triangle->second;
+		return -1 - static_cast<int32_t>(triangles.size() + sphere_ids.at(object));
+	}
+
+	std::unordered_map<const Hittable*, int32_t> triangle_ids;
+	std::unordered_map<const Hittable*, int32_t> sphere_ids;
+};
+
+bool publishSharedScene(const BvhNode& world, const std::string& name, uint64_t scene_key)
+{
+	SceneFlattener flattener;
+	if (!flattener.flatten(world))
+		return false;
+
+	SharedSceneHeader header{};
+	header.version = SHARED_SCENE_VERSION;
+	header.node_size = sizeof(SharedScene::FlatNode);
+	header.triangle_size = sizeof(TriangleData);
+	header.sphere_size = sizeof(SphereData);
+	header.scene_key = scene_key;
+	header.node_count = flattener.nodes.size();
+	header.triangle_count = flattener.triangles.size();
+	header.sphere_count = flattener.spheres.size();
+	header.nodes_offset = alignUp(sizeof(SharedSceneHeader));
+	header.triangles_offset = alignUp(header.nodes_offset + header.node_count * header.node_size);
+	header.spheres_offset = alignUp(header.triangles_offset + header.triangle_count * header.triangle_size);
+	header.size = header.spheres_offset + header.sphere_count * header.sphere_size;
+
+	std::vector<char> block(header.size, 0);
+	std::memcpy(block.data() + header.nodes_offset, flattener.nodes.data(), header.node_count * header.node_size);
+	std::memcpy(block.data() + header.triangles_offset, flattener.triangles.data(),
+		header.triangle_count * header.triangle_size);
+	std::memcpy(block.data() + header.spheres_offset, flattener.spheres.data(),
+		header.sphere_count * header.sphere_size);
+
+	// Never write into a published block: renderers map it shared and would
+	// fault or read a half written BVH. A file is written beside name and
+	// renamed over it; a shared memory object cannot be renamed, so it is
+	// unlinked and created anew. Either way existing mappings keep the old
+	// one.
+	const bool shared_memory = isSharedMemoryName(name);
+	const std::string write_name = shared_memory ? name : name + ".tmp." + std::to_string(getpid());
+	if (shared_memory && shm_unlink(name.c_str()) != 0 && errno != ENOENT)
+	{
+		std::cerr << "Could not replace shared scene " << name << ": " << std::strerror(errno) << std::endl;
+		return false;
+	}
+	int fd = openBlock(write_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+	{
+		std::cerr << "Could not create shared scene " << name << ": " << std::strerror(errno) << std::endl;
+		return false;
+	}
+	// The magic goes in last, so a reader never accepts a half written block.
+	bool written = write(fd, block.data(), block.size()) == static_cast<ssize_t>(block.size());
+	std::memcpy(header.magic, SHARED_SCENE_MAGIC, sizeof(header.magic));
+	written = written && pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+	close(fd);
+	if (written && !shared_memory)
+		written = rename(write_name.c_str(), name.c_str()) == 0;
+	if (!written)
+	{
+		std::cerr << "Could not write shared scene " << name << ": " << std::strerror(errno) << std::endl;
+		if (shared_memory)
+			shm_unlink(name.c_str());
+		else
+			unlink(write_name.c_str());
+		return false;
+	}
+
+	std::cout << "Published shared scene " << name << ": " << header.node_count << " nodes, "
+		<< header.triangle_count << " triangles, " << header.sphere_count << " spheres ("
+		<< header.size / (1024.0 * 1024.0) << " MB)" << std::endl;
+	return true;
+}
+
+std::unique_ptr<SharedScene> SharedScene::attach(const std::string& name, size_t expected_primitives,
+	uint64_t scene_key)
+{
+	ScopedStageTimer timer(Stage::Bvh);
+	int fd = openBlock(name, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		std::cerr << "Could not open shared scene " << name << ": " << std::strerror(errno) << std::endl;
+		return nullptr;
+	}
+	struct stat file_stat;
+	void* mapping = MAP_FAILED;
+	if (fstat(fd, &file_stat) == 0 && file_stat.st_size >= static_cast<off_t>(sizeof(SharedSceneHeader)))
+		mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		std::cerr << "Could not map shared scene " << name << std::endl;
+		return nullptr;
+	}
+	std::unique_ptr<SharedScene> scene(new SharedScene(mapping, file_stat.st_size));
+
+	const char* block = static_cast<const char*>(mapping);
+	const SharedSceneHeader& header = *reinterpret_cast<const SharedSceneHeader*>(block);
+	const uint64_t primitive_count = header.triangle_count + header.sphere_count;
+	if (std::memcmp(header.magic, SHARED_SCENE_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != SHARED_SCENE_VERSION
+		|| header.node_size != sizeof(FlatNode)
+		|| header.triangle_size != sizeof(TriangleData)
+		|| header.sphere_size != sizeof(SphereData)
+		|| header.size != scene->mapping_size
+		|| header.nodes_offset + header.node_count * header.node_size > header.size
+		|| header.triangles_offset + header.triangle_count * header.triangle_size > header.size
+		|| header.spheres_offset + header.sphere_count * header.sphere_size > header.size)
+	{
+		std::cerr << name << " is not a shared scene written by this build" << std::endl;
+		return nullptr;
+	}
+	if (primitive_count != expected_primitives)
+	{
+		std::cerr << "Shared scene " << name << " holds " << primitive_count
+			<< " primitives, the scene file " << expected_primitives << std::endl;
+		return nullptr;
+	}
+	if (header.scene_key != scene_key)
+	{
+		std::cerr << "Shared scene " << name << " was published from a different version of the scene file" << std::endl;
+		return nullptr;
+	}
+
+	scene->nodes = reinterpret_cast<const FlatNode*>(block + header.nodes_offset);
+	scene->node_count = header.node_count;
+	for (size_t i = 0; i < scene->node_count; i++)
+	{
+		for (int32_t child : scene->nodes[i].children)
+		{
+			if (child >= static_cast<int64_t>(header.node_count) || -1 - static_cast<int64_t>(child) >= static_cast<int64_t>(primitive_count))
+			{
+				std::cerr << "Shared scene " << name << " has a broken node " << i << std::endl;
+				return nullptr;
+			}
+		}
+	}
+
+	const TriangleData* triangle_data = reinterpret_cast<const TriangleData*>(block + header.triangles_offset);
+	scene->triangles.reserve(header.triangle_count);
+	for (size_t i = 0; i < header.triangle_count; i++)
+		scene->triangles.emplace_back(triangle_data + i);
+	const SphereData* sphere_data = reinterpret_cast<const SphereData*>(block + header.spheres_offset);
+	scene->spheres.reserve(header.sphere_count);
+	for (size_t i = 0; i < header.sphere_count; i++)
+		scene->spheres.emplace_back(sphere_data + i);
+
+	std::cout << "Attached shared scene " << name << ": " << header.node_count << " nodes, "
+		<< primitive_count << " primitives" << std::endl;
+	return scene;
+}
+
+SharedScene::SharedScene(void* mapping, size_t mapping_size)
+	: mapping(mapping), mapping_size(mapping_size)
+{
+}
+
+SharedScene::~SharedScene()
+{
+	munmap(mapping, mapping_size);
+}
+
+const Hittable& SharedScene::primitive(int32_t child) const
+{
+	size_t index = -1 - static_cast<int64_t>(child);
+	if (index < triangles.size())
+		return triangles[index];
+	return spheres[index - triangles.size()];
+}
+
+bool SharedScene::hit(const Ray& ray, Interval ray_t, HitRecord& rec) const
+{
+	return node_count > 0 && hitNode(nodes[0], ray, ray_t, rec);
+}
+
+void SharedScene::hitPacket(const RayPacket& packet, LaneMask active,
+	const Interval* ray_t, double* closest_t, HitRecord* recs,
+	LaneMask& hit_mask) const
+{
+	if (node_count > 0)
+		hitNodePacket(nodes[0], packet, active, ray_t, closest_t, recs, hit_mask);
+}
+
+AABB SharedScene::getAABB() const
+{
+	return node_count > 0 ? nodes[0].bounding_box : AABB();
+}
+
+// BvhNode::hit over flat nodes.
+bool SharedScene::hitNode(const FlatNode& node, const Ray& ray, Interval ray_t, HitRecord& rec) const
+{
+	RenderStats::local().node_tests++;
+	if (!node.bounding_box.hit(ray, ray_t)) return false;
+	HitRecord child_recs[2];
+	bool child_hits[2];
+	for (int i = 0; i < 2; i++)
+	{
+		int32_t child = node.children[i];
+		child_hits[i] = child >= 0 ? hitNode(nodes[child], ray, ray_t, child_recs[i])
+			: primitive(child).hit(ray, ray_t, child_recs[i]);
+	}
+
+	if (child_hits[0] && child_hits[1])
+	{
+		rec = child_recs[0].t < child_recs[1].t ? child_recs[0] : child_recs[1];
+		return true;
+	}
+	if (child_hits[0] || child_hits[1])
+	{
+		rec = child_hits[0] ? child_recs[0] : child_recs[1];
+		return true;
+	}
+	return false;
+}
+
+// BvhNode::hitPacket over flat nodes.
+void SharedScene::hitNodePacket(const FlatNode& node, const RayPacket& packet, LaneMask active,
+	const Interval* ray_t, double* closest_t, HitRecord* recs,
+	LaneMask& hit_mask) const
+{
+	RenderStats::local().node_tests += activeLaneCount(active);
+	active = node.bounding_box.hitPacket(packet, active, ray_t, closest_t);
+	if (!active) return;
+
+	for (int32_t child : node.children)
+	{
+		if (child >= 0)
+			hitNodePacket(nodes[child], packet, active, ray_t, closest_t, recs, hit_mask);
+		else
+			primitive(child).hitPacket(packet, active, ray_t, closest_t, recs, hit_mask);
+	}
+}
+
+bool SharedScene::TriangleView::hit(const Ray& ray, Interval ray_t, HitRecord& rec) const
+{
+	return Triangle::intersect(*data, this, ray, ray_t, rec);
+}
+
+void SharedScene::TriangleView::hitPacket(const RayPacket& packet, LaneMask active,
+	const Interval* ray_t, double* closest_t, HitRecord* recs,
+	LaneMask& hit_mask) const
+{
+	Triangle::intersectPacket(*data, this, packet, active, ray_t, closest_t, recs, hit_mask);
+}
+
+bool SharedScene::SphereView::hit(const Ray& ray, Interval ray_t, HitRecord& rec) const
+{
+	return Sphere::intersect(*data, this, ray, ray_t, rec);
+}
+
+AABB SharedScene::SphereView::getAABB() const
+{
+	const double radius = data->radius;
+	return AABB(data->center - Vec3(radius, radius, radius), data->center + Vec3(radius, radius, radius));
+}
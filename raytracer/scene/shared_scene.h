@@ -0,0 +1,95 @@
+#ifndef SHARED_SCENE_H
+#define SHARED_SCENE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../include/bvh.h"
+#include "../objects/triangle.h"
+#include "../objects/sphere.h"
+
+// A built scene's primitives and BVH flattened into one position
+// independent block and published under a name: "/name" is a POSIX shared
+// memory object (see /dev/shm), any other path a plain file. Renderers of
+// the same scene on one host map it read-only instead of building their
+// own primitives and BVH, so the geometry is resident once however many
+// processes run. The block stays until the object or file is removed.
+// Republishing replaces it with a new object or file, so renderers that
+// still map the old one keep reading it unchanged.
+
+// Writes world, built from Triangles and Spheres, to name, tagged with
+// scene_key (LoadedScene::geometry_key) so stale blocks can be told apart.
+// Prints the reason and returns false on failure.
+bool publishSharedScene(const BvhNode& world, const std::string& name, uint64_t scene_key);
+
+// BVH over a mapped block. Traversal visits the same nodes in the same
+// order as BvhNode, so renders match a locally built scene exactly.
+class SharedScene : public Hittable {
+public:
+	// Maps name read-only. Prints the reason and returns null if it cannot
+	// be mapped, is not a shared scene of this build, or was published from
+	// a scene other than the one with scene_key and expected_primitives
+	// primitives.
+	static std::unique_ptr<SharedScene> attach(const std::string& name, size_t expected_primitives,
+		uint64_t scene_key);
+	~SharedScene();
+	SharedScene(const SharedScene&) = delete;
+	SharedScene& operator=(const SharedScene&) = delete;
+
+	bool hit(const Ray& ray, Interval ray_t, HitRecord& rec) const override;
+
+	void hitPacket(const RayPacket& packet, LaneMask active,
+		const Interval* ray_t, double* closest_t, HitRecord* recs,
+		LaneMask& hit_mask) const override;
+
+	AABB getAABB() const override;
+
+	// Children >= 0 are node indices, negative ones primitive -1 - child:
+	// triangles first, then spheres.
+	typedef struct FlatNode {
+		AABB bounding_box;
+		int32_t children[2];
+	}FlatNode;
+
+private:
+	// Give each mapped primitive an address and a virtual hit(), which hit
+	// records and the shadow occluder cache rely on.
+	class TriangleView : public Hittable {
+	public:
+		TriangleView(const TriangleData* data) : data(data) {}
+		bool hit(const Ray& ray, Interval ray_t, HitRecord& rec) const override;
+		void hitPacket(const RayPacket& packet, LaneMask active,
+			const Interval* ray_t, double* closest_t, HitRecord* recs,
+			LaneMask& hit_mask) const override;
+		AABB getAABB() const override { return data->bounding_box; }
+	private:
+		const TriangleData* data;
+	};
+
+	class SphereView : public Hittable {
+	public:
+		SphereView(const SphereData* data) : data(data) {}
+		bool hit(const Ray& ray, Interval ray_t, HitRecord& rec) const override;
+		AABB getAABB() const override;
+	private:
+		const SphereData* data;
+	};
+
+	SharedScene(void* mapping, size_t mapping_size);
+
+	const Hittable& primitive(int32_t child) const;
+	bool hitNode(const FlatNode& node, const Ray& ray, Interval ray_t, HitRecord& rec) const;
+	void hitNodePacket(const FlatNode& node, const RayPacket& packet, LaneMask active,
+		const Interval* ray_t, double* closest_t, HitRecord* recs,
+		LaneMask& hit_mask) const;
+
+	void* mapping;
+	size_t mapping_size;
+	const FlatNode* nodes = nullptr;
+	size_t node_count = 0;
+	std::vector<TriangleView> triangles;
+	std::vector<SphereView> spheres;
+};
+
+#endif // SHARED_SCENE_H
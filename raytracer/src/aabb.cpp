@@ -33,6 +33,14 @@ const Interval& AABB::axis(int i) const
     else return z;
 }
 
+double AABB::surfaceArea() const
+{
+    double dx = x.getLength();
+    double dy = y.getLength();
+    double dz = z.getLength();
+    return 2.0 * (dx * dy + dy * dz + dz * dx);
+}
+
 bool AABB::hit(const Ray& ray, Interval ray_t) const
 {
     for (int i = 0; i < 3; i++)
@@ -50,6 +58,46 @@ bool AABB::hit(const Ray& ray, Interval ray_t) const
     return true;
 }
 
+// Same slab test as hit(), run over every lane of the packet at once. The
+// per-lane interval is clipped to the closest hit found so far, so boxes
+// behind it are culled for the whole packet.
+LaneMask AABB::hitPacket(const RayPacket& packet, LaneMask active,
+    const Interval* ray_t, const double* closest_t) const
+{
+    double t_min[MAX_PACKET_SIZE];
+    double t_max[MAX_PACKET_SIZE];
+    for (int lane = 0; lane < packet.size; lane++)
+    {
+        t_min[lane] = ray_t[lane].min;
+        t_max[lane] = closest_t[lane] < ray_t[lane].max ? closest_t[lane] : ray_t[lane].max;
+    }
+
+    const double* origins[3] = { packet.origin_x, packet.origin_y, packet.origin_z };
+    const double* directions[3] = { packet.direction_x, packet.direction_y, packet.direction_z };
+    for (int i = 0; i < 3; i++)
+    {
+        const double slab_min = axis(i).min;
+        const double slab_max = axis(i).max;
+        for (int lane = 0; lane < packet.size; lane++)
+        {
+            double t0 = (slab_min - origins[i][lane]) / directions[i][lane];
+            double t1 = (slab_max - origins[i][lane]) / directions[i][lane];
+            double near_t = t0 > t1 ? t1 : t0;
+            double far_t = t0 > t1 ? t0 : t1;
+            t_min[lane] = t_min[lane] < near_t ? near_t : t_min[lane];
+            t_max[lane] = t_max[lane] > far_t ? far_t : t_max[lane];
+        }
+    }
+
+    LaneMask result = 0;
+    for (int lane = 0; lane < packet.size; lane++)
+    {
+        if (t_max[lane] > t_min[lane])
+            result |= LaneMask(1) << lane;
+    }
+    return result & active;
+}
+
 const Interval& AABB::operator[](int axis) const
 {
     switch (axis) {
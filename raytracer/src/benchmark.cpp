@@ -0,0 +1,184 @@
+#include "benchmark.h"
+#include "../include/render_stats.h"
+#include "../external/json.hpp"
+#include "../scene/loaded_scene.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using json = nlohmann::json;
+
+// Slowdowns smaller than this are timer noise, whatever the percentage.
+constexpr double MIN_REGRESSION_SECONDS = 0.01;
+
+typedef struct BenchmarkResult {
+  std::string scene;
+  double parse_seconds = 0.0;
+  double build_seconds = 0.0; // vertex normals and BVH
+  double render_seconds = 0.0;
+  long long rays = 0;
+}BenchmarkResult;
+
+static bool readManifest(const std::string& manifest_path, OUT std::vector<std::string>& scenes)
+{
+  std::ifstream manifest(manifest_path);
+  if (!manifest.is_open())
+  {
+    std::cerr << "Could not open benchmark manifest: " << manifest_path << std::endl;
+    return false;
+  }
+
+  const std::filesystem::path base_dir = std::filesystem::path(manifest_path).parent_path();
+  std::string line;
+  while (std::getline(manifest, line))
+  {
+    line = line.substr(0, line.find('#'));
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos) continue;
+    size_t last = line.find_last_not_of(" \t\r");
+    scenes.push_back((base_dir / line.substr(first, last - first + 1)).string());
+  }
+  return true;
+}
+
+static BenchmarkResult benchmarkScene(const std::string& scene_filename, const RendererInfo& options)
+{
+  BenchmarkResult result;
+  result.scene = std::filesystem::path(scene_filename).filename().string();
+
+  RenderStats::reset();
+  LoadedScene loaded_scene(scene_filename, options);
+  for (const Camera& cam : loaded_scene.scene.cameras)
+  {
+    std::vector<std::vector<Color>> image;
+    cam.render(loaded_scene.ray_tracer, image);
+  }
+
+  result.parse_seconds = RenderStats::stageSeconds(Stage::Parse);
+  result.build_seconds = RenderStats::stageSeconds(Stage::Normals) + RenderStats::stageSeconds(Stage::Bvh);
+  result.render_seconds = RenderStats::stageSeconds(Stage::Render);
+  result.rays = RenderStats::totals().totalRays();
+  return result;
+}
+
+static json resultJson(const BenchmarkResult& result)
+{
+  return {
+    {"parse_seconds", result.parse_seconds},
+    {"build_seconds", result.build_seconds},
+    {"render_seconds", result.render_seconds},
+    {"rays", result.rays},
+    {"rays_per_second", result.render_seconds > 0.0 ? result.rays / result.render_seconds : 0.0}
+  };
+}
+
+// Prints one line per regressed measurement and returns how many there were.
+static int compareWithBaseline(const json& report, const json& baseline, double threshold)
+{
+  static const char* timings[] = {"parse_seconds", "build_seconds", "render_seconds"};
+  int regressions = 0;
+  for (const auto& [scene, current] : report["scenes"].items())
+  {
+    if (!baseline["scenes"].contains(scene))
+    {
+      std::cout << "  " << scene << ": not in baseline" << std::endl;
+      continue;
+    }
+    const json& previous = baseline["scenes"][scene];
+    for (const char* timing : timings)
+    {
+      if (!previous.contains(timing)) continue;
+      double before = previous[timing].get<double>();
+      double now = current[timing].get<double>();
+      if (now > before * (1.0 + threshold) && now - before > MIN_REGRESSION_SECONDS)
+      {
+        std::cout << "  REGRESSION " << scene << " " << timing << ": "
+          << before << "s -> " << now << "s (+"
+          << (before > 0.0 ? 100.0 * (now - before) / before : 0.0) << "%)" << std::endl;
+        regressions++;
+      }
+    }
+  }
+  return regressions;
+}
+
+bool runBenchmark(const BenchmarkOptions& bench_options, const RendererInfo& options)
+{
+  std::vector<std::string> scenes;
+  if (!readManifest(bench_options.manifest_path, scenes))
+    return false;
+
+  json report;
+  report["threshold"] = bench_options.threshold;
+  report["scenes"] = json::object();
+
+  // Scene loading and rendering chatter would bury the table.
+  std::streambuf* console = std::cout.rdbuf();
+  std::ostringstream discarded;
+  std::vector<BenchmarkResult> results;
+  for (const std::string& scene_filename : scenes)
+  {
+    if (!std::filesystem::exists(scene_filename))
+    {
+      std::cerr << "Benchmark scene not found: " << scene_filename << std::endl;
+      return false;
+    }
+    std::cout.rdbuf(discarded.rdbuf());
+    BenchmarkResult result = benchmarkScene(scene_filename, options);
+    std::cout.rdbuf(console);
+    discarded.str("");
+
+    std::cout << std::left << std::setw(28) << result.scene << std::right << std::fixed
+      << std::setprecision(3)
+      << " parse " << std::setw(8) << result.parse_seconds << "s"
+      << "  build " << std::setw(8) << result.build_seconds << "s"
+      << "  render " << std::setw(8) << result.render_seconds << "s"
+      << "  " << std::setprecision(0) << std::setw(10)
+      << (result.render_seconds > 0.0 ? result.rays / result.render_seconds : 0.0)
+      << " rays/s" << std::defaultfloat << std::setprecision(6) << std::endl;
+    report["scenes"][result.scene] = resultJson(result);
+  }
+
+  std::ofstream report_file(bench_options.report_path);
+  if (!report_file.is_open())
+  {
+    std::cerr << "Could not write benchmark report: " << bench_options.report_path << std::endl;
+    return false;
+  }
+  report_file << report.dump(2) << std::endl;
+  std::cout << "Benchmark report written to " << bench_options.report_path << std::endl;
+
+  if (bench_options.baseline_path.empty())
+    return true;
+  std::ifstream baseline_file(bench_options.baseline_path);
+  if (!baseline_file.is_open())
+  {
+    std::cout << "No baseline at " << bench_options.baseline_path
+      << ", skipping the regression check" << std::endl;
+    return true;
+  }
+  json baseline;
+  try
+  {
+    baseline_file >> baseline;
+  }
+  catch (const json::parse_error& e)
+  {
+    std::cerr << "Could not parse benchmark baseline: " << e.what() << std::endl;
+    return false;
+  }
+
+  std::cout << "Comparing with " << bench_options.baseline_path << " (threshold "
+    << 100.0 * bench_options.threshold << "%)" << std::endl;
+  int regressions = compareWithBaseline(report, baseline, bench_options.threshold);
+  if (regressions > 0)
+  {
+    std::cout << regressions << " regression(s) found" << std::endl;
+    return false;
+  }
+  std::cout << "No regressions" << std::endl;
+  return true;
+}
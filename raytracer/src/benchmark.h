@@ -0,0 +1,21 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include "../render/rendering_technique.h"
+
+typedef struct BenchmarkOptions {
+  std::string manifest_path;
+  std::string report_path = "bench/report.json";
+  std::string baseline_path = "bench/baseline.json";
+  double threshold = 0.10; // allowed slowdown over the baseline, as a fraction
+}BenchmarkOptions;
+
+// Renders every scene listed in the manifest (one path per line, relative to
+// the manifest, '#' starts a comment) without writing images, records parse,
+// build and render wall times and rays per second to a JSON report and
+// compares it against the baseline report. Returns false if a scene fails to
+// render or any time regressed past the threshold.
+bool runBenchmark(const BenchmarkOptions& bench_options, const RendererInfo& options);
+
+#endif // BENCHMARK_H
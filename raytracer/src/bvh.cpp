@@ -1,4 +1,8 @@
 #include "../include/bvh.h"
+#include "../include/sbvh.h"
+#include "../include/early_split.h"
+
+#include <thread>
 
 BvhNode::BvhNode() {}
 
@@ -32,8 +36,14 @@ BvhNode::BvhNode(std::vector<std::shared_ptr<Hittable>>& objects, int begin, int
   bounding_box = AABB(left->getAABB(), right->getAABB());
 }
 
+BvhNode::BvhNode(std::shared_ptr<Hittable> left, std::shared_ptr<Hittable> right, const AABB& bounding_box)
+  : left(left), right(right), bounding_box(bounding_box)
+{
+}
+
 bool BvhNode::hit(const Ray& ray, Interval ray_t, HitRecord& rec) const
 {
+  RenderStats::local().node_tests++;
   if (!bounding_box.hit(ray, ray_t)) return false;
   HitRecord rec1, rec2;
 
@@ -66,5 +76,95 @@ bool BvhNode::hit(const Ray& ray, Interval ray_t, HitRecord& rec) const
   return false;
 }
 
+// The whole packet descends the tree together; lanes that miss a node's box
+// drop out of the active mask for that subtree, and the subtree is skipped
+// once no lane is left.
+void BvhNode::hitPacket(const RayPacket& packet, LaneMask active,
+  const Interval* ray_t, double* closest_t, HitRecord* recs,
+  LaneMask& hit_mask) const
+{
+  RenderStats::local().node_tests += activeLaneCount(active);
+  active = bounding_box.hitPacket(packet, active, ray_t, closest_t);
+  if (!active) return;
+
+  left->hitPacket(packet, active, ray_t, closest_t, recs, hit_mask);
+  right->hitPacket(packet, active, ray_t, closest_t, recs, hit_mask);
+}
+
 AABB BvhNode::getAABB() const { return bounding_box; }
 
+void BvhNode::refit(int thread_count)
+{
+  BvhNode* left_node = dynamic_cast<BvhNode*>(left.get());
+  BvhNode* right_node = right != left ? dynamic_cast<BvhNode*>(right.get()) : nullptr;
+  if (thread_count > 1 && left_node && right_node)
+  {
+    std::thread left_thread([left_node, thread_count]() { left_node->refit(thread_count / 2); });
+    right_node->refit(thread_count - thread_count / 2);
+    left_thread.join();
+  }
+  else
+  {
+    if (left_node) left_node->refit(thread_count);
+    if (right_node) right_node->refit(thread_count);
+  }
+  bounding_box = AABB(left->getAABB(), right->getAABB());
+}
+
+double BvhNode::traversalCost() const
+{
+  double area = bounding_box.surfaceArea();
+  return area > 0.0 ? summedArea() / area : 0.0;
+}
+
+double BvhNode::summedArea() const
+{
+  double area = bounding_box.surfaceArea();
+  if (const BvhNode* node = dynamic_cast<const BvhNode*>(left.get()))
+    area += node->summedArea();
+  if (right != left)
+  {
+    if (const BvhNode* node = dynamic_cast<const BvhNode*>(right.get()))
+      area += node->summedArea();
+  }
+  return area;
+}
+
+void BvhNode::countNodes(long long& nodes, long long& references) const
+{
+  nodes++;
+  const Hittable* children[2] = { left.get(), right != left ? right.get() : nullptr };
+  for (const Hittable* child : children)
+  {
+    if (!child) continue;
+    if (const BvhNode* node = dynamic_cast<const BvhNode*>(child))
+      node->countNodes(nodes, references);
+    else
+      references++;
+  }
+}
+
+BvhNode buildBvh(std::vector<std::shared_ptr<Hittable>>& objects, BvhBuilder builder,
+  double duplication_budget, double early_split_budget)
+{
+  std::vector<std::shared_ptr<Hittable>> fragments;
+  if (early_split_budget > 0.0)
+  {
+    TraceSpan span("early split", "build");
+    fragments = splitLargeTriangles(objects, early_split_budget);
+  }
+  std::vector<std::shared_ptr<Hittable>>& references = fragments.empty() ? objects : fragments;
+
+  BvhNode world = builder == BvhBuilder::Spatial
+    ? buildSpatialBvh(references, duplication_budget)
+    : BvhNode(references, 0, static_cast<int>(references.size() - 1));
+
+  BvhStats stats;
+  stats.builder = builder == BvhBuilder::Spatial ? "spatial" : "median";
+  stats.primitives = static_cast<long long>(objects.size());
+  world.countNodes(stats.nodes, stats.references);
+  stats.traversal_cost = world.traversalCost();
+  stats.node_bytes = stats.nodes * static_cast<long long>(sizeof(BvhNode));
+  RenderStats::setBvhStats(stats);
+  return world;
+}
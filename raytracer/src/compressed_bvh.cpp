@@ -0,0 +1,354 @@
+#include "../include/compressed_bvh.h"
+
+#include <bit>
+#include <cmath>
+#include <limits>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSE2__)
+
+// A ray as the slab test takes it: origin and reciprocal direction per
+// axis, each broadcast to both halves of an SSE2 register. Worked out once
+// per ray instead of dividing at every node.
+typedef struct RaySlabs {
+	__m128d origin[3];
+	__m128d inverse_direction[3];
+}RaySlabs;
+
+static RaySlabs makeRaySlabs(const Vec3& origin, const Vec3& direction)
+{
+	RaySlabs slabs;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		slabs.origin[axis] = _mm_set1_pd(origin[axis]);
+		slabs.inverse_direction[axis] = _mm_set1_pd(1.0 / direction[axis]);
+	}
+	return slabs;
+}
+
+// Widens the 8 offsets at bytes to doubles, two children per register.
+static void decodeOffsets(const uint8_t* bytes, __m128d offsets[COMPRESSED_BVH_WIDTH / 2])
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i words = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bytes)), zero);
+	const __m128i low = _mm_unpacklo_epi16(words, zero);
+	const __m128i high = _mm_unpackhi_epi16(words, zero);
+	offsets[0] = _mm_cvtepi32_pd(low);
+	offsets[1] = _mm_cvtepi32_pd(_mm_shuffle_epi32(low, 0x0E));
+	offsets[2] = _mm_cvtepi32_pd(high);
+	offsets[3] = _mm_cvtepi32_pd(_mm_shuffle_epi32(high, 0x0E));
+}
+
+// AABB::hit against every child of node, two children per SSE2 register.
+// Boxes are decoded on the fly; min and max take their operands in the
+// order that keeps AABB::hit's handling of NaN (a zero direction component
+// through a slab plane), where the axis does not narrow the interval.
+static uint32_t hitChildren(const CompressedBvh::QuantizedNode& node, const RaySlabs& ray,
+	double t_min, double t_max)
+{
+	constexpr int PAIRS = COMPRESSED_BVH_WIDTH / 2;
+	__m128d near_t[PAIRS];
+	__m128d far_t[PAIRS];
+	for (int p = 0; p < PAIRS; p++)
+	{
+		near_t[p] = _mm_set1_pd(t_min);
+		far_t[p] = _mm_set1_pd(t_max);
+	}
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const __m128d origin = _mm_set1_pd(node.origin[axis]);
+		const __m128d scale = _mm_set1_pd(std::ldexp(1.0, node.exponent[axis]));
+		__m128d child_min[PAIRS], child_max[PAIRS];
+		decodeOffsets(node.child_min[axis], child_min);
+		decodeOffsets(node.child_max[axis], child_max);
+		for (int p = 0; p < PAIRS; p++)
+		{
+			__m128d box_min = _mm_add_pd(origin, _mm_mul_pd(child_min[p], scale));
+			__m128d box_max = _mm_add_pd(origin, _mm_mul_pd(child_max[p], scale));
+			__m128d t0 = _mm_mul_pd(_mm_sub_pd(box_min, ray.origin[axis]), ray.inverse_direction[axis]);
+			__m128d t1 = _mm_mul_pd(_mm_sub_pd(box_max, ray.origin[axis]), ray.inverse_direction[axis]);
+			near_t[p] = _mm_max_pd(_mm_min_pd(t1, t0), near_t[p]);
+			far_t[p] = _mm_min_pd(_mm_max_pd(t0, t1), far_t[p]);
+		}
+	}
+
+	uint32_t mask = 0;
+	for (int p = 0; p < PAIRS; p++)
+		mask |= static_cast<uint32_t>(_mm_movemask_pd(_mm_cmpgt_pd(far_t[p], near_t[p]))) << (2 * p);
+	return mask & ((1u << node.child_count) - 1);
+}
+
+#else
+
+// A ray as the slab test takes it: origin and reciprocal direction per
+// axis, worked out once per ray instead of dividing at every node.
+typedef struct RaySlabs {
+	double origin[3];
+	double inverse_direction[3];
+}RaySlabs;
+
+static RaySlabs makeRaySlabs(const Vec3& origin, const Vec3& direction)
+{
+	RaySlabs slabs;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		slabs.origin[axis] = origin[axis];
+		slabs.inverse_direction[axis] = 1.0 / direction[axis];
+	}
+	return slabs;
+}
+
+// The SSE2 version's decode and slab test as plain loops, for targets
+// without it; the comparisons are the same, so are the results.
+static uint32_t hitChildren(const CompressedBvh::QuantizedNode& node, const RaySlabs& ray,
+	double t_min, double t_max)
+{
+	double near_t[COMPRESSED_BVH_WIDTH];
+	double far_t[COMPRESSED_BVH_WIDTH];
+	for (int k = 0; k < COMPRESSED_BVH_WIDTH; k++)
+	{
+		near_t[k] = t_min;
+		far_t[k] = t_max;
+	}
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const double origin = node.origin[axis];
+		const double scale = std::ldexp(1.0, node.exponent[axis]);
+		for (int k = 0; k < COMPRESSED_BVH_WIDTH; k++)
+		{
+			double box_min = origin + node.child_min[axis][k] * scale;
+			double box_max = origin + node.child_max[axis][k] * scale;
+			double t0 = (box_min - ray.origin[axis]) * ray.inverse_direction[axis];
+			double t1 = (box_max - ray.origin[axis]) * ray.inverse_direction[axis];
+			double near = t0 > t1 ? t1 : t0;
+			double far = t0 > t1 ? t0 : t1;
+			near_t[k] = near_t[k] < near ? near : near_t[k];
+			far_t[k] = far_t[k] > far ? far : far_t[k];
+		}
+	}
+
+	uint32_t mask = 0;
+	for (int k = 0; k < node.child_count; k++)
+	{
+		if (far_t[k] > near_t[k])
+			mask |= 1u << k;
+	}
+	return mask;
+}
+
+#endif
+
+CompressedBvh::CompressedBvh(const BvhNode& world)
+	: bounding_box(world.getAABB())
+{
+	if (!world.leftChild())
+		return;
+	nodes.emplace_back();
+	addNode(world, 0);
+}
+
+size_t CompressedBvh::byteSize() const
+{
+	return nodes.size() * sizeof(QuantizedNode) + primitives.size() * sizeof(const Hittable*);
+}
+
+int32_t CompressedBvh::childEntry(const QuantizedNode& node, int k)
+{
+	int inner_before = std::popcount(static_cast<unsigned>(node.inner_mask & ((1u << k) - 1)));
+	if (node.inner_mask & (1u << k))
+		return node.first_node + inner_before;
+	return -1 - (node.first_primitive + k - inner_before);
+}
+
+void CompressedBvh::addNode(const BvhNode& node, int32_t index)
+{
+	// Open the largest inner node among the children until the node is
+	// full, keeping the depth first order.
+	std::vector<const Hittable*> children = { node.leftChild() };
+	if (node.rightChild() != node.leftChild())
+		children.push_back(node.rightChild());
+	while (children.size() < COMPRESSED_BVH_WIDTH)
+	{
+		int largest = -1;
+		double largest_area = -1.0;
+		for (size_t k = 0; k < children.size(); k++)
+		{
+			const BvhNode* child = dynamic_cast<const BvhNode*>(children[k]);
+			if (child && child->getAABB().surfaceArea() > largest_area)
+			{
+				largest = static_cast<int>(k);
+				largest_area = child->getAABB().surfaceArea();
+			}
+		}
+		if (largest < 0) break;
+		const BvhNode* opened = static_cast<const BvhNode*>(children[largest]);
+		children[largest] = opened->leftChild();
+		if (opened->rightChild() != opened->leftChild())
+			children.insert(children.begin() + largest + 1, opened->rightChild());
+	}
+
+	QuantizedNode quantized{};
+
+	// Offsets count steps of 2^exponent up from origin, which is the node's
+	// box rounded down to a float; children are rounded outwards and
+	// clipped to the node's box, which already bounds every part of them a
+	// ray can reach here.
+	const AABB frame = node.getAABB();
+	double scales[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float origin = static_cast<float>(frame[axis].min);
+		if (origin > frame[axis].min)
+			origin = std::nextafter(origin, std::numeric_limits<float>::lowest());
+		double extent = frame[axis].max - origin;
+		int exponent = extent > 0.0 ? static_cast<int>(std::ceil(std::log2(extent / 255.0))) : -64;
+		while (std::ldexp(255.0, exponent) < extent)
+			exponent++;
+		exponent = std::max(exponent, -128);
+		quantized.origin[axis] = origin;
+		quantized.exponent[axis] = static_cast<int8_t>(exponent);
+		scales[axis] = std::ldexp(1.0, exponent);
+	}
+
+	int child_count = 0;
+	std::vector<const BvhNode*> inner_children;
+	quantized.first_primitive = static_cast<int32_t>(primitives.size());
+	for (const Hittable* child : children)
+	{
+		const AABB box = child->getAABB();
+		uint8_t child_min[3], child_max[3];
+		bool empty = false;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			double low = std::floor((box[axis].min - quantized.origin[axis]) / scales[axis]);
+			double high = std::ceil((box[axis].max - quantized.origin[axis]) / scales[axis]);
+			low = std::max(low, 0.0);
+			high = std::min(high, 255.0);
+			empty = empty || low > high;
+			child_min[axis] = static_cast<uint8_t>(low);
+			child_max[axis] = static_cast<uint8_t>(high);
+		}
+		// Empty or outside the node: no ray reaches it through here.
+		if (empty) continue;
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			quantized.child_min[axis][child_count] = child_min[axis];
+			quantized.child_max[axis][child_count] = child_max[axis];
+		}
+		if (const BvhNode* inner = dynamic_cast<const BvhNode*>(child))
+		{
+			quantized.inner_mask |= 1u << child_count;
+			inner_children.push_back(inner);
+		}
+		else
+		{
+			primitives.push_back(child);
+		}
+		child_count++;
+	}
+	quantized.child_count = static_cast<uint8_t>(child_count);
+	quantized.first_node = static_cast<int32_t>(nodes.size());
+	nodes[index] = quantized;
+
+	nodes.resize(nodes.size() + inner_children.size());
+	for (size_t j = 0; j < inner_children.size(); j++)
+		addNode(*inner_children[j], quantized.first_node + static_cast<int32_t>(j));
+}
+
+// Depth first, like BvhNode::hit: children are pushed in reverse so they
+// pop in order, and a hit as close as the best so far replaces it.
+bool CompressedBvh::hit(const Ray& ray, Interval ray_t, HitRecord& rec) const
+{
+	RenderCounters& counters = RenderStats::local();
+	counters.node_tests++;
+	if (nodes.empty() || !bounding_box.hit(ray, ray_t)) return false;
+
+	thread_local std::vector<int32_t> stack;
+	stack.clear();
+	stack.push_back(0);
+	bool hit_anything = false;
+	const RaySlabs slabs = makeRaySlabs(ray.origin, ray.direction);
+	while (!stack.empty())
+	{
+		int32_t entry = stack.back();
+		stack.pop_back();
+		if (entry < 0)
+		{
+			HitRecord temp_rec;
+			if (primitives[-1 - entry]->hit(ray, ray_t, temp_rec) && (!hit_anything || temp_rec.t <= rec.t))
+			{
+				rec = temp_rec;
+				hit_anything = true;
+			}
+			continue;
+		}
+
+		const QuantizedNode& node = nodes[entry];
+		counters.node_tests += node.child_count;
+		uint32_t mask = hitChildren(node, slabs, ray_t.min, ray_t.max);
+		for (int k = node.child_count - 1; k >= 0; k--)
+		{
+			if (mask & (1u << k))
+				stack.push_back(childEntry(node, k));
+		}
+	}
+	return hit_anything;
+}
+
+// BvhNode::hitPacket's descent, one slab test per active lane per node.
+// Lanes are culled against their closest hit when a node is opened.
+void CompressedBvh::hitPacket(const RayPacket& packet, LaneMask active,
+	const Interval* ray_t, double* closest_t, HitRecord* recs,
+	LaneMask& hit_mask) const
+{
+	RenderCounters& counters = RenderStats::local();
+	counters.node_tests += activeLaneCount(active);
+	if (nodes.empty()) return;
+	active = bounding_box.hitPacket(packet, active, ray_t, closest_t);
+	if (!active) return;
+
+	thread_local std::vector<std::pair<int32_t, LaneMask>> stack;
+	stack.clear();
+	stack.push_back(std::make_pair(0, active));
+	RaySlabs slabs[MAX_PACKET_SIZE];
+	for (int lane = 0; lane < packet.size; lane++)
+	{
+		if (!laneActive(active, lane)) continue;
+		slabs[lane] = makeRaySlabs(Vec3(packet.origin_x[lane], packet.origin_y[lane], packet.origin_z[lane]),
+			Vec3(packet.direction_x[lane], packet.direction_y[lane], packet.direction_z[lane]));
+	}
+	while (!stack.empty())
+	{
+		const int32_t entry = stack.back().first;
+		const LaneMask lanes = stack.back().second;
+		stack.pop_back();
+		if (entry < 0)
+		{
+			primitives[-1 - entry]->hitPacket(packet, lanes, ray_t, closest_t, recs, hit_mask);
+			continue;
+		}
+
+		const QuantizedNode& node = nodes[entry];
+		counters.node_tests += static_cast<long long>(activeLaneCount(lanes)) * node.child_count;
+		LaneMask child_lanes[COMPRESSED_BVH_WIDTH] = {};
+		for (int lane = 0; lane < packet.size; lane++)
+		{
+			if (!laneActive(lanes, lane)) continue;
+			double t_max = closest_t[lane] < ray_t[lane].max ? closest_t[lane] : ray_t[lane].max;
+			uint32_t mask = hitChildren(node, slabs[lane], ray_t[lane].min, t_max);
+			for (int k = 0; k < node.child_count; k++)
+			{
+				if (mask & (1u << k))
+					child_lanes[k] |= LaneMask(1) << lane;
+			}
+		}
+		for (int k = node.child_count - 1; k >= 0; k--)
+		{
+			if (child_lanes[k])
+				stack.push_back(std::make_pair(childEntry(node, k), child_lanes[k]));
+		}
+	}
+}
@@ -0,0 +1,145 @@
+#include "../include/early_split.h"
+#include "../objects/triangle_fragment.h"
+
+#include <queue>
+
+// A piece is worth splitting while its box's surface area is more than this
+// multiple of a flat box fitting it exactly, i.e. twice its own area.
+constexpr double EARLY_SPLIT_MIN_RATIO = 1.5;
+
+// A convex part of one triangle, with its corners as barycentric weights and
+// in world space.
+typedef struct Piece {
+	int object;
+	std::vector<Vec3> weights;
+	std::vector<Vec3> corners;
+	AABB box;
+	double area = 0.0;
+	bool split = false;
+
+	// Box area a ray can enter without hitting the piece, roughly.
+	double emptyArea() const { return box.surfaceArea() * 0.5 - area; }
+
+	bool worthSplitting() const
+	{
+		return area > 0.0 && box.surfaceArea() > EARLY_SPLIT_MIN_RATIO * 2.0 * area;
+	}
+}Piece;
+
+static Piece makePiece(int object, std::vector<Vec3> weights, std::vector<Vec3> corners)
+{
+	Piece piece;
+	piece.object = object;
+	Vec3 low(INFINITY), high(-INFINITY);
+	for (const Vec3& corner : corners)
+	{
+		low = Vec3(std::min(low.x, corner.x), std::min(low.y, corner.y), std::min(low.z, corner.z));
+		high = Vec3(std::max(high.x, corner.x), std::max(high.y, corner.y), std::max(high.z, corner.z));
+	}
+	piece.box = AABB(low, high);
+	Vec3 doubled_area;
+	for (size_t i = 1; i + 1 < corners.size(); i++)
+		doubled_area = doubled_area + (corners[i] - corners[0]).cross(corners[i + 1] - corners[0]);
+	piece.area = doubled_area.length() * 0.5;
+	piece.weights = std::move(weights);
+	piece.corners = std::move(corners);
+	return piece;
+}
+
+// Clips piece against the plane at position on axis. Returns false when
+// one side would be degenerate.
+static bool splitPiece(const Piece& piece, int axis, double position, Piece& left, Piece& right)
+{
+	std::vector<Vec3> left_weights, left_corners, right_weights, right_corners;
+	const size_t n = piece.corners.size();
+	for (size_t i = 0; i < n; i++)
+	{
+		const Vec3& from = piece.corners[i];
+		const Vec3& to = piece.corners[(i + 1) % n];
+		if (from[axis] <= position)
+		{
+			left_weights.push_back(piece.weights[i]);
+			left_corners.push_back(from);
+		}
+		if (from[axis] >= position)
+		{
+			right_weights.push_back(piece.weights[i]);
+			right_corners.push_back(from);
+		}
+		if ((from[axis] < position && to[axis] > position) || (from[axis] > position && to[axis] < position))
+		{
+			double t = (position - from[axis]) / (to[axis] - from[axis]);
+			Vec3 weight = piece.weights[i] + (piece.weights[(i + 1) % n] - piece.weights[i]) * t;
+			Vec3 corner = from + (to - from) * t;
+			left_weights.push_back(weight);
+			left_corners.push_back(corner);
+			right_weights.push_back(weight);
+			right_corners.push_back(corner);
+		}
+	}
+	if (left_corners.size() < 3 || right_corners.size() < 3)
+		return false;
+	left = makePiece(piece.object, std::move(left_weights), std::move(left_corners));
+	right = makePiece(piece.object, std::move(right_weights), std::move(right_corners));
+	return left.area > 0.0 && right.area > 0.0;
+}
+
+std::vector<std::shared_ptr<Hittable>> splitLargeTriangles(
+	const std::vector<std::shared_ptr<Hittable>>& objects, double budget)
+{
+	std::vector<Piece> pieces;
+	std::priority_queue<std::pair<double, int>> worst; // (empty area, piece)
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		const Triangle* triangle = dynamic_cast<const Triangle*>(objects[i].get());
+		if (!triangle) continue;
+		const TriangleData& data = triangle->getData();
+		pieces.push_back(makePiece(static_cast<int>(i),
+			{ Vec3(1.0, 0.0, 0.0), Vec3(0.0, 1.0, 0.0), Vec3(0.0, 0.0, 1.0) },
+			{ data.indices[0], data.indices[1], data.indices[2] }));
+		if (pieces.back().worthSplitting())
+			worst.push(std::make_pair(pieces.back().emptyArea(), static_cast<int>(pieces.size() - 1)));
+	}
+
+	long long splits_left = static_cast<long long>(budget * objects.size());
+	std::vector<bool> split_objects(objects.size(), false);
+	while (splits_left > 0 && !worst.empty())
+	{
+		int index = worst.top().second;
+		worst.pop();
+
+		const AABB& box = pieces[index].box;
+		int axis = 0;
+		for (int i = 1; i < 3; i++)
+		{
+			if (box[i].getLength() > box[axis].getLength()) axis = i;
+		}
+		Piece left, right;
+		if (!splitPiece(pieces[index], axis, (box[axis].min + box[axis].max) * 0.5, left, right))
+			continue;
+
+		pieces[index].split = true;
+		split_objects[pieces[index].object] = true;
+		splits_left--;
+		for (Piece* piece : { &left, &right })
+		{
+			pieces.push_back(std::move(*piece));
+			if (pieces.back().worthSplitting())
+				worst.push(std::make_pair(pieces.back().emptyArea(), static_cast<int>(pieces.size() - 1)));
+		}
+	}
+
+	std::vector<std::shared_ptr<Hittable>> references;
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		if (!split_objects[i])
+			references.push_back(objects[i]);
+	}
+	for (Piece& piece : pieces)
+	{
+		if (piece.split || !split_objects[piece.object]) continue;
+		references.push_back(std::make_shared<TriangleFragment>(
+			std::static_pointer_cast<Triangle>(objects[piece.object]), std::move(piece.weights)));
+	}
+	return references;
+}
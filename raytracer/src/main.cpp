@@ -1,156 +1,413 @@
 #include <iostream>
 #include "../include/parser.hpp"
-#include "../render/render_manager.h"
-#include "../render/base_ray_tracer.h"
-#include "../material/material_manager.h"
-#include "../scene/scene.h"
-#include "../objects/sphere.h"
-#include "../objects/triangle.h"
-#include "../objects/plane.h"
-
-double getAreaTriangle(Vec3 v1, Vec3 v2, Vec3 v3)
-{
-  Vec3 edge1 = v2 - v1;
-  Vec3 edge2 = v3 - v1;
-  Vec3 cross_product = edge1.cross(edge2);
-  double area = 0.5 * cross_product.length();
-  return area;
-}
+#include "../render/frame_sequence.h"
+#include "../render/render_server.h"
+#include "../render/tile_farm.h"
+#include "benchmark.h"
+#include "verify.h"
+#include "../include/trace_recorder.h"
+#include "../scene/loaded_scene.h"
+
+#include <cmath>
+#include <cstdlib>
 
 constexpr auto BACKFACE_CULLING = false;
 
-int main(int argc, char* argv[])
-{
-  // Expect exactly one argument after the executable name
-  if (argc != 2)
+// Writes the recorded trace however main returns.
+class TraceFileWriter {
+public:
+  TraceFileWriter(const std::string& path) : path(path)
   {
-    std::cerr << "Usage: " << argv[0] << " <scene_file.json>" << std::endl;
-    return 1;
+    if (!path.empty()) TraceRecorder::start();
   }
 
-  std::string scene_filename = argv[1];
-
-  //std::string scene_filename = "D:/Furkan/repos/raytracer/HelixNebula/inputs/other_dragon.json";
-
-  Scene_ raw_scene;
-  
-  std::cout << "Parsing scene file: " << scene_filename << std::endl;
-  parseScene(scene_filename, raw_scene);
-
-  //printSceneSummary(scene);
-  //printScene(raw_scene);
-
-	std::vector<Plane> planes;
-
-	std::vector<std::shared_ptr<Hittable>> world_objects;
-  for (const Sphere_& raw_sphere : raw_scene.spheres)
+  ~TraceFileWriter()
   {
-    Vec3 center = Vec3(raw_scene.vertex_data[raw_sphere.center_vertex_id]);
-    double radius = static_cast<double>(raw_sphere.radius);
-    int material_id = raw_sphere.material_id;
-		world_objects.push_back(
-      std::make_shared<Sphere>(center, radius, material_id));
+    if (!path.empty()) TraceRecorder::write(path);
   }
 
-  for(const Triangle_ & raw_triangle : raw_scene.triangles)
-  {
-    Vec3 indices[3] = { raw_scene.vertex_data[raw_triangle.v0_id], 
-      raw_scene.vertex_data[raw_triangle.v1_id], 
-      raw_scene.vertex_data[raw_triangle.v2_id]};
+private:
+  std::string path;
+};
 
-    world_objects.push_back(
-      std::make_shared<Triangle>(indices, raw_triangle.material_id));
-	}
+// Reads a finite number >= 0 taking up all of text.
+static bool parseNonNegative(const char* text, double& value)
+{
+  char* end = nullptr;
+  value = std::strtod(text, &end);
+  return end != text && *end == '\0' && std::isfinite(value) && value >= 0.0;
+}
 
+int main(int argc, char* argv[])
+{
+  std::string scene_filename;
+  int packet_size = 0;
+  Integrator integrator = Integrator::Recursive;
+  int thread_count = 0;
+  PixelOrder pixel_order = PixelOrder::Scanline;
+  double light_threshold = 0.0;
+  double light_error_bound = INFINITY;
+  bool server_stdin = false;
+  std::string server_socket;
+  std::string coordinator_socket;
+  std::string tile_worker_socket;
+  std::string publish_scene;
+  std::string attach_scene;
+  int farm_workers = 0;
+  std::string stats_json;
+  bool traversal_heatmap = false;
+  std::string gbuffer_dir;
+  int gbuffer_cache = 0;
+  std::string frames_path;
+  double bvh_rebuild_ratio = RendererInfo{}.bvh_rebuild_ratio;
+  BvhBuilder bvh_builder = BvhBuilder::Median;
+  double sbvh_budget = RendererInfo{}.sbvh_duplication_budget;
+  double early_split_budget = 0.0;
+  bool compressed_bvh = false;
+  ImageFormat image_format = ImageFormat::Png;
+  int aa_min_samples = 1;
+  int aa_max_samples = 1;
+  double aa_threshold = RendererInfo{}.aa_threshold;
+  double progressive_seconds = 0.0;
+  double progressive_noise = 0.0;
+  int progressive_max_samples = RendererInfo{}.progressive_max_samples;
+  double progressive_write_interval = RendererInfo{}.progressive_write_interval;
+  std::string trace_path;
+  BenchmarkOptions bench_options;
+  bool verify = false;
+  VerifyOptions verify_options;
 
-  for(const Mesh_& raw_mesh : raw_scene.meshes)
+  for (int i = 1; i < argc; i++)
   {
-    if (raw_mesh.smooth_shading)
+    std::string arg = argv[i];
+    if (arg == "--packet" && i + 1 < argc)
+    {
+      packet_size = std::stoi(argv[++i]);
+      if (packet_size != 4 && packet_size != 8)
+      {
+        std::cerr << "Packet size must be 4 or 8" << std::endl;
+        return 1;
+      }
+    }
+    else if (arg == "--integrator" && i + 1 < argc)
     {
-			std::vector<std::vector<std::pair<Vec3, double>>> per_vertex_triangles; // pair<triangle_normal, area> for each vertex
-      per_vertex_triangles.resize(raw_scene.vertex_data.size());
-      for(const Triangle_& raw_triangle : raw_mesh.faces)
+      std::string name = argv[++i];
+      if (name == "recursive") integrator = Integrator::Recursive;
+      else if (name == "wavefront") integrator = Integrator::Wavefront;
+      else
       {
-        Vec3 v0 = Vec3(raw_scene.vertex_data[raw_triangle.v0_id]);
-        Vec3 v1 = Vec3(raw_scene.vertex_data[raw_triangle.v1_id]);
-        Vec3 v2 = Vec3(raw_scene.vertex_data[raw_triangle.v2_id]);
-        double area = getAreaTriangle(v0, v1, v2);
-        Vec3 edge1 = v1 - v0;
-        Vec3 edge2 = v2 - v0;
-        Vec3 face_normal = edge1.cross(edge2).normalize();
-        per_vertex_triangles[raw_triangle.v0_id].push_back(std::make_pair(face_normal, area));
-        per_vertex_triangles[raw_triangle.v1_id].push_back(std::make_pair(face_normal, area));
-        per_vertex_triangles[raw_triangle.v2_id].push_back(std::make_pair(face_normal, area));
-			}
-			std::vector<Vec3> vertex_normals;
-      for (const auto& v : per_vertex_triangles)
+        std::cerr << "Unknown integrator: " << name << std::endl;
+        return 1;
+      }
+    }
+    else if (arg == "--threads" && i + 1 < argc)
+    {
+      thread_count = std::stoi(argv[++i]);
+    }
+    else if (arg == "--light-threshold" && i + 1 < argc)
+    {
+      light_threshold = std::stod(argv[++i]);
+    }
+    else if (arg == "--light-error" && i + 1 < argc)
+    {
+      light_error_bound = std::stod(argv[++i]);
+    }
+    else if (arg == "--server")
+    {
+      server_stdin = true;
+    }
+    else if (arg == "--server-socket" && i + 1 < argc)
+    {
+      server_socket = argv[++i];
+    }
+    else if (arg == "--stats-json" && i + 1 < argc)
+    {
+      stats_json = argv[++i];
+    }
+    else if (arg == "--trace" && i + 1 < argc)
+    {
+      trace_path = argv[++i];
+    }
+    else if (arg == "--aa-samples" && i + 1 < argc)
+    {
+      aa_min_samples = std::stoi(argv[++i]);
+    }
+    else if (arg == "--aa-max-samples" && i + 1 < argc)
+    {
+      aa_max_samples = std::stoi(argv[++i]);
+    }
+    else if (arg == "--aa-threshold" && i + 1 < argc)
+    {
+      aa_threshold = std::stod(argv[++i]);
+    }
+    else if (arg == "--progressive-time" && i + 1 < argc)
+    {
+      progressive_seconds = std::stod(argv[++i]);
+    }
+    else if (arg == "--progressive-noise" && i + 1 < argc)
+    {
+      progressive_noise = std::stod(argv[++i]);
+    }
+    else if (arg == "--progressive-max-samples" && i + 1 < argc)
+    {
+      progressive_max_samples = std::stoi(argv[++i]);
+    }
+    else if (arg == "--progressive-write-interval" && i + 1 < argc)
+    {
+      progressive_write_interval = std::stod(argv[++i]);
+    }
+    else if (arg == "--pixel-order" && i + 1 < argc)
+    {
+      std::string name = argv[++i];
+      if (name == "scanline") pixel_order = PixelOrder::Scanline;
+      else if (name == "morton") pixel_order = PixelOrder::Morton;
+      else if (name == "hilbert") pixel_order = PixelOrder::Hilbert;
+      else
       {
-        Vec3 normal(0.0, 0.0, 0.0);
-        double total_area = 0.0;
-        for (const auto& pair : v)
-        {
-          normal = normal + pair.first * pair.second;
-          total_area += pair.second;
-        }
-        if (total_area > 0.0)
-        {
-          normal = normal / total_area;
-          normal.normalize();
-        }
-				vertex_normals.push_back(normal);
+        std::cerr << "Unknown pixel order: " << name << std::endl;
+        return 1;
       }
-      for (const Triangle_& raw_triangle : raw_mesh.faces)
+    }
+    else if (arg == "--bvh-builder" && i + 1 < argc)
+    {
+      std::string name = argv[++i];
+      if (name == "median") bvh_builder = BvhBuilder::Median;
+      else if (name == "sbvh") bvh_builder = BvhBuilder::Spatial;
+      else
       {
-        Vec3 indices[3] = { raw_scene.vertex_data[raw_triangle.v0_id],
-          raw_scene.vertex_data[raw_triangle.v1_id],
-          raw_scene.vertex_data[raw_triangle.v2_id] };
-
-				Vec3 per_vertex_normals[3] = {
-          vertex_normals[raw_triangle.v0_id],
-          vertex_normals[raw_triangle.v1_id],
-					vertex_normals[raw_triangle.v2_id] };
-
-        world_objects.push_back(
-          std::make_shared<Triangle>(indices, raw_triangle.material_id, per_vertex_normals));
+        std::cerr << "Unknown BVH builder: " << name << std::endl;
+        return 1;
       }
     }
-    else
+    else if (arg == "--sbvh-budget" && i + 1 < argc)
     {
-      for (const Triangle_& raw_triangle : raw_mesh.faces)
+      if (!parseNonNegative(argv[++i], sbvh_budget))
       {
-        Vec3 indices[3] = { raw_scene.vertex_data[raw_triangle.v0_id],
-          raw_scene.vertex_data[raw_triangle.v1_id],
-          raw_scene.vertex_data[raw_triangle.v2_id] };
-
-        world_objects.push_back(
-          std::make_shared<Triangle>(indices, raw_triangle.material_id));
+        std::cerr << "SBVH budget must be a number >= 0: " << argv[i] << std::endl;
+        return 1;
+      }
+    }
+    else if (arg == "--compressed-bvh")
+    {
+      compressed_bvh = true;
+    }
+    else if (arg == "--early-split" && i + 1 < argc)
+    {
+      if (!parseNonNegative(argv[++i], early_split_budget))
+      {
+        std::cerr << "Early split budget must be a number >= 0: " << argv[i] << std::endl;
+        return 1;
+      }
+    }
+    else if (arg == "--coordinator" && i + 1 < argc)
+    {
+      coordinator_socket = argv[++i];
+    }
+    else if (arg == "--farm-workers" && i + 1 < argc)
+    {
+      farm_workers = std::stoi(argv[++i]);
+    }
+    else if (arg == "--tile-worker" && i + 1 < argc)
+    {
+      tile_worker_socket = argv[++i];
+    }
+    else if (arg == "--publish-scene" && i + 1 < argc)
+    {
+      publish_scene = argv[++i];
+    }
+    else if (arg == "--attach-scene" && i + 1 < argc)
+    {
+      attach_scene = argv[++i];
+    }
+    else if (arg == "--image-format" && i + 1 < argc)
+    {
+      std::string name = argv[++i];
+      if (name == "png") image_format = ImageFormat::Png;
+      else if (name == "pfm") image_format = ImageFormat::Pfm;
+      else if (name == "exr") image_format = ImageFormat::Exr;
+      else
+      {
+        std::cerr << "Unknown image format: " << name << std::endl;
+        return 1;
+      }
+    }
+    else if (arg == "--cost-heatmap")
+    {
+      traversal_heatmap = true;
+    }
+    else if (arg == "--gbuffer-dir" && i + 1 < argc)
+    {
+      gbuffer_dir = argv[++i];
+    }
+    else if (arg == "--gbuffer-cache" && i + 1 < argc)
+    {
+      gbuffer_cache = std::stoi(argv[++i]);
+    }
+    else if (arg == "--frames" && i + 1 < argc)
+    {
+      frames_path = argv[++i];
+    }
+    else if (arg == "--bvh-rebuild-ratio" && i + 1 < argc)
+    {
+      if (!parseNonNegative(argv[++i], bvh_rebuild_ratio) || bvh_rebuild_ratio < 1.0)
+      {
+        std::cerr << "BVH rebuild ratio must be a number >= 1: " << argv[i] << std::endl;
+        return 1;
       }
     }
-	}
+    else if (arg == "--bench" && i + 1 < argc)
+    {
+      bench_options.manifest_path = argv[++i];
+    }
+    else if (arg == "--bench-report" && i + 1 < argc)
+    {
+      bench_options.report_path = argv[++i];
+    }
+    else if (arg == "--bench-baseline" && i + 1 < argc)
+    {
+      bench_options.baseline_path = argv[++i];
+    }
+    else if (arg == "--bench-threshold" && i + 1 < argc)
+    {
+      bench_options.threshold = std::stod(argv[++i]);
+    }
+    else if (arg == "--verify")
+    {
+      verify = true;
+    }
+    else if (arg == "--reference-dir" && i + 1 < argc)
+    {
+      verify_options.reference_dir = argv[++i];
+    }
+    else if (arg == "--min-psnr" && i + 1 < argc)
+    {
+      verify_options.min_psnr = std::stod(argv[++i]);
+    }
+    else if (arg == "--max-error" && i + 1 < argc)
+    {
+      verify_options.max_error = std::stoi(argv[++i]);
+    }
+    else if (scene_filename.empty() && arg.rfind("--", 0) != 0)
+    {
+      scene_filename = arg;
+    }
+    else
+    {
+      scene_filename.clear();
+      break;
+    }
+  }
 
-  for(const Plane_& raw_plane : raw_scene.planes)
+  // Expect exactly one scene file after the options, unless benchmarking
+  if (scene_filename.empty() && bench_options.manifest_path.empty())
   {
-    planes.push_back(Plane(raw_plane, raw_scene.vertex_data));
-	}
+    std::cerr << "Usage: " << argv[0] << " [--packet 4|8] [--integrator recursive|wavefront]"
+      << " [--threads N] [--pixel-order scanline|morton|hilbert] [--light-threshold T] [--light-error E]"
+      << " [--aa-samples N] [--aa-max-samples M] [--aa-threshold T]"
+      << " [--progressive-time S] [--progressive-noise N] [--progressive-max-samples M]"
+      << " [--progressive-write-interval S] [--image-format png|pfm|exr] [--gbuffer-dir DIR]"
+      << " [--stats-json FILE] [--cost-heatmap] [--trace FILE] [--server | --server-socket PATH]"
+      << " [--gbuffer-cache N] [--bvh-builder median|sbvh] [--sbvh-budget F]"
+      << " [--early-split F] [--compressed-bvh] <scene_file.json>" << std::endl;
+    std::cerr << "       " << argv[0] << " --publish-scene NAME <scene_file.json>" << std::endl;
+    std::cerr << "       " << argv[0] << " [render options] --attach-scene NAME ... <scene_file.json>" << std::endl;
+    std::cerr << "       " << argv[0] << " [render options] --coordinator PATH [--farm-workers N]"
+      << " <scene_file.json>" << std::endl;
+    std::cerr << "       " << argv[0] << " [render options] --tile-worker PATH <scene_file.json>" << std::endl;
+    std::cerr << "       " << argv[0] << " [render options] --frames FILE [--bvh-rebuild-ratio R]"
+      << " <scene_file.json>" << std::endl;
+    std::cerr << "       " << argv[0] << " [render options] --verify [--reference-dir DIR]"
+      << " [--min-psnr DB] [--max-error N] <scene_file.json>" << std::endl;
+    std::cerr << "       " << argv[0] << " [render options] --bench MANIFEST"
+      << " [--bench-report FILE] [--bench-baseline FILE] [--bench-threshold FRACTION]" << std::endl;
+    return 1;
+  }
+
+  //std::string scene_filename = "D:/Furkan/repos/raytracer/HelixNebula/inputs/other_dragon.json";
+
+  RendererInfo options{};
+  options.backface_culling = BACKFACE_CULLING;
+  options.packet_size = packet_size;
+  options.integrator = integrator;
+  options.thread_count = thread_count;
+  options.pixel_order = pixel_order;
+  options.light_cull_threshold = light_threshold;
+  options.light_cull_error_bound = light_error_bound;
+  options.aa_min_samples = aa_min_samples;
+  options.aa_max_samples = aa_max_samples;
+  options.aa_threshold = aa_threshold;
+  options.progressive_seconds = progressive_seconds;
+  options.progressive_noise = progressive_noise;
+  options.progressive_max_samples = progressive_max_samples;
+  options.progressive_write_interval = progressive_write_interval;
+  options.image_format = image_format;
+  options.traversal_heatmap = traversal_heatmap;
+  options.gbuffer_dir = gbuffer_dir;
+  options.gbuffer_cache = gbuffer_cache;
+  options.bvh_rebuild_ratio = bvh_rebuild_ratio;
+  options.bvh_builder = bvh_builder;
+  options.sbvh_duplication_budget = sbvh_budget;
+  options.early_split_budget = early_split_budget;
+  options.compressed_bvh = compressed_bvh;
 
+  TraceFileWriter trace_writer(trace_path);
 
-	MaterialManager material_manager(raw_scene.materials);
+  if (!bench_options.manifest_path.empty())
+    return runBenchmark(bench_options, options) ? 0 : 1;
 
-  Scene scene(raw_scene, world_objects);
+  // In stdin server mode responses own stdout; progress messages go to stderr.
+  std::ostream responses(std::cout.rdbuf());
+  if (server_stdin)
+    std::cout.rdbuf(std::cerr.rdbuf());
 
-  RendererInfo renderer_info(raw_scene.shadow_ray_epsilon, 
-    raw_scene.intersection_test_epsilon, 
-    raw_scene.max_recursion_depth,
-    BACKFACE_CULLING);
+  LoadedScene loaded_scene(scene_filename, options, attach_scene);
+  if (!publish_scene.empty())
+    return publishSharedScene(loaded_scene.scene.world, publish_scene, loaded_scene.geometry_key) ? 0 : 1;
 
-  BaseRayTracer ray_tracer(scene.background_color, scene.light_sources, 
-    scene.world, planes, material_manager, renderer_info);
+  //printSceneSummary(loaded_scene.raw_scene);
+  //printScene(loaded_scene.raw_scene);
 
-  RenderManager renderer(scene, material_manager, renderer_info, ray_tracer);
+  if (!coordinator_socket.empty())
+  {
+    // Spawned workers get the same options, minus the ones that write
+    // files of their own.
+    std::vector<std::string> worker_args;
+    for (int i = 0; i < argc; i++)
+    {
+      std::string arg = argv[i];
+      if (i + 1 < argc && (arg == "--farm-workers" || arg == "--trace" || arg == "--stats-json"))
+        i++;
+      else if (arg == "--coordinator")
+        worker_args.push_back("--tile-worker");
+      else
+        worker_args.push_back(arg);
+    }
+    return runTileCoordinator(loaded_scene, coordinator_socket, farm_workers, worker_args) ? 0 : 1;
+  }
+  if (!tile_worker_socket.empty())
+    return runTileWorker(loaded_scene, tile_worker_socket) ? 0 : 1;
+  if (!server_socket.empty())
+  {
+    RenderServer server(loaded_scene);
+    return server.serveSocket(server_socket) ? 0 : 1;
+  }
+  if (!frames_path.empty())
+    return renderFrameSequence(loaded_scene, frames_path) ? 0 : 1;
+  if (verify)
+    return verifyScene(loaded_scene, scene_filename, verify_options) ? 0 : 1;
+  if (server_stdin)
+  {
+    RenderServer server(loaded_scene);
+    server.serveStream(std::cin, responses);
+    std::cout.rdbuf(responses.rdbuf());
+    return 0;
+  }
 
   std::cout << "Rendering will start here in the future." << std::endl;
   
-  renderer.render();
+  loaded_scene.render_manager.render();
+  if (!stats_json.empty() && !RenderStats::writeJson(stats_json))
+    return 1;
 
   return 0;
-}
\ No newline at end of file
+}
@@ -1,8 +1,11 @@
 ﻿#include "../include/parser.hpp"
 #include "../external/json.hpp"
+#include "../include/trace_recorder.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <stdexcept>
 #define M_PI 3.14159265358979323846
 
 // For convenience
@@ -59,6 +62,149 @@ Vec3f_ crossProduct(Vec3f_ a, Vec3f_ b)
   return result;
 }
 
+// Sets every camera field present in cam_json on top of cam. Scene files
+// must give all of them (required throws on a missing one); render job
+// overrides may give only a few.
+static void applyCameraJson(const json& cam_json, Camera_& cam, bool required)
+{
+  if (required)
+  {
+    std::vector<std::string> keys = { "_id", "Position", "Up", "NearDistance", "ImageResolution", "ImageName" };
+    if (cam_json.contains("GazePoint"))
+      keys.push_back("FovY");
+    else
+      keys.insert(keys.end(), { "Gaze", "NearPlane" });
+    for (const std::string& key : keys)
+    {
+      if (!cam_json.contains(key))
+        throw std::runtime_error("Camera is missing " + key);
+    }
+  }
+
+  const int old_width = cam.image_width;
+  const int old_height = cam.image_height;
+
+  if (cam_json.contains("_id")) cam.id = std::stoi(cam_json["_id"].get<std::string>());
+  if (cam_json.contains("Position")) cam.position = parseVec3f(cam_json["Position"]);
+  if (cam_json.contains("Up")) cam.up = parseVec3f(cam_json["Up"]);
+  if (cam_json.contains("NearDistance")) cam.near_distance = std::stof(cam_json["NearDistance"].get<std::string>());
+  if (cam_json.contains("ImageResolution"))
+  {
+    const std::string resolution = cam_json["ImageResolution"].get<std::string>();
+    std::stringstream res_ss(resolution);
+    int width = 0, height = 0;
+    res_ss >> width >> height;
+    if (!res_ss || width <= 0 || height <= 0)
+      throw std::runtime_error("bad ImageResolution \"" + resolution + "\", expected a positive width and height");
+    cam.image_width = width;
+    cam.image_height = height;
+  }
+  if (cam_json.contains("ImageName")) cam.image_name = cam_json["ImageName"];
+
+  if (cam_json.contains("GazePoint"))
+  {
+    Vec3f_ gaze_point = parseVec3f(cam_json["GazePoint"]);
+    Vec3f_ gaze_vec = {
+        gaze_point.x - cam.position.x,
+        gaze_point.y - cam.position.y,
+        gaze_point.z - cam.position.z
+    };
+    float len = std::sqrt(gaze_vec.x * gaze_vec.x + gaze_vec.y * gaze_vec.y + gaze_vec.z * gaze_vec.z);
+    if (len > 0)
+    { // Avoid division by zero
+      gaze_vec.x /= len;
+      gaze_vec.y /= len;
+      gaze_vec.z /= len;
+    }
+    cam.gaze = gaze_vec;
+  }
+  else if (cam_json.contains("Gaze"))
+  {
+    cam.gaze = parseVec3f(cam_json["Gaze"]);
+  }
+
+  if (cam_json.contains("FovY"))
+  {
+    // Calculate 'near_plane' extents from FovY
+    float fov_y_degrees = std::stof(cam_json["FovY"].get<std::string>());
+    float aspect_ratio = (float)cam.image_width / (float)cam.image_height;
+
+    // Formula: top = near_distance * tan(fov_y / 2)
+    float fov_y_radians = fov_y_degrees * (M_PI / 180.0);
+    float t = cam.near_distance * std::tan(fov_y_radians / 2.0f);
+    float r = t * aspect_ratio;
+
+    cam.near_plane.l = -r;
+    cam.near_plane.r = r;
+    cam.near_plane.b = -t;
+    cam.near_plane.t = t;
+  }
+  else if (cam_json.contains("NearPlane"))
+  {
+    cam.near_plane = parseVec4f(cam_json["NearPlane"]);
+  }
+  else if (old_width > 0 && old_height > 0
+    && old_width * cam.image_height != cam.image_width * old_height)
+  {
+    // Resolution changed alone: keep the vertical extent, widen or narrow
+    // the horizontal one so pixels stay square.
+    float scale = ((float)cam.image_width / cam.image_height) / ((float)old_width / old_height);
+    cam.near_plane.l *= scale;
+    cam.near_plane.r *= scale;
+  }
+
+  if (!perpendicular(cam.gaze, cam.up))
+  {
+		float len_gaze = std::sqrt(cam.gaze.x * cam.gaze.x + cam.gaze.y * cam.gaze.y + cam.gaze.z * cam.gaze.z);
+		Vec3f_ w = Vec3f_{ -cam.gaze.x / len_gaze,
+      -cam.gaze.y / len_gaze,
+      -cam.gaze.z / len_gaze };
+		float len_up = std::sqrt(cam.up.x * cam.up.x + cam.up.y * cam.up.y + cam.up.z * cam.up.z);
+    Vec3f_ v_ = Vec3f_{ cam.up.x / len_up,
+      cam.up.y / len_up,
+			cam.up.z / len_up };
+    Vec3f_ u = crossProduct(v_, w);
+		Vec3f_ v = crossProduct(w, u);
+		cam.up = v;
+  }
+}
+
+static PointLight_ parsePointLight(const json& pl_json)
+{
+    PointLight_ pl;
+    pl.id = std::stoi(pl_json["_id"].get<std::string>());
+    pl.position = parseVec3f(pl_json["Position"]);
+    pl.intensity = parseVec3f(pl_json["Intensity"]);
+    return pl;
+}
+
+// Keys a material leaves out get zero, "none" for the type and 1 for the
+// refraction index.
+static Material_ parseMaterial(const json& mat_json)
+{
+    Material_ mat;
+    mat.id = std::stoi(mat_json["_id"].get<std::string>());
+    if (mat_json.contains("AmbientReflectance")) mat.ambient_reflectance = parseVec3f(mat_json["AmbientReflectance"]);
+		else mat.ambient_reflectance = { 0.0f, 0.0f, 0.0f };
+    if (mat_json.contains("DiffuseReflectance")) mat.diffuse_reflectance = parseVec3f(mat_json["DiffuseReflectance"]);
+		else mat.diffuse_reflectance = { 0.0f, 0.0f, 0.0f };
+    if (mat_json.contains("SpecularReflectance")) mat.specular_reflectance = parseVec3f(mat_json["SpecularReflectance"]);
+		else mat.specular_reflectance = { 0.0f, 0.0f, 0.0f };
+    if (mat_json.contains("PhongExponent")) mat.phong_exponent = std::stof(mat_json["PhongExponent"].get<std::string>());
+		else mat.phong_exponent = 0.0f;
+		if (mat_json.contains("_type")) mat.type = mat_json["_type"].get<std::string>();
+		else mat.type = "none";
+		if (mat_json.contains("MirrorReflectance")) mat.mirror_reflectance = parseVec3f(mat_json["MirrorReflectance"]);
+		else mat.mirror_reflectance = { 0.0f, 0.0f, 0.0f };
+		if (mat_json.contains("RefractionIndex")) mat.refraction_index = std::stof(mat_json["RefractionIndex"].get<std::string>());
+		else mat.refraction_index = 1.0f;
+		if (mat_json.contains("AbsorptionCoefficient")) mat.absorption_coefficient = parseVec3f(mat_json["AbsorptionCoefficient"]);
+		else mat.absorption_coefficient = { 0.0f, 0.0f, 0.0f };
+    if (mat_json.contains("AbsorptionIndex")) mat.absorption_index = std::stof(mat_json["AbsorptionIndex"].get<std::string>());
+		else mat.absorption_index = 0.0f;
+    return mat;
+}
+
 // --- UNIVERSAL, ROBUST PLY PARSER (ASCII + basic binary) ---
 namespace PlyHelpers
 {
@@ -152,6 +298,8 @@ namespace PlyHelpers
 void parsePlyFile(const std::string& ply_filename, Mesh_& mesh, Scene_& scene)
 {
   using namespace PlyHelpers;
+  TraceSpan span("ply", "parse");
+  span.arg("file", ply_filename);
 
   std::ifstream file(ply_filename, std::ios::binary);
   if (!file.is_open())
@@ -433,69 +581,8 @@ void parseScene(const std::string& filename, Scene_& scene) {
     // --- Cameras ---
     const auto& cameras_json = scene_json["Cameras"]["Camera"];
     auto parse_camera = [&](const json& cam_json) {
-      Camera_ cam;
-
-      cam.id = std::stoi(cam_json["_id"].get<std::string>());
-      cam.position = parseVec3f(cam_json["Position"]);
-      cam.up = parseVec3f(cam_json["Up"]);
-      cam.near_distance = std::stof(cam_json["NearDistance"].get<std::string>());
-      std::stringstream res_ss(cam_json["ImageResolution"].get<std::string>());
-      res_ss >> cam.image_width >> cam.image_height;
-      cam.image_name = cam_json["ImageName"];
-
-      if (cam_json.contains("GazePoint"))
-      {
-        Vec3f_ gaze_point = parseVec3f(cam_json["GazePoint"]);
-        Vec3f_ gaze_vec = {
-            gaze_point.x - cam.position.x,
-            gaze_point.y - cam.position.y,
-            gaze_point.z - cam.position.z
-        };
-        float len = std::sqrt(gaze_vec.x * gaze_vec.x + gaze_vec.y * gaze_vec.y + gaze_vec.z * gaze_vec.z);
-        if (len > 0)
-        { // Avoid division by zero
-          gaze_vec.x /= len;
-          gaze_vec.y /= len;
-          gaze_vec.z /= len;
-        }
-        cam.gaze = gaze_vec;
-
-        // 2. Calculate 'near_plane' extents from FovY
-        float fov_y_degrees = std::stof(cam_json["FovY"].get<std::string>());
-        float aspect_ratio = (float)cam.image_width / (float)cam.image_height;
-
-        // Formula: top = near_distance * tan(fov_y / 2)
-        float fov_y_radians = fov_y_degrees * (M_PI / 180.0);
-        float t = cam.near_distance * std::tan(fov_y_radians / 2.0f);
-        float r = t * aspect_ratio;
-
-        cam.near_plane.l = -r;
-        cam.near_plane.r = r;
-        cam.near_plane.b = -t;
-        cam.near_plane.t = t;
-      }
-      else
-      {
-        // --- TYPE 2: Your original camera format ---
-        cam.gaze = parseVec3f(cam_json["Gaze"]);
-        cam.near_plane = parseVec4f(cam_json["NearPlane"]);
-      }
-
-      if (!perpendicular(cam.gaze, cam.up))
-      {
-				float len_gaze = std::sqrt(cam.gaze.x * cam.gaze.x + cam.gaze.y * cam.gaze.y + cam.gaze.z * cam.gaze.z);
-				Vec3f_ w = Vec3f_{ -cam.gaze.x / len_gaze,
-          -cam.gaze.y / len_gaze,
-          -cam.gaze.z / len_gaze };
-				float len_up = std::sqrt(cam.up.x * cam.up.x + cam.up.y * cam.up.y + cam.up.z * cam.up.z);
-        Vec3f_ v_ = Vec3f_{ cam.up.x / len_up,
-          cam.up.y / len_up,
-					cam.up.z / len_up };
-        Vec3f_ u = crossProduct(v_, w);
-				Vec3f_ v = crossProduct(w, u);
-				cam.up = v;
-      }
-
+      Camera_ cam{};
+      applyCameraJson(cam_json, cam, true);
       scene.cameras.push_back(cam);
       };
 
@@ -512,11 +599,7 @@ void parseScene(const std::string& filename, Scene_& scene) {
     scene.ambient_light = parseVec3f(scene_json["Lights"]["AmbientLight"]);
     const auto& point_lights_json = scene_json["Lights"]["PointLight"];
     auto parse_point_light = [&](const json& pl_json) {
-        PointLight_ pl;
-        pl.id = std::stoi(pl_json["_id"].get<std::string>());
-        pl.position = parseVec3f(pl_json["Position"]);
-        pl.intensity = parseVec3f(pl_json["Intensity"]);
-        scene.point_lights.push_back(pl);
+        scene.point_lights.push_back(parsePointLight(pl_json));
     };
     if (point_lights_json.is_array()) {
         for (const auto& pl_json : point_lights_json) parse_point_light(pl_json);
@@ -527,27 +610,7 @@ void parseScene(const std::string& filename, Scene_& scene) {
     // --- Materials ---
     const auto& materials_json = scene_json["Materials"]["Material"];
     auto parse_material = [&](const json& mat_json) {
-        Material_ mat;
-        mat.id = std::stoi(mat_json["_id"].get<std::string>());
-        if (mat_json.contains("AmbientReflectance")) mat.ambient_reflectance = parseVec3f(mat_json["AmbientReflectance"]);
-				else mat.ambient_reflectance = { 0.0f, 0.0f, 0.0f };
-        if (mat_json.contains("DiffuseReflectance")) mat.diffuse_reflectance = parseVec3f(mat_json["DiffuseReflectance"]);
-				else mat.diffuse_reflectance = { 0.0f, 0.0f, 0.0f };
-        if (mat_json.contains("SpecularReflectance")) mat.specular_reflectance = parseVec3f(mat_json["SpecularReflectance"]);
-				else mat.specular_reflectance = { 0.0f, 0.0f, 0.0f };
-        if (mat_json.contains("PhongExponent")) mat.phong_exponent = std::stof(mat_json["PhongExponent"].get<std::string>());
-				else mat.phong_exponent = 0.0f;
-				if (mat_json.contains("_type")) mat.type = mat_json["_type"].get<std::string>();
-				else mat.type = "none";
-				if (mat_json.contains("MirrorReflectance")) mat.mirror_reflectance = parseVec3f(mat_json["MirrorReflectance"]);
-				else mat.mirror_reflectance = { 0.0f, 0.0f, 0.0f };
-				if (mat_json.contains("RefractionIndex")) mat.refraction_index = std::stof(mat_json["RefractionIndex"].get<std::string>());
-				else mat.refraction_index = 1.0f;
-				if (mat_json.contains("AbsorptionCoefficient")) mat.absorption_coefficient = parseVec3f(mat_json["AbsorptionCoefficient"]);
-				else mat.absorption_coefficient = { 0.0f, 0.0f, 0.0f };
-        if (mat_json.contains("AbsorptionIndex")) mat.absorption_index = std::stof(mat_json["AbsorptionIndex"].get<std::string>());
-				else mat.absorption_index = 0.0f;
-        scene.materials.push_back(mat);
+        scene.materials.push_back(parseMaterial(mat_json));
     };
     if (materials_json.is_array()) {
         for (const auto& mat_json : materials_json) parse_material(mat_json);
@@ -673,6 +736,209 @@ void parseScene(const std::string& filename, Scene_& scene) {
      }
 }
 
+bool parseRenderJob(const std::string& line, const Scene_& scene, RenderJob_& job, std::string& error)
+{
+  try
+  {
+    json j = json::parse(line);
+    if (j.contains("Command"))
+    {
+      if (j["Command"].get<std::string>() != "shutdown")
+      {
+        error = "unknown command";
+        return false;
+      }
+      job.shutdown = true;
+      return true;
+    }
+    if (scene.cameras.empty())
+    {
+      error = "scene has no camera";
+      return false;
+    }
+
+    // Start from the scene camera with the requested id, the first by default
+    job.camera = scene.cameras.front();
+    if (j.contains("CameraId"))
+    {
+      int id = std::stoi(j["CameraId"].get<std::string>());
+      auto it = std::find_if(scene.cameras.begin(), scene.cameras.end(),
+        [id](const Camera_& cam) { return cam.id == id; });
+      if (it == scene.cameras.end())
+      {
+        error = "no camera with id " + std::to_string(id);
+        return false;
+      }
+      job.camera = *it;
+    }
+    if (j.contains("Camera")) applyCameraJson(j["Camera"], job.camera, false);
+
+    if (!j.contains("Output"))
+    {
+      error = "job has no Output";
+      return false;
+    }
+    job.output_path = j["Output"].get<std::string>();
+
+    // Materials and spheres are changed in place, so only ones the scene
+    // already has can be given; a light with a new id is added.
+    if (j.contains("Lights"))
+    {
+      const json& lights_json = j["Lights"];
+      if (lights_json.contains("AmbientLight"))
+      {
+        job.has_ambient_light = true;
+        job.ambient_light = parseVec3f(lights_json["AmbientLight"]);
+      }
+      if (lights_json.contains("PointLight"))
+      {
+        const json& point_lights_json = lights_json["PointLight"];
+        if (point_lights_json.is_array())
+        {
+          for (const auto& pl_json : point_lights_json) job.point_lights.push_back(parsePointLight(pl_json));
+        }
+        else
+        {
+          job.point_lights.push_back(parsePointLight(point_lights_json));
+        }
+      }
+    }
+    if (j.contains("Materials") && j["Materials"].contains("Material"))
+    {
+      const json& materials_json = j["Materials"]["Material"];
+      if (materials_json.is_array())
+      {
+        for (const auto& mat_json : materials_json) job.materials.push_back(parseMaterial(mat_json));
+      }
+      else
+      {
+        job.materials.push_back(parseMaterial(materials_json));
+      }
+    }
+    if (j.contains("Objects") && j["Objects"].contains("Sphere"))
+    {
+      const json& spheres_json = j["Objects"]["Sphere"];
+      auto parse_sphere_edit = [&](const json& sphere_json) {
+        SphereEdit_ edit;
+        edit.id = std::stoi(sphere_json["_id"].get<std::string>());
+        if (sphere_json.contains("Position"))
+        {
+          edit.has_center = true;
+          edit.center = parseVec3f(sphere_json["Position"]);
+        }
+        if (sphere_json.contains("Radius"))
+        {
+          edit.has_radius = true;
+          edit.radius = std::stof(sphere_json["Radius"].get<std::string>());
+        }
+        if (sphere_json.contains("Material"))
+        {
+          edit.has_material = true;
+          edit.material_id = std::stoi(sphere_json["Material"].get<std::string>());
+        }
+        job.sphere_edits.push_back(edit);
+      };
+      if (spheres_json.is_array())
+      {
+        for (const auto& sphere_json : spheres_json) parse_sphere_edit(sphere_json);
+      }
+      else
+      {
+        parse_sphere_edit(spheres_json);
+      }
+    }
+    // Sphere ids are checked by LoadedScene::applyChanges, which knows
+    // whether the spheres were built here.
+    for (const SphereEdit_& edit : job.sphere_edits)
+    {
+      if (edit.has_material && std::none_of(scene.materials.begin(), scene.materials.end(),
+        [&edit](const Material_& other) { return other.id == edit.material_id; }))
+      {
+        error = "no material with id " + std::to_string(edit.material_id);
+        return false;
+      }
+    }
+    for (const Material_& mat : job.materials)
+    {
+      if (std::none_of(scene.materials.begin(), scene.materials.end(),
+        [&mat](const Material_& other) { return other.id == mat.id; }))
+      {
+        error = "no material with id " + std::to_string(mat.id);
+        return false;
+      }
+    }
+    return true;
+  }
+  catch (const std::exception& e)
+  {
+    error = e.what();
+    return false;
+  }
+}
+
+static ObjectTransform_ parseObjectTransform(const json& transform_json)
+{
+  ObjectTransform_ transform;
+  transform.id = std::stoi(transform_json["_id"].get<std::string>());
+  if (transform_json.contains("Scaling"))
+  {
+    std::stringstream ss(transform_json["Scaling"].get<std::string>());
+    float sx, sy, sz;
+    ss >> sx;
+    if (ss >> sy >> sz) transform.scaling = { sx, sy, sz };
+    else transform.scaling = { sx, sx, sx };
+  }
+  if (transform_json.contains("Rotation"))
+  {
+    std::stringstream ss(transform_json["Rotation"].get<std::string>());
+    ss >> transform.rotation_angle >> transform.rotation_axis.x >> transform.rotation_axis.y >> transform.rotation_axis.z;
+  }
+  if (transform_json.contains("Translation")) transform.translation = parseVec3f(transform_json["Translation"]);
+  return transform;
+}
+
+bool parseFrameSequence(const std::string& filename, std::vector<Frame_>& frames, std::string& error)
+{
+  try
+  {
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+      error = "could not open " + filename;
+      return false;
+    }
+    json j = json::parse(file);
+    if (!j.contains("Frames") || !j["Frames"].is_array())
+    {
+      error = filename + " has no Frames array";
+      return false;
+    }
+    auto parse_transforms = [](const json& transforms_json, std::vector<ObjectTransform_>& transforms) {
+      if (transforms_json.is_array())
+      {
+        for (const auto& transform_json : transforms_json) transforms.push_back(parseObjectTransform(transform_json));
+      }
+      else
+      {
+        transforms.push_back(parseObjectTransform(transforms_json));
+      }
+    };
+    for (const auto& frame_json : j["Frames"])
+    {
+      Frame_ frame;
+      if (frame_json.contains("Mesh")) parse_transforms(frame_json["Mesh"], frame.meshes);
+      if (frame_json.contains("Sphere")) parse_transforms(frame_json["Sphere"], frame.spheres);
+      frames.push_back(frame);
+    }
+    return true;
+  }
+  catch (const std::exception& e)
+  {
+    error = e.what();
+    return false;
+  }
+}
+
 // A simple function to print a summary of the parsed scene
 void printSceneSummary(const Scene_& scene) {
     std::cout << "--- Scene parsing successful ---" << std::endl;
@@ -0,0 +1,178 @@
+#include "../include/render_stats.h"
+#include "../external/json.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+
+static std::mutex totals_mutex;
+static RenderCounters total_counters;
+static double stage_seconds[static_cast<int>(Stage::Count)] = {};
+static BvhStats bvh_stats;
+
+void RenderStats::flushThread()
+{
+  RenderCounters& counters = local();
+  std::lock_guard<std::mutex> lock(totals_mutex);
+  total_counters.add(counters);
+  counters = RenderCounters();
+}
+
+RenderCounters RenderStats::totals()
+{
+  std::lock_guard<std::mutex> lock(totals_mutex);
+  return total_counters;
+}
+
+void RenderStats::addStageTime(Stage stage, double seconds)
+{
+  std::lock_guard<std::mutex> lock(totals_mutex);
+  stage_seconds[static_cast<int>(stage)] += seconds;
+}
+
+double RenderStats::stageSeconds(Stage stage)
+{
+  std::lock_guard<std::mutex> lock(totals_mutex);
+  return stage_seconds[static_cast<int>(stage)];
+}
+
+const char* RenderStats::stageName(Stage stage)
+{
+  switch (stage)
+  {
+  case Stage::Parse: return "parse";
+  case Stage::Normals: return "normals";
+  case Stage::Bvh: return "bvh_build";
+  case Stage::Render: return "render";
+  case Stage::Encode: return "encode";
+  default: return "unknown";
+  }
+}
+
+void RenderStats::setBvhStats(const BvhStats& stats)
+{
+  std::lock_guard<std::mutex> lock(totals_mutex);
+  bvh_stats = stats;
+}
+
+BvhStats RenderStats::bvhStats()
+{
+  std::lock_guard<std::mutex> lock(totals_mutex);
+  return bvh_stats;
+}
+
+void RenderStats::reset()
+{
+  std::lock_guard<std::mutex> lock(totals_mutex);
+  total_counters = RenderCounters();
+  bvh_stats = BvhStats();
+  for (double& seconds : stage_seconds)
+    seconds = 0.0;
+}
+
+static double perRay(long long count, long long rays)
+{
+  return rays > 0 ? static_cast<double>(count) / rays : 0.0;
+}
+
+void RenderStats::printSummary(std::ostream& out)
+{
+  RenderCounters counters = totals();
+  long long rays = counters.totalRays();
+  double render_seconds = stageSeconds(Stage::Render);
+
+  out << "Render statistics" << std::endl;
+  for (int i = 0; i < static_cast<int>(Stage::Count); i++)
+  {
+    Stage stage = static_cast<Stage>(i);
+    out << "  " << std::left << std::setw(12) << stageName(stage) << std::right
+      << std::fixed << std::setprecision(3) << std::setw(10) << stageSeconds(stage) << " s"
+      << std::defaultfloat << std::setprecision(6) << std::endl;
+  }
+  out << "  rays: " << counters.primary_rays << " primary, " << counters.shadow_rays << " shadow, "
+    << counters.reflection_rays << " reflection, " << counters.refraction_rays << " refraction"
+    << " (" << rays << " total";
+  if (render_seconds > 0.0)
+    out << ", " << static_cast<long long>(rays / render_seconds) << " rays/s";
+  out << ")" << std::endl;
+  out << "  per ray: " << perRay(counters.node_tests, rays) << " BVH node tests, "
+    << perRay(counters.primitive_tests, rays) << " primitive tests" << std::endl;
+
+  BvhStats bvh = bvhStats();
+  if (!bvh.builder.empty())
+  {
+    out << "  bvh: " << bvh.builder << " builder, " << bvh.nodes << " nodes, "
+      << bvh.references << " references to " << bvh.primitives << " primitives, traversal cost "
+      << bvh.traversal_cost << std::endl;
+    if (bvh.compressed_nodes > 0)
+    {
+      out << "  compressed bvh: " << bvh.compressed_nodes << " nodes, " << bvh.compressed_bytes / 1024.0
+        << " KB against " << bvh.node_bytes / 1024.0 << " KB of binary nodes" << std::endl;
+    }
+  }
+
+  if (counters.primary_hit_repeats > 0)
+  {
+    out << "  primary coherence: " << (100.0 * counters.primary_hit_repeats / counters.primary_rays)
+      << "% of primary rays hit the previous ray's primitive" << std::endl;
+  }
+
+  long long cache_lookups = counters.occluder_cache_hits + counters.occluder_cache_misses;
+  if (cache_lookups > 0)
+  {
+    out << "  shadow occluder cache: " << counters.occluder_cache_hits << " hits, "
+      << counters.occluder_cache_misses << " misses ("
+      << (100.0 * counters.occluder_cache_hits / cache_lookups) << "% hit rate)" << std::endl;
+  }
+}
+
+bool RenderStats::writeJson(const std::string& path)
+{
+  RenderCounters counters = totals();
+  nlohmann::json stats;
+  for (int i = 0; i < static_cast<int>(Stage::Count); i++)
+  {
+    Stage stage = static_cast<Stage>(i);
+    stats["seconds"][stageName(stage)] = stageSeconds(stage);
+  }
+  stats["rays"] = {
+    {"primary", counters.primary_rays},
+    {"shadow", counters.shadow_rays},
+    {"reflection", counters.reflection_rays},
+    {"refraction", counters.refraction_rays},
+    {"total", counters.totalRays()}
+  };
+  stats["node_tests"] = counters.node_tests;
+  stats["primitive_tests"] = counters.primitive_tests;
+  stats["node_tests_per_ray"] = perRay(counters.node_tests, counters.totalRays());
+  stats["primitive_tests_per_ray"] = perRay(counters.primitive_tests, counters.totalRays());
+  BvhStats bvh = bvhStats();
+  if (!bvh.builder.empty())
+  {
+    stats["bvh"] = {
+      {"builder", bvh.builder},
+      {"nodes", bvh.nodes},
+      {"references", bvh.references},
+      {"primitives", bvh.primitives},
+      {"traversal_cost", bvh.traversal_cost},
+      {"node_bytes", bvh.node_bytes},
+      {"compressed_nodes", bvh.compressed_nodes},
+      {"compressed_bytes", bvh.compressed_bytes}
+    };
+  }
+  stats["primary_hit_repeats"] = counters.primary_hit_repeats;
+  stats["occluder_cache"] = {
+    {"hits", counters.occluder_cache_hits},
+    {"misses", counters.occluder_cache_misses}
+  };
+
+  std::ofstream file(path);
+  if (!file.is_open())
+  {
+    std::cerr << "Could not write render statistics: " << path << std::endl;
+    return false;
+  }
+  file << stats.dump(2) << std::endl;
+  return true;
+}
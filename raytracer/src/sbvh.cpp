@@ -0,0 +1,323 @@
+#include "../include/sbvh.h"
+#include "../objects/triangle.h"
+
+#include <stdexcept>
+
+// Planes spatial splits are tried at, per axis.
+constexpr int SPATIAL_BIN_COUNT = 32;
+// Spatial splits are tried where the children of the best object split
+// overlap by more than this fraction of the root's surface area.
+constexpr double SPATIAL_OVERLAP_THRESHOLD = 1e-5;
+// Nodes deeper than this only take object splits.
+constexpr int SPATIAL_MAX_DEPTH = 48;
+
+// One primitive, or the part of it within box.
+typedef struct Reference {
+	int object;
+	AABB box;
+}Reference;
+
+typedef struct SplitCandidate {
+	double cost = INFINITY;
+	int axis = 0;
+	double position = 0.0; // spatial splits: the plane
+	int count = 0;         // object splits: references going left
+	AABB left_box;
+	AABB right_box;
+}SplitCandidate;
+
+typedef struct SpatialBin {
+	AABB box;
+	int entries = 0; // references starting in this bin
+	int exits = 0;   // references ending in this bin
+}SpatialBin;
+
+// Boxes here are grown without AABB's thickening, which would compound at
+// every merge; the primitives' own boxes are already thickened.
+static Interval& axisOf(AABB& box, int axis)
+{
+	return axis == 0 ? box.x : axis == 1 ? box.y : box.z;
+}
+
+static void grow(AABB& box, const AABB& other)
+{
+	box.x = Interval(box.x, other.x);
+	box.y = Interval(box.y, other.y);
+	box.z = Interval(box.z, other.z);
+}
+
+static void grow(AABB& box, const Vec3& point)
+{
+	box.x = Interval(box.x, Interval(point.x, point.x));
+	box.y = Interval(box.y, Interval(point.y, point.y));
+	box.z = Interval(box.z, Interval(point.z, point.z));
+}
+
+static AABB intersection(const AABB& a, const AABB& b)
+{
+	AABB box;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		axisOf(box, axis) = Interval(std::max(a[axis].min, b[axis].min), std::min(a[axis].max, b[axis].max));
+	}
+	return box;
+}
+
+static double area(const AABB& box)
+{
+	if (box.x.max < box.x.min || box.y.max < box.y.min || box.z.max < box.z.min)
+		return 0.0;
+	return box.surfaceArea();
+}
+
+static double centroid(const Reference& ref, int axis)
+{
+	return ref.box[axis].min + ref.box[axis].max;
+}
+
+class SpatialBvhBuilder {
+public:
+	SpatialBvhBuilder(const std::vector<std::shared_ptr<Hittable>>& objects, double duplication_budget)
+		: objects(objects),
+		duplicates_left(static_cast<long long>(duplication_budget * objects.size()))
+	{
+		for (const auto& object : objects)
+			triangles.push_back(dynamic_cast<const Triangle*>(object.get()));
+	}
+
+	BvhNode build()
+	{
+		std::vector<Reference> refs;
+		AABB bounds;
+		for (size_t i = 0; i < objects.size(); i++)
+		{
+			refs.push_back(Reference{ static_cast<int>(i), objects[i]->getAABB() });
+			grow(bounds, refs.back().box);
+		}
+		min_overlap = SPATIAL_OVERLAP_THRESHOLD * area(bounds);
+
+		if (refs.size() == 1)
+			return BvhNode(objects[0], objects[0], bounds);
+		std::shared_ptr<Hittable> root = buildNode(refs, 0);
+		return *std::static_pointer_cast<BvhNode>(root);
+	}
+
+private:
+	std::shared_ptr<Hittable> buildNode(std::vector<Reference>& refs, int depth)
+	{
+		AABB bounds;
+		for (const Reference& ref : refs)
+			grow(bounds, ref.box);
+		if (refs.size() == 1)
+			return objects[refs[0].object];
+		if (refs.size() == 2)
+			return std::make_shared<BvhNode>(objects[refs[0].object], objects[refs[1].object], bounds);
+
+		SplitCandidate object_split = findObjectSplit(refs);
+		std::vector<Reference> left, right;
+		bool split = false;
+		if (depth < SPATIAL_MAX_DEPTH && duplicates_left > 0
+			&& area(intersection(object_split.left_box, object_split.right_box)) > min_overlap)
+		{
+			SplitCandidate spatial_split = findSpatialSplit(refs, bounds);
+			if (spatial_split.cost < object_split.cost)
+				split = performSpatialSplit(refs, spatial_split, left, right);
+		}
+		if (!split)
+			performObjectSplit(refs, object_split, left, right);
+		std::vector<Reference>().swap(refs);
+
+		std::shared_ptr<Hittable> left_child = buildNode(left, depth + 1);
+		std::shared_ptr<Hittable> right_child = buildNode(right, depth + 1);
+		return std::make_shared<BvhNode>(left_child, right_child, bounds);
+	}
+
+	// The best split of refs, sorted by centroid, into a prefix and the rest.
+	SplitCandidate findObjectSplit(std::vector<Reference>& refs) const
+	{
+		const int n = static_cast<int>(refs.size());
+		SplitCandidate best;
+		std::vector<AABB> right_boxes(n);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			sortByCentroid(refs, axis);
+			AABB right_box;
+			for (int i = n - 1; i > 0; i--)
+			{
+				grow(right_box, refs[i].box);
+				right_boxes[i] = right_box;
+			}
+			AABB left_box;
+			for (int i = 1; i < n; i++)
+			{
+				grow(left_box, refs[i - 1].box);
+				double cost = area(left_box) * i + area(right_boxes[i]) * (n - i);
+				if (cost < best.cost)
+				{
+					best.cost = cost;
+					best.axis = axis;
+					best.count = i;
+					best.left_box = left_box;
+					best.right_box = right_boxes[i];
+				}
+			}
+		}
+		return best;
+	}
+
+	void performObjectSplit(std::vector<Reference>& refs, const SplitCandidate& split,
+		std::vector<Reference>& left, std::vector<Reference>& right) const
+	{
+		sortByCentroid(refs, split.axis);
+		left.assign(refs.begin(), refs.begin() + split.count);
+		right.assign(refs.begin() + split.count, refs.end());
+	}
+
+	// Bins every reference, chopped at the bin planes, along each axis and
+	// sweeps the planes between bins.
+	SplitCandidate findSpatialSplit(const std::vector<Reference>& refs, const AABB& bounds) const
+	{
+		SplitCandidate best;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const double origin = bounds[axis].min;
+			const double bin_width = bounds[axis].getLength() / SPATIAL_BIN_COUNT;
+			if (bin_width <= 0.0) continue;
+
+			SpatialBin bins[SPATIAL_BIN_COUNT];
+			for (const Reference& ref : refs)
+			{
+				int first = binIndex(ref.box[axis].min, origin, bin_width);
+				int last = binIndex(ref.box[axis].max, origin, bin_width);
+				Reference rest = ref;
+				for (int bin = first; bin < last; bin++)
+				{
+					Reference piece;
+					splitReference(rest, axis, origin + (bin + 1) * bin_width, piece, rest);
+					grow(bins[bin].box, piece.box);
+				}
+				grow(bins[last].box, rest.box);
+				bins[first].entries++;
+				bins[last].exits++;
+			}
+
+			AABB right_boxes[SPATIAL_BIN_COUNT];
+			AABB right_box;
+			for (int bin = SPATIAL_BIN_COUNT - 1; bin > 0; bin--)
+			{
+				grow(right_box, bins[bin].box);
+				right_boxes[bin] = right_box;
+			}
+			AABB left_box;
+			int left_count = 0;
+			int right_count = static_cast<int>(refs.size());
+			for (int bin = 1; bin < SPATIAL_BIN_COUNT; bin++)
+			{
+				grow(left_box, bins[bin - 1].box);
+				left_count += bins[bin - 1].entries;
+				right_count -= bins[bin - 1].exits;
+				double cost = area(left_box) * left_count + area(right_boxes[bin]) * right_count;
+				if (cost < best.cost)
+				{
+					best.cost = cost;
+					best.axis = axis;
+					best.position = origin + bin * bin_width;
+				}
+			}
+		}
+		return best;
+	}
+
+	// Refuses splits that leave a side with every reference, which would not
+	// shrink the problem, or that run over the duplication budget.
+	bool performSpatialSplit(const std::vector<Reference>& refs, const SplitCandidate& split,
+		std::vector<Reference>& left, std::vector<Reference>& right)
+	{
+		for (const Reference& ref : refs)
+		{
+			if (ref.box[split.axis].max <= split.position)
+				left.push_back(ref);
+			else if (ref.box[split.axis].min >= split.position)
+				right.push_back(ref);
+			else
+			{
+				Reference left_piece, right_piece;
+				splitReference(ref, split.axis, split.position, left_piece, right_piece);
+				left.push_back(left_piece);
+				right.push_back(right_piece);
+			}
+		}
+		const long long duplicates = static_cast<long long>(left.size() + right.size() - refs.size());
+		if (left.size() == refs.size() || right.size() == refs.size() || duplicates > duplicates_left)
+		{
+			left.clear();
+			right.clear();
+			return false;
+		}
+		duplicates_left -= duplicates;
+		return true;
+	}
+
+	// Cuts ref at the plane. A triangle's pieces are bounded by its corners
+	// and edge crossings on each side; other primitives keep their box,
+	// cut at the plane.
+	void splitReference(const Reference& ref, int axis, double position,
+		Reference& left, Reference& right) const
+	{
+		AABB left_box, right_box;
+		if (const Triangle* triangle = triangles[ref.object])
+		{
+			const Vec3* corners = triangle->getData().indices;
+			for (int i = 0; i < 3; i++)
+			{
+				const Vec3& from = corners[i];
+				const Vec3& to = corners[(i + 1) % 3];
+				if (from[axis] <= position) grow(left_box, from);
+				if (from[axis] >= position) grow(right_box, from);
+				if ((from[axis] < position && to[axis] > position) || (from[axis] > position && to[axis] < position))
+				{
+					Vec3 crossing = from + (to - from) * ((position - from[axis]) / (to[axis] - from[axis]));
+					grow(left_box, crossing);
+					grow(right_box, crossing);
+				}
+			}
+			left_box.thicken();
+			right_box.thicken();
+		}
+		else
+		{
+			left_box = ref.box;
+			right_box = ref.box;
+		}
+		axisOf(left_box, axis).max = std::min(axisOf(left_box, axis).max, position);
+		axisOf(right_box, axis).min = std::max(axisOf(right_box, axis).min, position);
+
+		left = Reference{ ref.object, intersection(left_box, ref.box) };
+		right = Reference{ ref.object, intersection(right_box, ref.box) };
+	}
+
+	static int binIndex(double value, double origin, double bin_width)
+	{
+		int bin = static_cast<int>((value - origin) / bin_width);
+		return std::max(0, std::min(bin, SPATIAL_BIN_COUNT - 1));
+	}
+
+	static void sortByCentroid(std::vector<Reference>& refs, int axis)
+	{
+		std::sort(refs.begin(), refs.end(), [axis](const Reference& a, const Reference& b) {
+			return centroid(a, axis) < centroid(b, axis);
+		});
+	}
+
+	const std::vector<std::shared_ptr<Hittable>>& objects;
+	std::vector<const Triangle*> triangles; // null for other primitives
+	long long duplicates_left;
+	double min_overlap = 0.0;
+};
+
+BvhNode buildSpatialBvh(const std::vector<std::shared_ptr<Hittable>>& objects, double duplication_budget)
+{
+	if (objects.empty())
+		throw std::runtime_error("Objects is empty");
+	return SpatialBvhBuilder(objects, duplication_budget).build();
+}
@@ -0,0 +1,115 @@
+#include "../include/trace_recorder.h"
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+typedef struct TraceEvent {
+  const char* name;
+  const char* category;
+  long long start_us;
+  long long duration_us;
+  std::string args;
+}TraceEvent;
+
+// Outlives its thread so the events can be written after the workers exit.
+typedef struct ThreadTrace {
+  int tid;
+  std::string name;
+  std::vector<TraceEvent> events;
+}ThreadTrace;
+
+static std::chrono::steady_clock::time_point trace_start;
+static std::mutex traces_mutex;
+static std::vector<std::unique_ptr<ThreadTrace>> thread_traces;
+
+static ThreadTrace& threadTrace()
+{
+  thread_local ThreadTrace* trace = nullptr;
+  if (!trace)
+  {
+    std::lock_guard<std::mutex> lock(traces_mutex);
+    thread_traces.push_back(std::make_unique<ThreadTrace>());
+    trace = thread_traces.back().get();
+    trace->tid = static_cast<int>(thread_traces.size());
+  }
+  return *trace;
+}
+
+static std::string escapeJson(const std::string& text)
+{
+  std::string escaped;
+  for (char c : text)
+  {
+    if (c == '"' || c == '\\') escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
+void TraceSpan::arg(const char* key, const std::string& value)
+{
+  if (active) appendArg(key, "\"" + escapeJson(value) + "\"");
+}
+
+void TraceRecorder::start()
+{
+  trace_start = std::chrono::steady_clock::now();
+  recording = true;
+  setThreadName("main");
+}
+
+long long TraceRecorder::now()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - trace_start).count();
+}
+
+void TraceRecorder::record(const char* name, const char* category, long long start_us,
+  long long duration_us, const std::string& args)
+{
+  threadTrace().events.push_back(TraceEvent{ name, category, start_us, duration_us, args });
+}
+
+void TraceRecorder::setThreadName(const std::string& name)
+{
+  if (enabled()) threadTrace().name = name;
+}
+
+bool TraceRecorder::write(const std::string& path)
+{
+  std::ofstream file(path);
+  if (!file.is_open())
+  {
+    std::cerr << "Could not write trace: " << path << std::endl;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(traces_mutex);
+  file << "{\"traceEvents\": [\n";
+  bool first = true;
+  for (const auto& trace : thread_traces)
+  {
+    if (!trace->name.empty())
+    {
+      file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+        << trace->tid << ", \"args\": {\"name\": \"" << escapeJson(trace->name) << "\"}}";
+      first = false;
+    }
+    for (const TraceEvent& event : trace->events)
+    {
+      file << (first ? "" : ",\n") << "{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category
+        << "\", \"ph\": \"X\", \"ts\": " << event.start_us << ", \"dur\": " << event.duration_us
+        << ", \"pid\": 1, \"tid\": " << trace->tid;
+      if (!event.args.empty())
+        file << ", \"args\": {" << event.args << "}";
+      file << "}";
+      first = false;
+    }
+  }
+  file << "\n], \"displayTimeUnit\": \"ms\"}\n";
+  std::cout << "Trace written to " << path << std::endl;
+  return true;
+}
@@ -0,0 +1,114 @@
+#include "verify.h"
+#include "../io/png_reader.h"
+#include "../io/stb_image_write.h"
+#include "../include/false_color.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+
+static std::filesystem::path defaultReferenceDir(const std::string& scene_filename)
+{
+  // inputs/raven/rt_raven.json -> outputs/raven/
+  std::filesystem::path scene_dir = std::filesystem::path(scene_filename).parent_path();
+  std::filesystem::path reference_dir;
+  std::vector<std::filesystem::path> parts(scene_dir.begin(), scene_dir.end());
+  auto inputs = std::find(parts.rbegin(), parts.rend(), std::filesystem::path("inputs"));
+  for (auto it = parts.begin(); it != parts.end(); ++it)
+  {
+    if (inputs != parts.rend() && it == inputs.base() - 1)
+      reference_dir /= "outputs";
+    else
+      reference_dir /= *it;
+  }
+  return reference_dir;
+}
+
+ImageDiff compareImages(const std::vector<unsigned char>& rendered,
+  const std::vector<unsigned char>& reference, int width, int height)
+{
+  ImageDiff diff;
+  size_t pixel_count = size_t(width) * height;
+  std::vector<int> errors(pixel_count);
+  double squared_error = 0.0;
+  for (size_t i = 0; i < pixel_count; i++)
+  {
+    int pixel_error = 0;
+    for (int channel = 0; channel < 3; channel++)
+    {
+      int d = int(rendered[i * 3 + channel]) - int(reference[i * 3 + channel]);
+      squared_error += d * d;
+      pixel_error = std::max(pixel_error, std::abs(d));
+    }
+    errors[i] = pixel_error;
+    diff.max_error = std::max(diff.max_error, pixel_error);
+    if (pixel_error > 0) diff.differing_pixels++;
+  }
+
+  double mse = squared_error / (3.0 * pixel_count);
+  diff.psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse)
+    : std::numeric_limits<double>::infinity();
+
+  diff.heatmap.resize(pixel_count * 3);
+  for (size_t i = 0; i < pixel_count; i++)
+    falseColor(diff.max_error > 0 ? static_cast<double>(errors[i]) / diff.max_error : 0.0,
+      &diff.heatmap[i * 3]);
+  return diff;
+}
+
+bool verifyScene(const LoadedScene& loaded_scene, const std::string& scene_filename,
+  const VerifyOptions& verify_options)
+{
+  const std::filesystem::path reference_dir = verify_options.reference_dir.empty()
+    ? defaultReferenceDir(scene_filename) : std::filesystem::path(verify_options.reference_dir);
+  const std::filesystem::path output_dir = "./output";
+  const RenderManager& render_manager = loaded_scene.render_manager;
+  if (!render_manager.createOutputDirectory(output_dir))
+    return false;
+
+  bool passed = true;
+  for (const Camera& cam : loaded_scene.scene.cameras)
+  {
+    std::vector<std::vector<Color>> image;
+    cam.render(loaded_scene.ray_tracer, image);
+    render_manager.saveImage(output_dir.string(), cam.image_name, image);
+
+    const std::filesystem::path reference_path = reference_dir / cam.image_name;
+    int width = 0, height = 0;
+    std::vector<unsigned char> reference;
+    if (!readPng(reference_path.string(), width, height, reference))
+    {
+      std::cout << "FAIL " << cam.image_name << ": no usable reference at "
+        << reference_path.string() << std::endl;
+      passed = false;
+      continue;
+    }
+    int rendered_height = image.size();
+    int rendered_width = rendered_height > 0 ? image[0].size() : 0;
+    if (rendered_width != width || rendered_height != height)
+    {
+      std::cout << "FAIL " << cam.image_name << ": rendered " << rendered_width << "x"
+        << rendered_height << ", reference is " << width << "x" << height << std::endl;
+      passed = false;
+      continue;
+    }
+
+    ImageDiff diff = compareImages(RenderManager::quantizeImage(image), reference, width, height);
+    std::filesystem::path heatmap_path = output_dir
+      / (std::filesystem::path(cam.image_name).stem().string() + "_diff.png");
+    if (!stbi_write_png(heatmap_path.string().c_str(), width, height, 3,
+      diff.heatmap.data(), width * 3))
+      std::cerr << "Error: Could not save image: " << heatmap_path.string() << std::endl;
+
+    bool image_passed = diff.psnr >= verify_options.min_psnr
+      && diff.max_error <= verify_options.max_error;
+    std::cout << (image_passed ? "PASS " : "FAIL ") << cam.image_name
+      << ": PSNR " << diff.psnr << " dB, max error " << diff.max_error
+      << ", " << diff.differing_pixels << " of " << size_t(width) * height
+      << " pixels differ (heatmap " << heatmap_path.string() << ")" << std::endl;
+    passed = passed && image_passed;
+  }
+  return passed;
+}
@@ -0,0 +1,34 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <string>
+#include <vector>
+#include "../scene/loaded_scene.h"
+
+typedef struct VerifyOptions {
+  // Directory holding the reference PNGs. Empty means the outputs/ directory
+  // that mirrors the scene's place under inputs/.
+  std::string reference_dir;
+  double min_psnr = 40.0; // dB
+  int max_error = 255;    // largest allowed per-channel difference
+}VerifyOptions;
+
+typedef struct ImageDiff {
+  double psnr = 0.0;          // infinite for identical images
+  int max_error = 0;          // largest per-channel difference, 0-255
+  long long differing_pixels = 0;
+  std::vector<unsigned char> heatmap; // RGB false color, scaled to max_error
+}ImageDiff;
+
+// Compares two 8-bit RGB images of the same size.
+ImageDiff compareImages(const std::vector<unsigned char>& rendered,
+  const std::vector<unsigned char>& reference, int width, int height);
+
+// Renders every camera of the scene, saves the image as usual, compares it
+// with the reference PNG of the same name and writes <name>_diff.png next to
+// it. Returns false if a reference is missing or any image falls outside the
+// tolerances.
+bool verifyScene(const LoadedScene& loaded_scene, const std::string& scene_filename,
+  const VerifyOptions& verify_options);
+
+#endif // VERIFY_H